@@ -340,4 +340,26 @@ int as_valid_write_addr(struct addrspace *as, vaddr_t *check_addr){
     }
     return 0;
 }
+/*
+ * Check that every byte of [start, start + len) lies in one of the two
+ * regions or the stack, stepping from the end of one into the next.
+ */
+int as_valid_range(struct addrspace *as, vaddr_t start, size_t len){
+    vaddr_t end = start + len;
+    if(end < start){
+        return 0; //wrapped around
+    }
+    while(start < end){
+        if(start >= as->as_vbase1 && start < as->as_vbase1 + as->as_npages1 * PAGE_SIZE){
+            start = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
+        } else if(start >= as->as_vbase2 && start < as->as_vbase2 + as->as_npages2 * PAGE_SIZE){
+            start = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+        } else if(start >= USERTOP - DUMBVM_STACKPAGES * PAGE_SIZE && start < USERTOP){
+            start = USERTOP;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
 #endif /* OPT_A2 */
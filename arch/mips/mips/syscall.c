@@ -8,6 +8,7 @@
 #include <kern/callno.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 #include <pid.h>
@@ -28,7 +29,7 @@
  *
  * Upon syscall return the program counter stored in the trapframe must be incremented by one instruction; otherwise the exception return code will restart the "syscall" instruction and the system call will repeat forever.
  *
- * Since none of the OS/161 system calls have more than 4 arguments, there should be no need to fetch additional arguments from the user-level stack.
+ * Only mmap has more than 4 arguments. As with ordinary function calls, the rest are on the user-level stack, after the 16 bytes reserved there for a0-a3.
  *
  * Watch out: if you make system calls that have 64-bit quantities as arguments, they will get passed in pairs of registers, and not necessarily in the way you expect. We recommend you don't do it. 
  * (In fact, we recommend you don't use 64-bit quantities at all. See arch/mips/include/types.h.)
@@ -38,6 +39,9 @@ void mips_syscall(struct trapframe *tf) {
     int callno;
     int32_t retval;
     int err;
+#if OPT_A3
+    int32_t stackargs[2];
+#endif
 
     assert(curspl == 0);
 
@@ -108,6 +112,46 @@ void mips_syscall(struct trapframe *tf) {
 
             break;
 
+        case SYS_lseek:
+            //13
+            err = sys_lseek(&retval, tf->tf_a0, (off_t) tf->tf_a1, tf->tf_a2);
+            break;
+
+        case SYS_dup2:
+            //26
+            err = sys_dup2(&retval, tf->tf_a0, tf->tf_a1);
+            break;
+
+        case SYS_pipe:
+            //27
+            err = sys_pipe(&retval, (int *) tf->tf_a0);
+            break;
+
+        case SYS_readv:
+            //32
+            err = sys_readv(&retval, tf->tf_a0, (const struct iovec *) tf->tf_a1, tf->tf_a2);
+            break;
+
+        case SYS_writev:
+            //33
+            err = sys_writev(&retval, tf->tf_a0, (const struct iovec *) tf->tf_a1, tf->tf_a2);
+            break;
+
+        case SYS_pread:
+            //34
+            err = sys_pread(&retval, tf->tf_a0, (void *) tf->tf_a1, tf->tf_a2, (off_t) tf->tf_a3);
+            break;
+
+        case SYS_pwrite:
+            //35
+            err = sys_pwrite(&retval, tf->tf_a0, (const void *) tf->tf_a1, tf->tf_a2, (off_t) tf->tf_a3);
+            break;
+
+        case SYS_spawn:
+            //39
+            err = sys_spawn(&retval, (char *) tf->tf_a0, (char **) tf->tf_a1);
+            break;
+
 #endif /* OPT_A2 */
         case SYS_reboot:
             //8
@@ -123,6 +167,27 @@ void mips_syscall(struct trapframe *tf) {
             break;
 
 #endif /* OPT_A2 */
+#if OPT_A3
+        case SYS_mmap:
+            //36
+            //fd and offset are the fifth and sixth arguments
+            err = copyin((const_userptr_t) (tf->tf_sp + 16), stackargs, sizeof(stackargs));
+            if (!err) {
+                err = sys_mmap(&retval, (void *) tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3, stackargs[0], (off_t) stackargs[1]);
+            }
+            break;
+
+        case SYS_munmap:
+            //37
+            err = sys_munmap(&retval, (void *) tf->tf_a0, tf->tf_a1);
+            break;
+
+        case SYS_msync:
+            //38
+            err = sys_msync(&retval, (void *) tf->tf_a0, tf->tf_a1, tf->tf_a2);
+            break;
+
+#endif /* OPT_A3 */
         default:
             kprintf("Unknown syscall %d\n", callno);
             err = ENOSYS;
@@ -44,6 +44,11 @@ static struct con_softc *the_console = NULL;
 static struct lock *con_userlock_read = NULL;
 static struct lock *con_userlock_write = NULL;
 
+/*
+ * How much user output con_io copies in at once.
+ */
+#define CON_CHUNK  128
+
 //////////////////////////////////////////////////
 
 /*
@@ -206,6 +211,8 @@ con_io(struct device *dev, struct uio *uio)
 {
 	int result;
 	char ch;
+	char buf[CON_CHUNK];
+	size_t len, i;
 	struct lock *lk;
 
 	(void)dev;  // unused
@@ -236,15 +243,26 @@ con_io(struct device *dev, struct uio *uio)
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			/*
+			 * Pull output over in chunks rather than a byte
+			 * at a time, so a user write is one copyin per
+			 * CON_CHUNK bytes instead of one per character.
+			 */
+			len = uio->uio_resid;
+			if (len > CON_CHUNK) {
+				len = CON_CHUNK;
+			}
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
+			for (i=0; i<len; i++) {
+				if (buf[i]=='\n') {
+					putch('\r');
+				}
+				putch(buf[i]);
 			}
-			putch(ch);
 		}
 	}
 	lock_release(lk);
@@ -278,6 +296,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_close = con_close;
 	dev->d_io = con_io;
 	dev->d_ioctl = con_ioctl;
+	dev->d_strategy = NULL;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
@@ -4,7 +4,8 @@
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
+#include <thread.h>
+#include <machine/spl.h>
 #include <kern/errno.h>
 #include <machine/bus.h>
 #include <uio.h>
@@ -30,6 +31,15 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/*
+ * Most requests that can be started ahead of a waiting one before it
+ * goes next regardless of where the heads are.
+ */
+#define LHD_DEADLINE    16
+
+/* Bounce buffer size for I/O to and from user buffers */
+#define LHD_BOUNCE      4096
+
 /*
  * Shortcut for reading a register.
  */
@@ -66,21 +76,134 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the sector lh_sector of the current request, first putting
+ * the data in the on-card buffer if it's a write.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_start(struct lhd_softc *lh)
+{
+	int result;
+
+	if (lh->lh_statval & LHD_ISWRITE) {
+		result = uiomove(lh->lh_buf, LHD_SECTSIZE, lh->lh_cur->br_uio);
+		assert(result == 0);	/* kernel buffers only */
+	}
+	lhd_wreg(lh, LHD_REG_SECT, lh->lh_sector);
+	lhd_wreg(lh, LHD_REG_STAT, lh->lh_statval);
+}
+
+/*
+ * Choose the next request to start (elevator scheduling). Normally
+ * this is the first one at or past the sector we just finished, in
+ * sector order, going back round to the lowest when there's nothing
+ * further along. But a request that has been passed over too many
+ * times goes first, so a stream of requests in one place can't
+ * starve one somewhere else.
+ *
+ * Called at splhigh with the queue not empty. Returns the link that
+ * points at the chosen request.
+ */
+static
+struct bioreq **
+lhd_pick(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct bioreq **pp, **ahead = NULL, **late = NULL;
+
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->br_next) {
+		if ((int32_t)((*pp)->br_deadline - lh->lh_nstarted) <= 0 &&
+		    (late == NULL ||
+		     (int32_t)((*pp)->br_deadline - (*late)->br_deadline) < 0)) {
+			late = pp;
+		}
+		if (ahead == NULL && (*pp)->br_block >= lh->lh_sector) {
+			ahead = pp;
+		}
+	}
+
+	if (late != NULL) {
+		return late;
+	}
+	if (ahead != NULL) {
+		return ahead;
+	}
+	return &lh->lh_queue;
+}
+
+/*
+ * Take the next request off the queue, if there is one, and start it.
+ * Called at splhigh when the device is idle.
+ */
+static
+void
+lhd_dispatch(struct lhd_softc *lh)
+{
+	struct bioreq **pp, *br;
+
+	assert(lh->lh_cur == NULL);
+	if (lh->lh_queue == NULL) {
+		return;
+	}
+
+	pp = lhd_pick(lh);
+	br = *pp;
+	*pp = br->br_next;
+	br->br_next = NULL;
+
+	lh->lh_cur = br;
+	lh->lh_sector = br->br_block;
+	lh->lh_nsect = br->br_nblocks;
+	lh->lh_statval = LHD_WORKING;
+	if (br->br_uio->uio_rw == UIO_WRITE) {
+		lh->lh_statval |= LHD_ISWRITE;
+	}
+	lh->lh_nstarted++;
+
+	lhd_start(lh);
+}
+
+/*
+ * Called from the interrupt handler when a sector has finished. If it
+ * worked, take the data out of the on-card buffer if it was a read,
+ * and start the next sector straight away. Otherwise, or if that was
+ * the last sector, complete the request and start the next one.
+ */
+static
+void
+lhd_next(struct lhd_softc *lh, int err)
+{
+	struct bioreq *br = lh->lh_cur;
+
+	if (br == NULL) {
+		/* Spurious or late completion; lhd_irq has acked it */
+		return;
+	}
+
+	if (err == 0) {
+		if (!(lh->lh_statval & LHD_ISWRITE)) {
+			err = uiomove(lh->lh_buf, LHD_SECTSIZE, br->br_uio);
+			assert(err == 0);	/* kernel buffers only */
+		}
+		lh->lh_sector++;
+		lh->lh_nsect--;
+		if (lh->lh_nsect > 0) {
+			lhd_start(lh);
+			return;
+		}
+	}
+
+	/* Keep the disk busy while the caller deals with this one */
+	lh->lh_cur = NULL;
+	lhd_dispatch(lh);
+
+	br->br_result = err;
+	br->br_done(br);
 }
 
 /*
  * Interrupt handler for lhd.
  * Read the status register; if an operation finished, clear the status
- * register and report completion.
+ * register and carry on with the current request.
  */
 void
 lhd_irq(void *vlh)
@@ -98,7 +221,7 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		lhd_next(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
 }
@@ -165,21 +288,24 @@ lhd_reset(struct lhd_softc *lh)
 #endif
 
 /*
- * I/O function (for both reads and writes)
+ * Queue a request (for both reads and writes). The device does one
+ * sector at a time; the interrupt handler moves each sector of a
+ * request and starts the next, and then starts whichever queued
+ * request lhd_pick likes best.
  */
 static
 int
-lhd_io(struct device *d, struct uio *uio)
+lhd_strategy(struct device *d, struct bioreq *br)
 {
 	struct lhd_softc *lh = d->d_data;
+	struct uio *uio = br->br_uio;
+	struct bioreq **pp;
+	int spl;
 
 	u_int32_t sector = uio->uio_offset / LHD_SECTSIZE;
 	u_int32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	u_int32_t len = uio->uio_resid / LHD_SECTSIZE;
 	u_int32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	u_int32_t i;
-	u_int32_t statval = LHD_WORKING;
-	int result;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -191,59 +317,145 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	/* The interrupt handler can't get at user memory. */
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		return EINVAL;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
+	if (len == 0) {
+		br->br_result = 0;
+		br->br_done(br);
+		return 0;
+	}
 
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+	br->br_block = sector;
+	br->br_nblocks = len;
 
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			if (result) {
-				V(lh->lh_clear);
-				return result;
-			}
+	spl = splhigh();
+
+	br->br_deadline = lh->lh_nstarted + LHD_DEADLINE;
+
+	/* Insert in sector order, after any others for the same sector */
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->br_next) {
+		if ((*pp)->br_block > sector) {
+			break;
 		}
+	}
+	br->br_next = *pp;
+	*pp = br;
+
+	if (lh->lh_cur == NULL) {
+		lhd_dispatch(lh);
+	}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
+	splx(spl);
+	return 0;
+}
 
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
+/*
+ * Completion callback for lhd_syncio.
+ */
+static
+void
+lhd_wakeup(struct bioreq *br)
+{
+	*(volatile int *)br->br_data = 1;
+	thread_wakeup(br);
+}
 
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+/*
+ * Queue a request for a kernel buffer and wait for it.
+ */
+static
+int
+lhd_syncio(struct lhd_softc *lh, struct uio *uio)
+{
+	struct bioreq br;
+	volatile int done = 0;
+	int result, spl;
+
+	br.br_uio = uio;
+	br.br_done = lhd_wakeup;
+	br.br_data = (void *)&done;
+
+	spl = splhigh();
+	result = lhd_strategy(&lh->lh_dev, &br);
+	if (result == 0) {
+		while (!done) {
+			thread_sleep(&br);
+		}
+		result = br.br_result;
+	}
+	splx(spl);
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
+	return result;
+}
+
+/*
+ * I/O function (for both reads and writes)
+ *
+ * Kernel buffers are queued as they are. User buffers go through a
+ * bounce buffer, a piece at a time.
+ */
+static
+int
+lhd_io(struct device *d, struct uio *uio)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct uio ku;
+	char *bounce;
+	size_t len;
+	int result = 0;
+
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		return lhd_syncio(lh, uio);
+	}
+
+	/* lhd_strategy checks this too, but only a piece at a time. */
+	if (uio->uio_offset % LHD_SECTSIZE != 0 ||
+	    uio->uio_resid % LHD_SECTSIZE != 0) {
+		return EINVAL;
+	}
+
+	bounce = kmalloc(LHD_BOUNCE);
+	if (bounce == NULL) {
+		return ENOMEM;
+	}
+
+	while (uio->uio_resid > 0) {
+		len = uio->uio_resid;
+		if (len > LHD_BOUNCE) {
+			len = LHD_BOUNCE;
+		}
+		mk_kuio(&ku, bounce, len, uio->uio_offset, uio->uio_rw);
 
 		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
+		 * Are we writing? If so, get the data in before going to
+		 * the disk; if reading, copy it out after. uiomove updates
+		 * uio_offset for us either way.
 		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (uio->uio_rw == UIO_WRITE) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
-
-		/* If we failed, return the error. */
+		result = lhd_syncio(lh, &ku);
 		if (result) {
-			return result;
+			break;
+		}
+
+		if (uio->uio_rw == UIO_READ) {
+			result = uiomove(bounce, len, uio);
+			if (result) {
+				break;
+			}
 		}
 	}
 
-	return 0;
+	kfree(bounce);
+	return result;
 }
 
 /*
@@ -260,23 +472,20 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Nothing queued yet. */
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_sector = 0;
+	lh->lh_nsect = 0;
+	lh->lh_statval = 0;
+	lh->lh_nstarted = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
 	lh->lh_dev.d_close = lhd_close;
 	lh->lh_dev.d_io = lhd_io;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
+	lh->lh_dev.d_strategy = lhd_strategy;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
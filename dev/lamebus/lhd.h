@@ -22,9 +22,17 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/*
+	 * Request queue. All of this is shared with the interrupt
+	 * handler, so it's only touched at splhigh.
+	 */
+	struct bioreq *lh_queue;	/* Waiting requests, by sector */
+	struct bioreq *lh_cur;		/* Request in progress, or NULL */
+	u_int32_t lh_sector;		/* Sector now in progress */
+	u_int32_t lh_nsect;		/* Sectors left, including that one */
+	u_int32_t lh_statval;		/* What to write to start each one */
+	u_int32_t lh_nstarted;		/* Requests started, for deadlines */
 
 	struct device lh_dev;		/* VFS device structure */
 };
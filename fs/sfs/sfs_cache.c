@@ -0,0 +1,973 @@
+/*
+ * SFS filesystem
+ *
+ * Disk buffer cache.
+ *
+ * A fixed pool of block buffers shared by all mounted sfs volumes,
+ * keyed by (filesystem, block number). Buffers are found through a
+ * small hash table and replaced in least-recently-used order. Writes
+ * through the cache just mark the buffer dirty; dirty buffers go to
+ * disk when they are replaced, when the volume is synced, or when the
+ * syncer thread comes round every SFS_SYNCER_SECS seconds.
+ *
+ * A buffer handed out by sfs_bread, sfs_bget or sfs_bpeek is busy: it belongs to
+ * the caller until sfs_brelse, and anyone else who wants the same
+ * block waits. The buffer's data and its valid/dirty flags are only
+ * touched by the thread that has it busy. buf_lock protects the rest
+ * (the hash chains, the LRU list, and the fs/block/busy fields), and
+ * is never held across disk I/O.
+ *
+ * Metadata buffers on a volume with a journal are dirtied with
+ * sfs_bjdirty. They aren't written back or replaced until a journal
+ * commit has logged them (sfs_bjgather), after which the commit writes
+ * them back itself (sfs_bjwrite).
+ *
+ * Readahead and write-back don't wait for the disk. They queue each
+ * run of buffers with the device's d_strategy (so the driver can sort
+ * them in with everyone else's requests) and the buffers stay busy
+ * until the "sfs iodone" thread sees the request finish.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <kern/errno.h>
+#include <uio.h>
+#include <dev.h>
+#include <machine/spl.h>
+#include <sfs.h>
+
+#define SFS_BUFHASH	31	/* number of hash chains */
+
+static struct sfs_buf bufs[SFS_NBUF];
+static struct sfs_buf *bufhash[SFS_BUFHASH];
+
+/* LRU list of all buffers; bufs_lru is the least recently used. */
+static struct sfs_buf *bufs_lru, *bufs_mru;
+
+static struct lock *buf_lock;
+static struct cv *buf_cv;	/* signalled when a buffer stops being busy */
+
+#define BUFHASH(sfs, block) \
+	((((u_int32_t)(sfs) >> 4) + (block)) % SFS_BUFHASH)
+
+/*
+ * Someone waiting for a batch of asynchronous requests.
+ */
+struct sfs_biowait {
+	int bw_pending;			/* requests not finished yet */
+	int bw_result;			/* first error, if any */
+};
+
+/*
+ * A run of buffers being read or written asynchronously.
+ */
+struct sfs_bio {
+	struct bioreq bio_req;
+	struct uio bio_uio;
+	struct iovec bio_iov[SFS_MAXRUN];
+	struct sfs_buf *bio_run[SFS_MAXRUN];
+	u_int32_t bio_n;
+	enum uio_rw bio_rw;
+	int bio_tries;			/* retries after I/O errors */
+	struct sfs_biowait *bio_wait;	/* who's waiting, or NULL */
+	struct sfs_bio *bio_next;	/* on bio_done */
+};
+
+/* Finished requests, for the iodone thread; touched only at splhigh. */
+static struct sfs_bio *bio_done;
+static struct semaphore *bio_sem;	/* counts requests on bio_done */
+
+////////////////////////////////////////////////////////////
+//
+// Lists (all called with buf_lock held)
+
+static
+void
+lru_remove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		bufs_lru = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		bufs_mru = b->b_lruprev;
+	}
+}
+
+static
+void
+lru_append(struct sfs_buf *b)
+{
+	b->b_lrunext = NULL;
+	b->b_lruprev = bufs_mru;
+	if (bufs_mru != NULL) {
+		bufs_mru->b_lrunext = b;
+	}
+	else {
+		bufs_lru = b;
+	}
+	bufs_mru = b;
+}
+
+static
+struct sfs_buf *
+hash_lookup(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = bufhash[BUFHASH(sfs, block)]; b != NULL; b = b->b_hashnext) {
+		if (b->b_fs == sfs && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+hash_insert(struct sfs_buf *b)
+{
+	u_int32_t h = BUFHASH(b->b_fs, b->b_block);
+
+	b->b_hashnext = bufhash[h];
+	bufhash[h] = b;
+}
+
+/*
+ * Take a buffer out of the hash table, so it holds no block.
+ */
+static
+void
+hash_remove(struct sfs_buf *b)
+{
+	struct sfs_buf **pp;
+
+	if (b->b_fs == NULL) {
+		return;
+	}
+	pp = &bufhash[BUFHASH(b->b_fs, b->b_block)];
+	while (*pp != b) {
+		assert(*pp != NULL);
+		pp = &(*pp)->b_hashnext;
+	}
+	*pp = b->b_hashnext;
+	if (b->b_jdirty) {
+		b->b_fs->sfs_njdirty--;
+		b->b_jdirty = 0;
+	}
+	b->b_fs = NULL;
+	b->b_valid = 0;
+	b->b_dirty = 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Syncer thread: write back dirty buffers every so often, so writes
+ * reach the disk in batches, in block order, instead of one at a time
+ * as they're made.
+ */
+static
+void
+sfs_syncer(void *unused1, unsigned long unused2)
+{
+	int result;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(SFS_SYNCER_SECS);
+		sfs_jcommitall();
+		result = sfs_bsync(NULL);
+		if (result) {
+			kprintf("sfs: syncer: %s\n", strerror(result));
+		}
+	}
+}
+
+static void bio_finish(struct sfs_bio *bio);
+
+/*
+ * Iodone thread: take finished asynchronous requests off bio_done and
+ * deal with them. This can't be done in the completion callback, which
+ * runs in the disk's interrupt handler and can't take buf_lock.
+ */
+static
+void
+sfs_iodone(void *unused1, unsigned long unused2)
+{
+	struct sfs_bio *bio;
+	int spl;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		P(bio_sem);
+		spl = splhigh();
+		bio = bio_done;
+		assert(bio != NULL);
+		bio_done = bio->bio_next;
+		splx(spl);
+
+		bio_finish(bio);
+	}
+}
+
+/*
+ * Set up the cache and start the iodone and syncer threads. Called on
+ * each mount; only the first call does anything.
+ */
+int
+sfs_bufinit(void)
+{
+	int i, result;
+
+	if (buf_lock != NULL) {
+		return 0;
+	}
+
+	buf_cv = cv_create("sfs buffers");
+	if (buf_cv == NULL) {
+		return ENOMEM;
+	}
+	buf_lock = lock_create("sfs buffers");
+	if (buf_lock == NULL) {
+		cv_destroy(buf_cv);
+		buf_cv = NULL;
+		return ENOMEM;
+	}
+	bio_sem = sem_create("sfs iodone", 0);
+	if (bio_sem == NULL) {
+		result = ENOMEM;
+		goto fail;
+	}
+
+	/* Without this, asynchronous requests would never finish */
+	result = thread_fork("sfs iodone", NULL, 0, sfs_iodone, NULL);
+	if (result) {
+		sem_destroy(bio_sem);
+		bio_sem = NULL;
+		goto fail;
+	}
+
+	for (i=0; i<SFS_NBUF; i++) {
+		lru_append(&bufs[i]);
+	}
+
+	result = thread_fork("sfs syncer", NULL, 0, sfs_syncer, NULL);
+	if (result) {
+		/* Not fatal; dirty buffers just wait for sync or reuse */
+		kprintf("sfs: cannot start syncer: %s\n", strerror(result));
+	}
+	return 0;
+
+ fail:
+	lock_destroy(buf_lock);
+	buf_lock = NULL;
+	cv_destroy(buf_cv);
+	buf_cv = NULL;
+	return result;
+}
+
+/*
+ * Read or write the N buffers in RUN, which must be busy and hold
+ * consecutive blocks of one volume, as a single device request.
+ */
+static
+int
+runio(struct sfs_buf **run, u_int32_t n, enum uio_rw rw)
+{
+	struct iovec iov[SFS_MAXRUN];
+	struct uio u;
+	u_int32_t i;
+
+	assert(n > 0 && n <= SFS_MAXRUN);
+	for (i=0; i<n; i++) {
+		assert(run[i]->b_busy);
+		assert(run[i]->b_fs == run[0]->b_fs);
+		assert(run[i]->b_block == run[0]->b_block + i);
+		iov[i].iov_kbase = run[i]->b_data;
+		iov[i].iov_len = SFS_BLOCKSIZE;
+	}
+
+	u.uio_iov = iov;
+	u.uio_iovcnt = n;
+	u.uio_offset = ((off_t)run[0]->b_block)*SFS_BLOCKSIZE;
+	u.uio_resid = n*SFS_BLOCKSIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = rw;
+	u.uio_space = NULL;
+
+	return sfs_rwblock(run[0]->b_fs, &u);
+}
+
+/*
+ * A run of N buffers, read or written as one request, has finished
+ * with RESULT. Update them and give them back, and tell BW, if it's
+ * not NULL, that the request is done.
+ */
+static
+void
+runfinish(struct sfs_buf **run, u_int32_t n, enum uio_rw rw, int result,
+	  struct sfs_biowait *bw)
+{
+	u_int32_t i;
+
+	lock_acquire(buf_lock);
+	for (i=0; i<n; i++) {
+		if (result == 0) {
+			if (rw == UIO_READ) {
+				run[i]->b_valid = 1;
+			}
+			else {
+				run[i]->b_dirty = 0;
+			}
+		}
+		run[i]->b_busy = 0;
+		if (!run[i]->b_valid) {
+			/* Failed read */
+			hash_remove(run[i]);
+		}
+		if (rw == UIO_READ) {
+			lru_remove(run[i]);
+			lru_append(run[i]);
+		}
+	}
+	if (bw != NULL) {
+		assert(bw->bw_pending > 0);
+		bw->bw_pending--;
+		if (result && bw->bw_result == 0) {
+			bw->bw_result = result;
+		}
+	}
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+/*
+ * Completion callback for asynchronous requests. Runs in the disk's
+ * interrupt handler, so just hand the request to the iodone thread.
+ */
+static
+void
+bio_callback(struct bioreq *br)
+{
+	struct sfs_bio *bio = br->br_data;
+	int spl;
+
+	spl = splhigh();
+	bio->bio_next = bio_done;
+	bio_done = bio;
+	splx(spl);
+	V(bio_sem);
+}
+
+/*
+ * (Re)build BIO's uio and queue it with the device.
+ */
+static
+void
+bio_submit(struct sfs_bio *bio)
+{
+	struct device *dev = bio->bio_run[0]->b_fs->sfs_device;
+	u_int32_t i;
+	int result;
+
+	for (i=0; i<bio->bio_n; i++) {
+		bio->bio_iov[i].iov_kbase = bio->bio_run[i]->b_data;
+		bio->bio_iov[i].iov_len = SFS_BLOCKSIZE;
+	}
+	bio->bio_uio.uio_iov = bio->bio_iov;
+	bio->bio_uio.uio_iovcnt = bio->bio_n;
+	bio->bio_uio.uio_offset =
+		((off_t)bio->bio_run[0]->b_block)*SFS_BLOCKSIZE;
+	bio->bio_uio.uio_resid = bio->bio_n*SFS_BLOCKSIZE;
+	bio->bio_uio.uio_segflg = UIO_SYSSPACE;
+	bio->bio_uio.uio_rw = bio->bio_rw;
+	bio->bio_uio.uio_space = NULL;
+
+	bio->bio_req.br_uio = &bio->bio_uio;
+	bio->bio_req.br_done = bio_callback;
+	bio->bio_req.br_data = bio;
+
+	result = dev->d_strategy(dev, &bio->bio_req);
+	if (result) {
+		/* Same as for d_io in sfs_rwblock: it's our fault */
+		panic("sfs: d_strategy returned %s\n", strerror(result));
+	}
+}
+
+/*
+ * Called by the iodone thread when an asynchronous request is over.
+ * I/O errors are retried the way sfs_rwblock does.
+ */
+static
+void
+bio_finish(struct sfs_bio *bio)
+{
+	int result = bio->bio_req.br_result;
+	u_int32_t block = bio->bio_run[0]->b_block;
+
+	if (result == EIO) {
+		if (bio->bio_tries == 0) {
+			kprintf("sfs: block %u I/O error, retrying\n", block);
+		}
+		if (bio->bio_tries < 10) {
+			bio->bio_tries++;
+			bio_submit(bio);
+			return;
+		}
+		kprintf("sfs: block %u I/O error, giving up after "
+			"%d retries\n", block, bio->bio_tries);
+	}
+
+	runfinish(bio->bio_run, bio->bio_n, bio->bio_rw, result,
+		  bio->bio_wait);
+	kfree(bio);
+}
+
+/*
+ * Start reading or writing the N busy buffers in RUN (as for runio)
+ * without waiting. The buffers are given back when it's done, and BW,
+ * if not NULL, told about it. If the device can't queue requests, or
+ * there's no memory, do it synchronously instead.
+ */
+static
+void
+runstart(struct sfs_buf **run, u_int32_t n, enum uio_rw rw,
+	 struct sfs_biowait *bw)
+{
+	struct sfs_fs *sfs = run[0]->b_fs;
+	struct sfs_bio *bio = NULL;
+	u_int32_t i;
+
+	assert(n > 0 && n <= SFS_MAXRUN);
+
+	if (sfs->sfs_device->d_strategy != NULL) {
+		bio = kmalloc(sizeof(struct sfs_bio));
+	}
+	if (bio == NULL) {
+		runfinish(run, n, rw, runio(run, n, rw), bw);
+		return;
+	}
+
+	for (i=0; i<n; i++) {
+		bio->bio_run[i] = run[i];
+	}
+	bio->bio_n = n;
+	bio->bio_rw = rw;
+	bio->bio_tries = 0;
+	bio->bio_wait = bw;
+	bio->bio_next = NULL;
+	bio_submit(bio);
+}
+
+/*
+ * Get the buffer for BLOCK, busy. If the block isn't cached, the least
+ * recently used idle buffer is taken for it (writing it back first if
+ * it's dirty); the buffer is then not valid.
+ *
+ * If WAIT is false, return EAGAIN instead of waiting for the block's
+ * buffer, or any buffer, to stop being busy.
+ */
+static
+int
+getbuf(struct sfs_fs *sfs, u_int32_t block, int wait, struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	lock_acquire(buf_lock);
+ again:
+	b = hash_lookup(sfs, block);
+	if (b != NULL) {
+		if (b->b_busy) {
+			if (!wait) {
+				lock_release(buf_lock);
+				return EAGAIN;
+			}
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+	}
+	else {
+		for (b = bufs_lru; b != NULL && (b->b_busy || b->b_jdirty);
+		     b = b->b_lrunext);
+		if (b == NULL) {
+			if (!wait) {
+				lock_release(buf_lock);
+				return EAGAIN;
+			}
+			/* Everything is in use; wait for something to free up */
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		if (b->b_dirty) {
+			/*
+			 * Write the victim back and then start over, since
+			 * someone else may have brought in our block while
+			 * we weren't holding the lock.
+			 */
+			b->b_busy = 1;
+			lock_release(buf_lock);
+			result = sfs_wblock(b->b_fs, b->b_data, b->b_block);
+			lock_acquire(buf_lock);
+			b->b_busy = 0;
+			if (result == 0) {
+				b->b_dirty = 0;
+			}
+			cv_broadcast(buf_cv, buf_lock);
+			if (result) {
+				lock_release(buf_lock);
+				return result;
+			}
+			goto again;
+		}
+		hash_remove(b);
+		b->b_fs = sfs;
+		b->b_block = block;
+		hash_insert(b);
+	}
+	b->b_busy = 1;
+	lock_release(buf_lock);
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get BLOCK's buffer with its contents read in.
+ */
+int
+sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	result = getbuf(sfs, block, 1, &b);
+	if (result) {
+		return result;
+	}
+
+	if (!b->b_valid) {
+		result = sfs_rblock(sfs, b->b_data, block);
+		if (result) {
+			lock_acquire(buf_lock);
+			hash_remove(b);
+			b->b_busy = 0;
+			cv_broadcast(buf_cv, buf_lock);
+			lock_release(buf_lock);
+			return result;
+		}
+		b->b_valid = 1;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Get BLOCK's buffer without reading it from disk, for a caller that
+ * is about to overwrite the whole block. If b_valid is set the buffer
+ * holds the block; otherwise it holds garbage until the caller fills
+ * it in and calls sfs_bdirty. A buffer that is still not valid when it
+ * is released is dropped.
+ */
+int
+sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return getbuf(sfs, block, 1, ret);
+}
+
+/*
+ * Start reading the N blocks from BLOCK on into the cache, skipping any
+ * that are already there, for readahead. Runs of missing blocks are
+ * read with one device request each, and we don't wait for them. This
+ * never waits for a busy buffer either (a busy block is cached or
+ * about to be), and errors are ignored.
+ */
+void
+sfs_bprefetch(struct sfs_fs *sfs, u_int32_t block, u_int32_t n)
+{
+	struct sfs_buf *run[SFS_MAXRUN];
+	struct sfs_buf *b;
+	u_int32_t i, nrun = 0;
+
+	for (i=0; i<n; i++) {
+		if (getbuf(sfs, block+i, 0, &b)) {
+			b = NULL;
+		}
+		else if (b->b_valid) {
+			sfs_brelse(b);
+			b = NULL;
+		}
+		if (b != NULL) {
+			run[nrun++] = b;
+		}
+
+		/* Start on the run when it ends */
+		if (nrun > 0 && (b == NULL || nrun == SFS_MAXRUN || i == n-1)) {
+			runstart(run, nrun, UIO_READ, NULL);
+			nrun = 0;
+		}
+	}
+}
+
+/*
+ * Return true if BLOCK is in the cache (or being read into it). This
+ * can be out of date as soon as it returns; it's for deciding whether
+ * file data should go through the cache.
+ */
+int
+sfs_bcached(struct sfs_fs *sfs, u_int32_t block)
+{
+	int ret;
+
+	lock_acquire(buf_lock);
+	ret = hash_lookup(sfs, block) != NULL;
+	lock_release(buf_lock);
+	return ret;
+}
+
+/*
+ * If BLOCK is cached, return its buffer, busy; otherwise NULL. Used
+ * for file data, which is read and written directly when it isn't
+ * already in the cache.
+ */
+struct sfs_buf *
+sfs_bpeek(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	lock_acquire(buf_lock);
+	while ((b = hash_lookup(sfs, block)) != NULL && b->b_busy) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	if (b != NULL && !b->b_valid) {
+		b = NULL;
+	}
+	if (b != NULL) {
+		b->b_busy = 1;
+	}
+	lock_release(buf_lock);
+	return b;
+}
+
+/*
+ * Mark a busy buffer as modified (and, after sfs_bget, filled in).
+ */
+void
+sfs_bdirty(struct sfs_buf *b)
+{
+	assert(b->b_busy);
+	b->b_valid = 1;
+	b->b_dirty = 1;
+}
+
+/*
+ * Mark a busy metadata buffer as modified. If the volume has a
+ * journal, the buffer stays in the cache until it has been logged.
+ */
+void
+sfs_bjdirty(struct sfs_buf *b)
+{
+	sfs_bdirty(b);
+	if (b->b_fs->sfs_journal != NULL && !b->b_jdirty) {
+		lock_acquire(buf_lock);
+		b->b_jdirty = 1;
+		b->b_fs->sfs_njdirty++;
+		lock_release(buf_lock);
+	}
+}
+
+/*
+ * Give back a buffer got from sfs_bread, sfs_bget or sfs_bpeek.
+ */
+void
+sfs_brelse(struct sfs_buf *b)
+{
+	lock_acquire(buf_lock);
+	assert(b->b_busy);
+	b->b_busy = 0;
+	if (!b->b_valid) {
+		/* sfs_bget and never filled in */
+		hash_remove(b);
+	}
+	lru_remove(b);
+	lru_append(b);
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+/*
+ * Forget BLOCK, which has been freed. Any dirty contents are thrown
+ * away.
+ */
+void
+sfs_binval(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	lock_acquire(buf_lock);
+	while ((b = hash_lookup(sfs, block)) != NULL && b->b_busy) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	if (b != NULL) {
+		hash_remove(b);
+		/* Reuse it first */
+		lru_remove(b);
+		b->b_lrunext = bufs_lru;
+		b->b_lruprev = NULL;
+		if (bufs_lru != NULL) {
+			bufs_lru->b_lruprev = b;
+		}
+		else {
+			bufs_mru = b;
+		}
+		bufs_lru = b;
+	}
+	lock_release(buf_lock);
+}
+
+/*
+ * Return true if B comes after block BLOCK of FS in the order sfs_bsync
+ * goes through buffers: volume by volume, and by block number within
+ * each volume, so that each disk sees one ascending sweep.
+ */
+static
+int
+bufafter(struct sfs_buf *b, u_int32_t block, struct sfs_fs *fs)
+{
+	if (b->b_fs != fs) {
+		return (u_int32_t)b->b_fs > (u_int32_t)fs;
+	}
+	return b->b_block > block;
+}
+
+/*
+ * Write back all of SFS's dirty buffers, or every volume's if SFS is
+ * NULL, in block order on each volume. Runs of dirty buffers for consecutive blocks
+ * go out as one device request each. The requests are all queued
+ * before we wait for any of them.
+ */
+int
+sfs_bsync(struct sfs_fs *sfs)
+{
+	struct sfs_buf *run[SFS_MAXRUN];
+	struct sfs_buf *b, *next;
+	struct sfs_biowait bw;
+	struct sfs_fs *fromfs = NULL;
+	u_int32_t from = 0, n;
+	int i;
+
+	bw.bw_pending = 0;
+	bw.bw_result = 0;
+
+	lock_acquire(buf_lock);
+	while (1) {
+		/*
+		 * Find the first dirty buffer, in bufafter's order, after
+		 * the last one we queued
+		 */
+		next = NULL;
+		for (i=0; i<SFS_NBUF; i++) {
+			b = &bufs[i];
+			if (b->b_fs == NULL || !b->b_dirty || b->b_jdirty) {
+				continue;
+			}
+			if (sfs != NULL && b->b_fs != sfs) {
+				continue;
+			}
+			if (fromfs != NULL && !bufafter(b, from, fromfs)) {
+				continue;
+			}
+			if (next == NULL ||
+			    bufafter(next, b->b_block, b->b_fs)) {
+				next = b;
+			}
+		}
+		if (next == NULL) {
+			break;
+		}
+		if (next->b_busy) {
+			cv_wait(buf_cv, buf_lock);
+			continue;
+		}
+
+		/* Take it and any idle dirty buffers for the blocks after it */
+		next->b_busy = 1;
+		run[0] = next;
+		for (n=1; n<SFS_MAXRUN; n++) {
+			b = hash_lookup(next->b_fs, next->b_block + n);
+			if (b == NULL || !b->b_dirty || b->b_busy ||
+			    b->b_jdirty) {
+				break;
+			}
+			b->b_busy = 1;
+			run[n] = b;
+		}
+		from = run[n-1]->b_block;
+		fromfs = run[n-1]->b_fs;
+		bw.bw_pending++;
+
+		lock_release(buf_lock);
+		runstart(run, n, UIO_WRITE, &bw);
+		lock_acquire(buf_lock);
+	}
+
+	while (bw.bw_pending > 0) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+	return bw.bw_result;
+}
+
+/*
+ * Drop all of SFS's buffers, on unmount. They must all have been
+ * written back already, but the syncer may still be looking at one.
+ */
+void
+sfs_bpurge(struct sfs_fs *sfs)
+{
+	int i;
+
+	lock_acquire(buf_lock);
+	for (i=0; i<SFS_NBUF; i++) {
+		while (bufs[i].b_fs == sfs && bufs[i].b_busy) {
+			cv_wait(buf_cv, buf_lock);
+		}
+		if (bufs[i].b_fs == sfs) {
+			assert(!bufs[i].b_dirty);
+			hash_remove(&bufs[i]);
+		}
+	}
+	lock_release(buf_lock);
+}
+
+/*
+ * Get all of SFS's buffers waiting to be journaled, for a commit, and
+ * put them (busy) in LIST, which has room for MAX; the number goes in
+ * *RET. If any of them is busy, wait until none is, so as not to sleep
+ * holding some of them. ENOSPC if there are more than MAX.
+ */
+int
+sfs_bjgather(struct sfs_fs *sfs, struct sfs_buf **list, u_int32_t max,
+	     u_int32_t *ret)
+{
+	struct sfs_buf *b;
+	u_int32_t n;
+	int i;
+
+	lock_acquire(buf_lock);
+ again:
+	n = 0;
+	for (i=0; i<SFS_NBUF; i++) {
+		b = &bufs[i];
+		if (b->b_fs != sfs || !b->b_jdirty) {
+			continue;
+		}
+		if (b->b_busy) {
+			cv_wait(buf_cv, buf_lock);
+			goto again;
+		}
+		n++;
+	}
+	if (n > max) {
+		lock_release(buf_lock);
+		return ENOSPC;
+	}
+
+	n = 0;
+	for (i=0; i<SFS_NBUF; i++) {
+		b = &bufs[i];
+		if (b->b_fs == sfs && b->b_jdirty) {
+			b->b_busy = 1;
+			list[n++] = b;
+		}
+	}
+	lock_release(buf_lock);
+
+	*ret = n;
+	return 0;
+}
+
+/*
+ * Give back the N buffers in LIST, from sfs_bjgather, uncommitted:
+ * they still wait for a commit.
+ */
+void
+sfs_bjrelease(struct sfs_buf **list, u_int32_t n)
+{
+	u_int32_t i;
+
+	lock_acquire(buf_lock);
+	for (i=0; i<n; i++) {
+		assert(list[i]->b_busy && list[i]->b_jdirty);
+		list[i]->b_busy = 0;
+	}
+	cv_broadcast(buf_cv, buf_lock);
+	lock_release(buf_lock);
+}
+
+/*
+ * The N buffers in LIST, from sfs_bjgather, are in the journal: write
+ * them back to where they belong and give them back. They stay busy
+ * until then, so nobody can change them in the meantime. Runs of
+ * consecutive blocks go out as one request each, all queued before we
+ * wait for any. LIST is left sorted by block.
+ */
+int
+sfs_bjwrite(struct sfs_buf **list, u_int32_t n)
+{
+	struct sfs_biowait bw;
+	struct sfs_buf *b;
+	u_int32_t i, k;
+
+	/* Sort by block; there are few enough for insertion sort */
+	for (i=1; i<n; i++) {
+		b = list[i];
+		for (k=i; k>0 && list[k-1]->b_block > b->b_block; k--) {
+			list[k] = list[k-1];
+		}
+		list[k] = b;
+	}
+
+	bw.bw_pending = 0;
+	bw.bw_result = 0;
+
+	lock_acquire(buf_lock);
+	for (i=0; i<n; i++) {
+		assert(list[i]->b_busy && list[i]->b_jdirty);
+		list[i]->b_jdirty = 0;
+		list[i]->b_fs->sfs_njdirty--;
+	}
+
+	for (i=0; i<n; i+=k) {
+		for (k=1; i+k<n && k<SFS_MAXRUN; k++) {
+			if (list[i+k]->b_block != list[i]->b_block + k) {
+				break;
+			}
+		}
+		bw.bw_pending++;
+		lock_release(buf_lock);
+		runstart(&list[i], k, UIO_WRITE, &bw);
+		lock_acquire(buf_lock);
+	}
+
+	while (bw.bw_pending > 0) {
+		cv_wait(buf_cv, buf_lock);
+	}
+	lock_release(buf_lock);
+	return bw.bw_result;
+}
@@ -7,7 +7,7 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
-#include <array.h>
+#include <synch.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <dev.h>
@@ -20,8 +20,11 @@
 
 /*
  * Routine for doing I/O (reads or writes) on the free block bitmap.
- * We always do the whole bitmap at once; writing individual sectors
- * might or might not be a worthwhile optimization.
+ * Reads do the whole bitmap at once. Writes only do the sectors marked
+ * in sfs_mapdirty, that is, ones with bits changed since they were last
+ * written, so a sync after a few allocations doesn't rewrite the whole
+ * map. Writes go into the buffer cache and reach the disk when it is
+ * synced.
  *
  * The free block bitmap consists of SFS_BITBLOCKS 512-byte sectors of
  * bits, one bit for each sector on the filesystem. The number of
@@ -40,8 +43,8 @@ static
 int
 sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 {
-	u_int32_t j, mapsize;
-	char *bitdata;
+	u_int32_t j, k, mapsize;
+	char *bitdata, *resdata;
 	int result;
 
 	/* Number of blocks in the bitmap. */
@@ -49,29 +52,85 @@ sfs_mapio(struct sfs_fs *sfs, enum uio_rw rw)
 
 	/* Pointer to our bitmap data in memory. */
 	bitdata = bitmap_getdata(sfs->sfs_freemap);
+	resdata = bitmap_getdata(sfs->sfs_resmap);
 	
 	/* For each sector in the bitmap... */
 	for (j=0; j<mapsize; j++) {
 
 		/* Get a pointer to its data */
 		void *ptr = bitdata + j*SFS_BLOCKSIZE;
+		struct sfs_buf *b;
+
+		/* Skip sectors that haven't changed */
+		if (rw == UIO_WRITE && !bitmap_isset(sfs->sfs_mapdirty, j)) {
+			continue;
+		}
 
 		/* and read or write it. The bitmap starts at sector 2. */ 
 		if (rw == UIO_READ) {
-			result = sfs_rblock(sfs, ptr, SFS_MAP_LOCATION+j);
+			result = sfs_bread(sfs, SFS_MAP_LOCATION+j, &b);
 		}
 		else {
-			result = sfs_wblock(sfs, ptr, SFS_MAP_LOCATION+j);
+			result = sfs_bget(sfs, SFS_MAP_LOCATION+j, &b);
 		}
 
 		/* If we failed, stop. */
 		if (result) {
 			return result;
 		}
+
+		if (rw == UIO_READ) {
+			memcpy(ptr, b->b_data, SFS_BLOCKSIZE);
+		}
+		else {
+			/* Blocks only reserved for files are free on disk */
+			char *res = resdata + j*SFS_BLOCKSIZE;
+			for (k=0; k<SFS_BLOCKSIZE; k++) {
+				b->b_data[k] = ((char *)ptr)[k] & ~res[k];
+			}
+			sfs_bjdirty(b);
+			bitmap_unmark(sfs->sfs_mapdirty, j);
+		}
+		sfs_brelse(b);
 	}
 	return 0;
 }
 
+/*
+ * Put the freemap and the superblock, if they've changed, into the
+ * buffer cache. Called on sync and by journal commits.
+ */
+int
+sfs_writemeta(struct sfs_fs *sfs)
+{
+	int result;
+
+	/* If the free block map needs to be written, write it. */
+	if (sfs->sfs_freemapdirty) {
+		result = sfs_mapio(sfs, UIO_WRITE);
+		if (result) {
+			return result;
+		}
+		sfs->sfs_freemapdirty = 0;
+	}
+
+	/* If the superblock needs to be written, write it. */
+	if (sfs->sfs_superdirty) {
+		struct sfs_buf *b;
+
+		result = sfs_bget(sfs, SFS_SB_LOCATION, &b);
+		if (result) {
+			return result;
+		}
+		memcpy(b->b_data, &sfs->sfs_super, SFS_BLOCKSIZE);
+		sfs_bjdirty(b);
+		sfs_brelse(b);
+		sfs->sfs_superdirty = 0;
+	}
+
+	return 0;
+}
+
 /*
  * Sync routine. This is what gets invoked if you do FS_SYNC on the
  * sfs filesystem structure.
@@ -82,7 +141,8 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
-	int i, num, result;
+	struct sfs_vnode *sv;
+	int i, result;
 
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
@@ -116,32 +176,37 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv = array_getguy(sfs->sfs_vnodes, i);
-		VOP_FSYNC(&sv->sv_v);
+	/*
+	 * With a journal, the operations have already put their inodes
+	 * in the cache, and a commit does the rest.
+	 */
+	if (sfs->sfs_journal != NULL) {
+		return sfs_jcommit(sfs);
 	}
 
-	/* If the free block map needs to be written, write it. */
-	if (sfs->sfs_freemapdirty) {
-		result = sfs_mapio(sfs, UIO_WRITE);
-		if (result) {
-			return result;
+	/*
+	 * Go over the table of loaded vnodes, putting their inodes in the
+	 * buffer cache; the one sfs_bsync below writes them all out.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	for (i=0; i<SFS_VNHASH; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			result = sfs_sync_inode(sv);
+			if (result) {
+				lock_release(sfs->sfs_vnlock);
+				return result;
+			}
 		}
-		sfs->sfs_freemapdirty = 0;
 	}
+	lock_release(sfs->sfs_vnlock);
 
-	/* If the superblock needs to be written, write it. */
-	if (sfs->sfs_superdirty) {
-		result = sfs_wblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
-		if (result) {
-			return result;
-		}
-		sfs->sfs_superdirty = 0;
+	result = sfs_writemeta(sfs);
+	if (result) {
+		return result;
 	}
 
-	return 0;
+	/* Now write back everything that's dirty in the buffer cache. */
+	return sfs_bsync(sfs);
 }
 
 /*
@@ -167,18 +232,36 @@ int
 sfs_unmount(struct fs *fs)
 {
 	struct sfs_fs *sfs = fs->fs_data;
-	
+	int result;
+
+	/* Get rid of vnodes that are only being kept around. */
+	result = sfs_vnflush(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* Do we have any files open? If so, can't unmount. */
-	if (array_getnum(sfs->sfs_vnodes)>0) {
+	if (sfs->sfs_nvnodes>0) {
 		return EBUSY;
 	}
 
+	/* In case that put any inodes in the buffer cache */
+	result = sfs_jcommit(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* We should have just had sfs_sync called. */
 	assert(sfs->sfs_superdirty==0);
 	assert(sfs->sfs_freemapdirty==0);
+	assert(sfs->sfs_njdirty==0);
 
 	/* Once we start nuking stuff we can't fail. */
-	array_destroy(sfs->sfs_vnodes);
+	sfs_jdestroy(sfs);
+	sfs_bpurge(sfs);
+	lock_destroy(sfs->sfs_vnlock);
+	bitmap_destroy(sfs->sfs_resmap);
+	bitmap_destroy(sfs->sfs_mapdirty);
 	bitmap_destroy(sfs->sfs_freemap);
 	
 	/* The vfs layer takes care of the device for us */
@@ -209,7 +292,7 @@ static
 int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
-	int result;
+	int i, result;
 	struct sfs_fs *sfs;
 
 	/* We don't pass any options through mount */
@@ -234,26 +317,42 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENXIO;
 	}
 
+	/* Set up the buffer cache, if this is the first mount */
+	result = sfs_bufinit();
+	if (result) {
+		return result;
+	}
+
 	/* Allocate object */
 	sfs = kmalloc(sizeof(struct sfs_fs));
 	if (sfs==NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate array */
-	sfs->sfs_vnodes = array_create();
-	if (sfs->sfs_vnodes == NULL) {
+	/* Set up the vnode table */
+	for (i=0; i<SFS_VNHASH; i++) {
+		sfs->sfs_vnhash[i] = NULL;
+	}
+	sfs->sfs_vnlru = sfs->sfs_vnmru = NULL;
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_nvncached = 0;
+	sfs->sfs_vnlock = lock_create("sfs vnodes");
+	if (sfs->sfs_vnlock == NULL) {
 		kfree(sfs);
 		return ENOMEM;
 	}
 
+	/* No journal until sfs_jinit */
+	sfs->sfs_journal = NULL;
+	sfs->sfs_njdirty = 0;
+
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
 
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
-		array_destroy(sfs->sfs_vnodes);
+		lock_destroy(sfs->sfs_vnlock);
 		kfree(sfs);
 		return result;
 	}
@@ -265,7 +364,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
-		array_destroy(sfs->sfs_vnodes);
+		lock_destroy(sfs->sfs_vnlock);
 		kfree(sfs);
 		return EINVAL;
 	}
@@ -278,17 +377,43 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Ensure null termination of the volume name */
 	sfs->sfs_super.sp_volname[sizeof(sfs->sfs_super.sp_volname)-1] = 0;
 
+	/* Finish off any journal commit that a crash cut short */
+	result = sfs_jreplay(sfs);
+	if (result) {
+		lock_destroy(sfs->sfs_vnlock);
+		kfree(sfs);
+		return result;
+	}
+
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
-		array_destroy(sfs->sfs_vnodes);
+		lock_destroy(sfs->sfs_vnlock);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_mapdirty = bitmap_create(SFS_FS_BITBLOCKS(sfs));
+	if (sfs->sfs_mapdirty == NULL) {
+		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_vnlock);
+		kfree(sfs);
+		return ENOMEM;
+	}
+	sfs->sfs_resmap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
+	if (sfs->sfs_resmap == NULL) {
+		bitmap_destroy(sfs->sfs_mapdirty);
+		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_vnlock);
 		kfree(sfs);
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
+		sfs_bpurge(sfs);
+		bitmap_destroy(sfs->sfs_resmap);
+		bitmap_destroy(sfs->sfs_mapdirty);
 		bitmap_destroy(sfs->sfs_freemap);
-		array_destroy(sfs->sfs_vnodes);
+		lock_destroy(sfs->sfs_vnlock);
 		kfree(sfs);
 		return result;
 	}
@@ -303,6 +428,19 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* the other fields */
 	sfs->sfs_superdirty = 0;
 	sfs->sfs_freemapdirty = 0;
+	sfs->sfs_nextfree = 0;
+
+	/* Start journaling, making the journal if there isn't one yet */
+	result = sfs_jinit(sfs);
+	if (result) {
+		sfs_bpurge(sfs);
+		bitmap_destroy(sfs->sfs_resmap);
+		bitmap_destroy(sfs->sfs_mapdirty);
+		bitmap_destroy(sfs->sfs_freemap);
+		lock_destroy(sfs->sfs_vnlock);
+		kfree(sfs);
+		return result;
+	}
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
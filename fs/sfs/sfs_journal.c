@@ -0,0 +1,588 @@
+/*
+ * SFS filesystem
+ *
+ * Metadata journal.
+ *
+ * Inodes, directory blocks, indirect blocks, the freemap and the
+ * superblock are metadata. Changes to them are made in the buffer
+ * cache as usual, but (with sfs_bjdirty) the buffers are held there
+ * instead of being written back. Every so often a commit writes all
+ * of them to the journal, a region of the disk recorded in the
+ * superblock, in one go, and then writes the journal header, which
+ * lists where they belong. Only then do those same buffers go to
+ * their real homes, after which the header is cleared again; other
+ * dirty blocks, such as file contents, are left for the syncer. If
+ * the system crashes after the header was written but before that
+ * finishes, the next mount copies the blocks home from the journal
+ * (sfs_jreplay). So after a crash the disk holds the metadata as of
+ * some commit, never part of one.
+ *
+ * For that to be a consistent state, a commit must not happen in the
+ * middle of an operation. Operations that change metadata are put
+ * between sfs_jbegin and sfs_jend, and a commit waits until none are
+ * in progress and holds off new ones until it's done. Any number of
+ * operations can go into one commit. Closing and reclaiming files
+ * release blocks and update inodes, so they are operations too.
+ *
+ * Commits happen when the syncer thread comes round, on sync and
+ * fsync, and when the buffers waiting for one would otherwise fill
+ * the journal or too much of the cache.
+ *
+ * File contents aren't journaled.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <kern/errno.h>
+#include <uio.h>
+#include <sfs.h>
+
+/* Journaled volumes, for sfs_jcommitall */
+static struct sfs_fs *jvols;
+static struct lock *jvols_lock;
+
+/*
+ * Check that the journal the superblock describes makes sense.
+ */
+static
+int
+jcheck(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+
+	if (sp->sp_jblocks < 2 || sp->sp_jblocks - 1 > SFS_JMAXLOG ||
+	    sp->sp_jstart <= SFS_MAP_LOCATION ||
+	    sp->sp_jstart + sp->sp_jblocks > sp->sp_nblocks) {
+		kprintf("sfs: %s: bad journal (%u blocks at %u)\n",
+			sp->sp_volname, sp->sp_jblocks, sp->sp_jstart);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * If the last commit before a crash didn't finish, copy its blocks
+ * home from the journal. Called at mount time before anything else is
+ * read, so this uses the disk directly.
+ */
+int
+sfs_jreplay(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_jheader *jh;
+	char *buf;
+	u_int32_t i;
+	int result, resuper = 0;
+
+	if (sp->sp_jblocks == 0) {
+		/* No journal */
+		return 0;
+	}
+	result = jcheck(sfs);
+	if (result) {
+		return result;
+	}
+
+	jh = kmalloc(sizeof(struct sfs_jheader));
+	buf = kmalloc(SFS_BLOCKSIZE);
+	if (jh == NULL || buf == NULL) {
+		result = ENOMEM;
+		goto done;
+	}
+
+	result = sfs_rblock(sfs, jh, sp->sp_jstart);
+	if (result) {
+		goto done;
+	}
+	if (jh->sjh_magic != SFS_JMAGIC ||
+	    jh->sjh_nblocks > sp->sp_jblocks - 1) {
+		kprintf("sfs: %s: bad journal header\n", sp->sp_volname);
+		result = EINVAL;
+		goto done;
+	}
+	if (jh->sjh_nblocks == 0) {
+		/* Nothing was left unfinished */
+		goto done;
+	}
+
+	for (i=0; i<jh->sjh_nblocks; i++) {
+		if (jh->sjh_blocks[i] >= sp->sp_nblocks) {
+			kprintf("sfs: %s: bad block %u in journal\n",
+				sp->sp_volname, jh->sjh_blocks[i]);
+			result = EINVAL;
+			goto done;
+		}
+		result = sfs_rblock(sfs, buf, sp->sp_jstart + 1 + i);
+		if (result) {
+			goto done;
+		}
+		result = sfs_wblock(sfs, buf, jh->sjh_blocks[i]);
+		if (result) {
+			goto done;
+		}
+		if (jh->sjh_blocks[i] == SFS_SB_LOCATION) {
+			resuper = 1;
+		}
+	}
+	kprintf("sfs: %s: replayed %u blocks from journal (commit %u)\n",
+		sp->sp_volname, jh->sjh_nblocks, jh->sjh_seq);
+
+	/* All done; don't do it again */
+	jh->sjh_nblocks = 0;
+	result = sfs_wblock(sfs, jh, sp->sp_jstart);
+	if (result) {
+		goto done;
+	}
+
+	if (resuper) {
+		result = sfs_rblock(sfs, sp, SFS_SB_LOCATION);
+		sp->sp_volname[sizeof(sp->sp_volname)-1] = 0;
+	}
+
+ done:
+	if (buf != NULL) {
+		kfree(buf);
+	}
+	if (jh != NULL) {
+		kfree(jh);
+	}
+	return result;
+}
+
+/*
+ * Make a journal for a volume that doesn't have one: take enough free
+ * blocks in a row, write an empty header, and record it in the
+ * superblock. This goes to disk before anything is journaled. If the
+ * volume can't have a journal, it just works without one.
+ */
+static
+int
+jcreate(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_jheader *jh;
+	u_int32_t size, start;
+	int result;
+
+	/* As much as the header can describe, if that's less */
+	size = SFS_JBLOCKS(sp->sp_nblocks);
+	if (size - 1 > SFS_JMAXLOG) {
+		size = SFS_JMAXLOG + 1;
+	}
+	if (size < 2 + SFS_BITBLOCKS(sp->sp_nblocks) + SFS_JMIN) {
+		kprintf("sfs: %s: freemap too big to journal\n",
+			sp->sp_volname);
+		return 0;
+	}
+	result = bitmap_alloc_range(sfs->sfs_freemap,
+				    SFS_MAP_LOCATION +
+				    SFS_BITBLOCKS(sp->sp_nblocks),
+				    size, &start);
+	if (result) {
+		kprintf("sfs: %s: no room for a journal\n", sp->sp_volname);
+		return 0;
+	}
+	/* The range can span two freemap sectors, but no more */
+	sfs_mapdirty(sfs, start);
+	sfs_mapdirty(sfs, start + size - 1);
+
+	jh = kmalloc(sizeof(struct sfs_jheader));
+	if (jh == NULL) {
+		return ENOMEM;
+	}
+	bzero(jh, sizeof(struct sfs_jheader));
+	jh->sjh_magic = SFS_JMAGIC;
+	result = sfs_wblock(sfs, jh, start);
+	kfree(jh);
+	if (result) {
+		return result;
+	}
+
+	sp->sp_jstart = start;
+	sp->sp_jblocks = size;
+	sfs->sfs_superdirty = 1;
+
+	result = sfs_writemeta(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_bsync(sfs);
+	if (result) {
+		return result;
+	}
+
+	kprintf("sfs: %s: made %u-block journal at block %u\n",
+		sp->sp_volname, size, start);
+	return 0;
+}
+
+static
+void
+jdestroy(struct sfs_journal *j)
+{
+	if (j->j_freed != NULL) {
+		bitmap_destroy(j->j_freed);
+	}
+	if (j->j_log != NULL) {
+		kfree(j->j_log);
+	}
+	if (j->j_cv != NULL) {
+		cv_destroy(j->j_cv);
+	}
+	if (j->j_lock != NULL) {
+		lock_destroy(j->j_lock);
+	}
+	kfree(j);
+}
+
+/*
+ * Start journaling metadata changes on a newly mounted volume, first
+ * giving it a journal if it doesn't have one.
+ */
+int
+sfs_jinit(struct sfs_fs *sfs)
+{
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct sfs_journal *j;
+	u_int32_t bitblocks = SFS_BITBLOCKS(sp->sp_nblocks);
+	int result;
+
+	assert(sfs->sfs_journal == NULL);
+
+	if (sp->sp_jblocks == 0) {
+		result = jcreate(sfs);
+		if (result || sp->sp_jblocks == 0) {
+			return result;
+		}
+	}
+	/* Each commit logs the freemap and superblock besides the rest */
+	if (sp->sp_jblocks < 2 + bitblocks + SFS_JMIN) {
+		kprintf("sfs: %s: journal too small; not using it\n",
+			sp->sp_volname);
+		return 0;
+	}
+
+	if (jvols_lock == NULL) {
+		jvols_lock = lock_create("sfs journals");
+		if (jvols_lock == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	j = kmalloc(sizeof(struct sfs_journal));
+	if (j == NULL) {
+		return ENOMEM;
+	}
+	j->j_lock = lock_create("sfs journal");
+	j->j_cv = cv_create("sfs journal");
+	j->j_log = kmalloc((sp->sp_jblocks - 1) * SFS_BLOCKSIZE);
+	j->j_freed = bitmap_create(sp->sp_nblocks);
+	if (j->j_lock == NULL || j->j_cv == NULL || j->j_log == NULL ||
+	    j->j_freed == NULL) {
+		jdestroy(j);
+		return ENOMEM;
+	}
+	j->j_nops = 0;
+	j->j_committing = 0;
+	j->j_max = sp->sp_jblocks - 2 - bitblocks;
+	if (j->j_max > SFS_JMAX) {
+		j->j_max = SFS_JMAX;
+	}
+	j->j_freelo = sp->sp_nblocks;
+	j->j_freehi = 0;
+
+	/* sfs_jreplay has left the header empty */
+	result = sfs_rblock(sfs, &j->j_head, sp->sp_jstart);
+	if (result) {
+		jdestroy(j);
+		return result;
+	}
+	assert(j->j_head.sjh_magic == SFS_JMAGIC);
+	assert(j->j_head.sjh_nblocks == 0);
+
+	sfs->sfs_journal = j;
+
+	lock_acquire(jvols_lock);
+	j->j_next = jvols;
+	jvols = sfs;
+	lock_release(jvols_lock);
+
+	return 0;
+}
+
+/*
+ * Stop journaling, on unmount. Everything must have been committed.
+ */
+void
+sfs_jdestroy(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_fs **pp;
+
+	if (j == NULL) {
+		return;
+	}
+	assert(j->j_nops == 0);
+	assert(j->j_head.sjh_nblocks == 0);
+
+	lock_acquire(jvols_lock);
+	for (pp = &jvols; *pp != sfs; pp = &(*pp)->sfs_journal->j_next) {
+		assert(*pp != NULL);
+	}
+	*pp = j->j_next;
+	lock_release(jvols_lock);
+
+	sfs->sfs_journal = NULL;
+	jdestroy(j);
+}
+
+/*
+ * The blocks of the last commit have all been written back to where
+ * they belong: clear the journal header. Until the header is clear,
+ * the journal can't be reused.
+ */
+static
+int
+jclear(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	u_int32_t n;
+	int result;
+
+	n = j->j_head.sjh_nblocks;
+	if (n == 0) {
+		return 0;
+	}
+	j->j_head.sjh_nblocks = 0;
+	result = sfs_wblock(sfs, &j->j_head, sfs->sfs_super.sp_jstart);
+	if (result) {
+		/* Try again next time */
+		j->j_head.sjh_nblocks = n;
+	}
+	return result;
+}
+
+/*
+ * Commit: called with j_lock held. Only metadata is written; file data
+ * is left to the syncer, or to whoever asked for the commit.
+ */
+static
+int
+jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	struct sfs_super *sp = &sfs->sfs_super;
+	struct uio ku;
+	u_int32_t i, n;
+	int result;
+
+	/* Let the operations in progress finish, and no new ones start */
+	j->j_committing = 1;
+	while (j->j_nops > 0) {
+		cv_wait(j->j_cv, j->j_lock);
+	}
+
+	/*
+	 * If the last commit didn't get all the way, finish it first.
+	 * Its blocks are ordinary dirty buffers by now, mixed in with
+	 * everything else.
+	 */
+	if (j->j_head.sjh_nblocks != 0) {
+		result = sfs_bsync(sfs);
+		if (result == 0) {
+			result = jclear(sfs);
+		}
+		if (result) {
+			goto done;
+		}
+	}
+
+	/*
+	 * Blocks freed since the last commit become free in this one,
+	 * and can be reused once it's done.
+	 */
+	for (i=j->j_freelo; i<j->j_freehi; i++) {
+		if (bitmap_isset(j->j_freed, i)) {
+			bitmap_unmark(j->j_freed, i);
+			bitmap_unmark(sfs->sfs_freemap, i);
+			sfs_mapdirty(sfs, i);
+		}
+	}
+	j->j_freelo = sp->sp_nblocks;
+	j->j_freehi = 0;
+
+	/* Get the freemap and superblock into the cache with the rest */
+	result = sfs_writemeta(sfs);
+	if (result) {
+		goto done;
+	}
+
+	result = sfs_bjgather(sfs, j->j_bufs, sp->sp_jblocks - 1, &n);
+	if (result) {
+		/* j_max and SFS_JOPMAX should make this impossible */
+		panic("sfs: %s: journal overflow\n", sp->sp_volname);
+	}
+	if (n == 0) {
+		/* No metadata changed */
+		goto done;
+	}
+
+	/* Write them all to the journal in one request */
+	for (i=0; i<n; i++) {
+		memcpy(j->j_log + i*SFS_BLOCKSIZE, j->j_bufs[i]->b_data,
+		       SFS_BLOCKSIZE);
+		j->j_head.sjh_blocks[i] = j->j_bufs[i]->b_block;
+	}
+	mk_kuio(&ku, j->j_log, n*SFS_BLOCKSIZE,
+		((off_t)(sp->sp_jstart + 1))*SFS_BLOCKSIZE, UIO_WRITE);
+	result = sfs_rwblock(sfs, &ku);
+	if (result) {
+		sfs_bjrelease(j->j_bufs, n);
+		goto done;
+	}
+
+	/* Writing the header is what commits them */
+	j->j_head.sjh_seq++;
+	j->j_head.sjh_nblocks = n;
+	result = sfs_wblock(sfs, &j->j_head, sp->sp_jstart);
+	if (result) {
+		j->j_head.sjh_nblocks = 0;
+		sfs_bjrelease(j->j_bufs, n);
+		goto done;
+	}
+
+	/* Now send them home, and then the journal is free again */
+	result = sfs_bjwrite(j->j_bufs, n);
+	if (result == 0) {
+		result = jclear(sfs);
+	}
+
+ done:
+	j->j_committing = 0;
+	cv_broadcast(j->j_cv, j->j_lock);
+	return result;
+}
+
+/*
+ * Commit SFS's metadata changes and write back everything else. On a
+ * volume without a journal, this is just sfs_bsync.
+ */
+int
+sfs_jcommit(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j != NULL) {
+		lock_acquire(j->j_lock);
+		result = jcommit(sfs);
+		lock_release(j->j_lock);
+		if (result) {
+			return result;
+		}
+	}
+	return sfs_bsync(sfs);
+}
+
+/*
+ * Commit every journaled volume. Called by the syncer, which writes
+ * back the rest itself.
+ */
+void
+sfs_jcommitall(void)
+{
+	struct sfs_fs *sfs;
+	struct sfs_journal *j;
+	int result;
+
+	if (jvols_lock == NULL) {
+		return;
+	}
+
+	lock_acquire(jvols_lock);
+	for (sfs = jvols; sfs != NULL; sfs = j->j_next) {
+		j = sfs->sfs_journal;
+		lock_acquire(j->j_lock);
+		result = jcommit(sfs);
+		lock_release(j->j_lock);
+		if (result) {
+			kprintf("sfs: %s: journal commit: %s\n",
+				sfs->sfs_super.sp_volname, strerror(result));
+		}
+	}
+	lock_release(jvols_lock);
+}
+
+/*
+ * Start an operation that changes metadata. If what's waiting to be
+ * committed plus what this and the other operations in progress might
+ * add wouldn't fit, commit first.
+ */
+int
+sfs_jbegin(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+	int result;
+
+	if (j == NULL) {
+		return 0;
+	}
+
+	lock_acquire(j->j_lock);
+	while (j->j_committing ||
+	       sfs->sfs_njdirty + (j->j_nops + 1)*SFS_JOPMAX > j->j_max) {
+		if (j->j_committing || j->j_nops > 0) {
+			cv_wait(j->j_cv, j->j_lock);
+			continue;
+		}
+		result = jcommit(sfs);
+		if (result) {
+			lock_release(j->j_lock);
+			return result;
+		}
+	}
+	j->j_nops++;
+	lock_release(j->j_lock);
+	return 0;
+}
+
+/*
+ * Finish an operation started with sfs_jbegin.
+ */
+void
+sfs_jend(struct sfs_fs *sfs)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	if (j == NULL) {
+		return;
+	}
+
+	lock_acquire(j->j_lock);
+	assert(j->j_nops > 0);
+	j->j_nops--;
+	cv_broadcast(j->j_cv, j->j_lock);
+	lock_release(j->j_lock);
+}
+
+/*
+ * Note that BLOCK has been freed. It stays marked in use until the
+ * next commit.
+ */
+void
+sfs_jfree(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_journal *j = sfs->sfs_journal;
+
+	lock_acquire(j->j_lock);
+	bitmap_mark(j->j_freed, block);
+	if (block < j->j_freelo) {
+		j->j_freelo = block;
+	}
+	if (block >= j->j_freehi) {
+		j->j_freehi = block + 1;
+	}
+	lock_release(j->j_lock);
+}
@@ -6,7 +6,6 @@
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
-#include <array.h>
 #include <bitmap.h>
 #include <kern/stat.h>
 #include <kern/errno.h>
@@ -20,31 +19,53 @@ static int
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 		 struct sfs_vnode **ret);
 
+/* With the vnode ops, but also used by sfs_reclaim */
+static int sfs_dotruncate(struct sfs_vnode *sv, off_t len);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
 
-/* Zero out a disk block. */
+/*
+ * Zero out a disk block (in the buffer cache). META says whether it's
+ * going to hold metadata, which has to go through the journal.
+ */
 static
 int
-sfs_clearblock(struct sfs_fs *sfs, u_int32_t block)
+sfs_clearblock(struct sfs_fs *sfs, u_int32_t block, int meta)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_bget(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(b->b_data, SFS_BLOCKSIZE);
+	if (meta) {
+		sfs_bjdirty(b);
+	}
+	else {
+		sfs_bdirty(b);
+	}
+	sfs_brelse(b);
+	return 0;
 }
 
-/* Write an on-disk inode structure back out to disk. */
-static
+/* Write an on-disk inode structure back out to the buffer cache. */
 int
 sfs_sync_inode(struct sfs_vnode *sv)
 {
 	if (sv->sv_dirty) {
 		struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-		int result = sfs_wblock(sfs, &sv->sv_i, sv->sv_ino);
+		struct sfs_buf *b;
+		int result = sfs_bget(sfs, sv->sv_ino, &b);
 		if (result) {
 			return result;
 		}
+		memcpy(b->b_data, &sv->sv_i, SFS_BLOCKSIZE);
+		sfs_bjdirty(b);
+		sfs_brelse(b);
 		sv->sv_dirty = 0;
 	}
 	return 0;
@@ -55,7 +76,69 @@ sfs_sync_inode(struct sfs_vnode *sv)
 // Space allocation
 
 /*
- * Allocate a block.
+ * Note that the freemap bit for DISKBLOCK has changed, so the sector
+ * of the freemap holding it needs writing out.
+ */
+void
+sfs_mapdirty(struct sfs_fs *sfs, u_int32_t diskblock)
+{
+	u_int32_t j = diskblock / SFS_BLOCKBITS;
+
+	if (!bitmap_isset(sfs->sfs_mapdirty, j)) {
+		bitmap_mark(sfs->sfs_mapdirty, j);
+	}
+	sfs->sfs_freemapdirty = 1;
+}
+
+/*
+ * Allocate N blocks in a row, at or as soon after GOAL as possible.
+ * If GOAL is 0, start from the next-free cursor, which is where the
+ * last allocation ended; so new things go after old ones rather than
+ * into whatever holes are left near the start of the disk. The blocks
+ * are not cleared. If RESERVE is set, the blocks are only reserved:
+ * they stay free in the freemap on disk until sfs_fballoc hands them
+ * out, so a crash can't leave them allocated to nothing.
+ */
+static
+int
+sfs_brange(struct sfs_fs *sfs, u_int32_t goal, u_int32_t n, int reserve,
+	   u_int32_t *diskblock)
+{
+	u_int32_t i;
+	int result;
+
+	if (goal == 0) {
+		goal = sfs->sfs_nextfree;
+	}
+
+	result = bitmap_alloc_range(sfs->sfs_freemap, goal, n, diskblock);
+	if (result) {
+		return result;
+	}
+	if (reserve) {
+		for (i=0; i<n; i++) {
+			bitmap_mark(sfs->sfs_resmap, *diskblock + i);
+		}
+	}
+	else {
+		/* The run can span two freemap sectors, but no more */
+		sfs_mapdirty(sfs, *diskblock);
+		sfs_mapdirty(sfs, *diskblock + n - 1);
+	}
+
+	if (*diskblock + n > sfs->sfs_super.sp_nblocks) {
+		panic("sfs: balloc: invalid block %u\n", *diskblock + n - 1);
+	}
+
+	sfs->sfs_nextfree = *diskblock + n;
+	if (sfs->sfs_nextfree >= sfs->sfs_super.sp_nblocks) {
+		sfs->sfs_nextfree = 0;
+	}
+	return 0;
+}
+
+/*
+ * Allocate a block for an inode.
  */
 static
 int
@@ -63,29 +146,99 @@ sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	result = sfs_brange(sfs, 0, 1, 0, diskblock);
 	if (result) {
 		return result;
 	}
-	sfs->sfs_freemapdirty = 1;
 
-	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
-		panic("sfs: balloc: invalid block %u\n", *diskblock);
+	/* Clear block before returning it */
+	return sfs_clearblock(sfs, *diskblock, 1);
+}
+
+/*
+ * Allocate a block (data or indirect) for file SV. Blocks are handed
+ * out in order from a run of SFS_PREALLOC reserved for the file, so a
+ * file written a block at a time still ends up contiguous on disk.
+ * When the run is used up, the next is taken right after the file's
+ * last block if possible (sv_goal). The run is only reserved in
+ * memory; each block is marked in use on disk as it is handed out.
+ * INDIRECT says whether the block will be an indirect block; those,
+ * and directory blocks, are metadata.
+ */
+static
+int
+sfs_fballoc(struct sfs_vnode *sv, int indirect, u_int32_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	int result;
+
+	if (sv->sv_npre == 0) {
+		result = sfs_brange(sfs, sv->sv_goal, SFS_PREALLOC, 1,
+				    &sv->sv_pre);
+		if (result == 0) {
+			sv->sv_npre = SFS_PREALLOC;
+		}
+		else if (result == ENOSPC) {
+			/* No room for a whole run; just get one */
+			result = sfs_brange(sfs, sv->sv_goal, 1, 1,
+					    &sv->sv_pre);
+			if (result) {
+				return result;
+			}
+			sv->sv_npre = 1;
+		}
+		else {
+			return result;
+		}
 	}
 
+	*diskblock = sv->sv_pre++;
+	sv->sv_npre--;
+	sv->sv_goal = *diskblock + 1;
+	bitmap_unmark(sfs->sfs_resmap, *diskblock);
+	sfs_mapdirty(sfs, *diskblock);
+
 	/* Clear block before returning it */
-	return sfs_clearblock(sfs, *diskblock);
+	return sfs_clearblock(sfs, *diskblock,
+			      indirect || sv->sv_i.sfi_type == SFS_TYPE_DIR);
+}
+
+/*
+ * Give back any blocks SV has reserved but not used. Called when the
+ * file is closed, truncated or reclaimed. They were never marked in
+ * use on disk, so the freemap there doesn't change.
+ */
+static
+void
+sfs_fbrelease(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	while (sv->sv_npre > 0) {
+		bitmap_unmark(sfs->sfs_resmap, sv->sv_pre);
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_pre);
+		sv->sv_pre++;
+		sv->sv_npre--;
+	}
 }
 
 /*
- * Free a block.
+ * Free a block. With a journal, it isn't free for reuse until the
+ * next commit, so nothing can be written over it while the committed
+ * metadata may still point at it.
  */
 static
 void
 sfs_bfree(struct sfs_fs *sfs, u_int32_t diskblock)
 {
+	/* Any cached contents must not be written over the next user's */
+	sfs_binval(sfs, diskblock);
+	if (sfs->sfs_journal != NULL) {
+		sfs_jfree(sfs, diskblock);
+		return;
+	}
 	bitmap_unmark(sfs->sfs_freemap, diskblock);
-	sfs->sfs_freemapdirty = 1;
+	sfs_mapdirty(sfs, diskblock);
 }
 
 /*
@@ -106,33 +259,77 @@ sfs_bused(struct sfs_fs *sfs, u_int32_t diskblock)
 //
 // Block mapping/inode maintenance
 
+/*
+ * Get entry IDX of indirect block IDBLOCK. If it's empty and DOALLOC
+ * is set, allocate a block and store it there; INDIRECT says whether
+ * that will be another indirect block.
+ */
+static
+int
+sfs_idget(struct sfs_vnode *sv, u_int32_t idblock, u_int32_t idx, int doalloc,
+	  int indirect, u_int32_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *idb;	/* the indirect block, from the buffer cache */
+	u_int32_t *idbuf;
+	u_int32_t block;
+	int result;
+
+	/*
+	 * Get the indirect block. After the first time, this doesn't
+	 * need the disk.
+	 */
+	result = sfs_bread(sfs, idblock, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = (u_int32_t *)idb->b_data;
+
+	/* Get the block out of the indirect block buffer */
+	block = idbuf[idx];
+
+	/* If there's no block there, allocate one */
+	if (block==0 && doalloc) {
+		result = sfs_fballoc(sv, indirect, &block);
+		if (result) {
+			sfs_brelse(idb);
+			return result;
+		}
+
+		/* Remember the block we allocated; the indirect block is dirty */
+		idbuf[idx] = block;
+		sfs_bjdirty(idb);
+	}
+	sfs_brelse(idb);
+
+	*ret = block;
+	return 0;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
  * file. If DOALLOC is set, and no such block exists, one will be
  * allocated.
+ *
+ * Past the direct blocks come the blocks mapped by the single, then
+ * the double, then the triple indirect block. To save going through
+ * the upper levels each time, the vnode remembers the last single
+ * indirect block it went through (sv_leaf), which is usually the one
+ * wanted next.
  */
 static
 int
 sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	    u_int32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 	u_int32_t block;
-	u_int32_t idblock;
-	u_int32_t idnum, idoff;
-	int result;
+	u_int32_t *idblockp;
+	u_int32_t offset, span;
+	int levels, result;
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	assert(SFS_DBPERIDB*sizeof(u_int32_t)==SFS_BLOCKSIZE);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -147,7 +344,7 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			result = sfs_fballoc(sv, 0, &block);
 			if (result) {
 				return result;
 			}
@@ -169,29 +366,53 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * Is it covered by the single indirect block we used last?
 	 */
-
-	fileblock -= SFS_NDIRECT;
-
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
+	if (sv->sv_leaf != 0 && fileblock >= sv->sv_leafbase &&
+	    fileblock - sv->sv_leafbase < SFS_DBPERIDB) {
+		result = sfs_idget(sv, sv->sv_leaf,
+				   fileblock - sv->sv_leafbase, doalloc, 0,
+				   &block);
+		if (result) {
+			return result;
+		}
+		goto done;
+	}
 
 	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
+	 * It's not a direct block; it must be under one of the indirect
+	 * blocks. Subtract off the number of direct blocks, and then the
+	 * number of blocks under each indirect block we go past, so
+	 * OFFSET ends up as the offset into the indirect block space of
+	 * the one it's under. SPAN is the number of file blocks each
+	 * entry of that indirect block covers.
 	 */
-	if (idnum > 0) {
+	offset = fileblock - SFS_NDIRECT;
+	span = 1;
+	if (offset < SFS_DBPERIDB) {
+		idblockp = &sv->sv_i.sfi_indirect;
+		levels = 1;
+	}
+	else if ((offset -= SFS_DBPERIDB) < SFS_DBPERIDB*SFS_DBPERIDB) {
+		idblockp = &sv->sv_i.sfi_dindirect;
+		levels = 2;
+		span = SFS_DBPERIDB;
+	}
+	else if ((offset -= SFS_DBPERIDB*SFS_DBPERIDB) <
+		 SFS_DBPERIDB*SFS_DBPERIDB*SFS_DBPERIDB) {
+		idblockp = &sv->sv_i.sfi_tindirect;
+		levels = 3;
+		span = SFS_DBPERIDB*SFS_DBPERIDB;
+	}
+	else {
+		/* Too big for us to handle, so fail. */
 		return EINVAL;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top indirect block. */
+	block = *idblockp;
 
-	if (idblock==0 && !doalloc) {
+	if (block==0 && !doalloc) {
 		/*
 		 * There's no indirect block allocated. We weren't
 		 * asked to allocate anything, so pretend the indirect
@@ -200,57 +421,53 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		*diskblock = 0;
 		return 0;
 	}
-	else if (idblock==0) {
+	else if (block==0) {
 		/*
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
 		 * the indirect block. Thus, we need to allocate an
 		 * indirect block.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		result = sfs_fballoc(sv, 1, &block);
 		if (result) {
 			return result;
 		}
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*idblockp = block;
 
 		/* Mark the inode dirty */
 		sv->sv_dirty = 1;
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
-		/*
-		 * We already have an indirect block allocated; load it.
-		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+		/* sfs_fballoc cleared the new block in the cache */
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
-
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+	/* Go down through the levels of indirect blocks */
+	for (; levels > 1; levels--) {
+		result = sfs_idget(sv, block, offset / span, doalloc, 1,
+				   &block);
 		if (result) {
 			return result;
 		}
+		if (block == 0) {
+			/* A hole */
+			*diskblock = 0;
+			return 0;
+		}
+		offset %= span;
+		span /= SFS_DBPERIDB;
+	}
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+	/* BLOCK is now a single indirect block; remember it */
+	sv->sv_leaf = block;
+	sv->sv_leafbase = fileblock - offset;
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
+	result = sfs_idget(sv, block, offset, doalloc, 0, &block);
+	if (result) {
+		return result;
 	}
 
+ done:
 	/* Hand back the result and return. */
 	if (block != 0 && !sfs_bused(sfs, block)) {
 		panic("sfs: Data block %u (block %u of file %u) marked free\n",
@@ -264,6 +481,22 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 //
 // File-level I/O
 
+/*
+ * Mark a buffer of SV's dirty after writing into it. Directory
+ * contents are metadata; file contents aren't journaled.
+ */
+static
+void
+sfs_iodirty(struct sfs_vnode *sv, struct sfs_buf *b)
+{
+	if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+		sfs_bjdirty(b);
+	}
+	else {
+		sfs_bdirty(b);
+	}
+}
+
 /*
  * Do I/O to a block of a file that doesn't cover the whole block.  We
  * need to read in the original block first, even if we're writing, so
@@ -279,16 +512,11 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      u_int32_t skipstart, u_int32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
+	/* I/O buffer for holes that are read */
+	static char zeros[SFS_BLOCKSIZE];
 
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *b;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
@@ -310,52 +538,47 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		return uiomove(zeros+skipstart, len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_bread(sfs, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 * If it was a write, the buffer is now dirty (even if the write
+	 * only got partway); it goes back to disk later.
 	 */
+	result = uiomove(b->b_data+skipstart, len, uio);
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		sfs_iodirty(sv, b);
 	}
+	sfs_brelse(b);
 
-	return 0;
+	return result;
 }
 
 /*
- * Do I/O (either read or write) of a single whole block.
+ * Do I/O (either read or write) of whole blocks: at least one, and up
+ * to MAXBLOCKS when reading blocks that are contiguous on disk.
  */
 static
 int
-sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
+sfs_blockio(struct sfs_vnode *sv, struct uio *uio, u_int32_t maxblocks)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
-	u_int32_t diskblock;
+	struct sfs_buf *b;
+	u_int32_t diskblock, nextblock;
 	u_int32_t fileblock;
+	u_int32_t nblocks;
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
 	off_t saveoff;
@@ -383,6 +606,55 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 		return uiomovezeros(SFS_BLOCKSIZE, uio);
 	}
 
+	/*
+	 * Writes go into the buffer cache (write-behind): the syncer
+	 * writes them back in batches. If the buffer wasn't holding the
+	 * block and the copy fails, sfs_brelse drops it again.
+	 */
+	if (uio->uio_rw == UIO_WRITE) {
+		int wasvalid;
+
+		result = sfs_bget(sfs, diskblock, &b);
+		if (result) {
+			return result;
+		}
+		wasvalid = b->b_valid;
+		result = uiomove(b->b_data, SFS_BLOCKSIZE, uio);
+		if (result == 0 || wasvalid) {
+			sfs_iodirty(sv, b);
+		}
+		sfs_brelse(b);
+		return result;
+	}
+
+	/*
+	 * Reads use the cache if the block is there (read ahead, or
+	 * dirty); otherwise do the I/O straight to disk without pushing
+	 * metadata out of the cache.
+	 */
+	b = sfs_bpeek(sfs, diskblock);
+	if (b != NULL) {
+		result = uiomove(b->b_data, SFS_BLOCKSIZE, uio);
+		sfs_brelse(b);
+		return result;
+	}
+
+	/*
+	 * Take in the following blocks of the request too, as long as
+	 * they're the next blocks on disk and not cached, so the whole
+	 * run is one device request.
+	 */
+	nblocks = 1;
+	while (nblocks < maxblocks) {
+		result = sfs_bmap(sv, fileblock+nblocks, 0, &nextblock);
+		if (result || nextblock != diskblock+nblocks ||
+		    sfs_bcached(sfs, nextblock)) {
+			/* Leave it (and any error) for the next call */
+			break;
+		}
+		nblocks++;
+	}
+
 	/*
 	 * Do the I/O directly to the uio region. Save the uio_offset,
 	 * and substitute one that makes sense to the device.
@@ -392,11 +664,11 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	uio->uio_offset = diskoff;
 
 	/*
-	 * Temporarily set the residue to be one block size.
+	 * Temporarily set the residue to be the size of the run.
 	 */
-	assert(uio->uio_resid >= SFS_BLOCKSIZE);
+	assert(uio->uio_resid >= nblocks*SFS_BLOCKSIZE);
 	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
+	diskres = nblocks*SFS_BLOCKSIZE;
 	uio->uio_resid = diskres;
 	
 	result = sfs_rwblock(sfs, uio);
@@ -411,6 +683,83 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+/*
+ * Readahead, called before a read of the file.
+ *
+ * A read that starts where the last one ended is sequential. Each
+ * sequential read doubles the readahead window, from SFS_RAMIN up to
+ * SFS_RAMAX blocks; any other read turns readahead off. When fewer
+ * than half a window's worth of blocks past this read have been read
+ * ahead, the blocks up to a full window past it are read into the
+ * buffer cache, where sfs_blockio and sfs_partialio find them. Blocks
+ * that are contiguous on disk are read together.
+ * Readahead is only advice, so errors are ignored.
+ */
+static
+void
+sfs_readahead(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t last, start, end, fileblock, diskblock;
+	u_int32_t runstart = 0, runlen = 0;
+
+	if (uio->uio_offset != sv->sv_raoff) {
+		sv->sv_rawin = 0;
+		sv->sv_raend = 0;
+		return;
+	}
+
+	if (sv->sv_rawin == 0) {
+		sv->sv_rawin = SFS_RAMIN;
+	}
+	else if (sv->sv_rawin < SFS_RAMAX) {
+		sv->sv_rawin *= 2;
+	}
+
+	/* The last block of this read, and one past the window after it */
+	last = (uio->uio_offset + uio->uio_resid - 1) / SFS_BLOCKSIZE;
+	end = last + 1 + sv->sv_rawin;
+	if (end > DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE)) {
+		end = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	}
+
+	if (sv->sv_raend >= last + 1 + sv->sv_rawin/2 || sv->sv_raend >= end) {
+		/* Still enough read ahead */
+		return;
+	}
+
+	/*
+	 * Start from where readahead got to, but don't bother caching
+	 * more than a window of a large read's own blocks.
+	 */
+	start = uio->uio_offset / SFS_BLOCKSIZE;
+	if (start < sv->sv_raend) {
+		start = sv->sv_raend;
+	}
+	if (end - start > SFS_RAMAX) {
+		start = end - SFS_RAMAX;
+	}
+
+	for (fileblock = start; fileblock < end; fileblock++) {
+		if (sfs_bmap(sv, fileblock, 0, &diskblock)) {
+			diskblock = 0;
+		}
+		if (runlen > 0 && diskblock == runstart + runlen) {
+			runlen++;
+			continue;
+		}
+		if (runlen > 0) {
+			sfs_bprefetch(sfs, runstart, runlen);
+		}
+		runstart = diskblock;
+		runlen = diskblock != 0 ? 1 : 0;
+	}
+	if (runlen > 0) {
+		sfs_bprefetch(sfs, runstart, runlen);
+	}
+	sv->sv_raend = end;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -419,7 +768,6 @@ int
 sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	u_int32_t blkoff;
-	u_int32_t nblocks, i;
 	int result = 0;
 	u_int32_t extraresid = 0;
 
@@ -442,6 +790,10 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			assert(uio->uio_resid > extraresid);
 			uio->uio_resid -= extraresid;
 		}
+
+		if (uio->uio_resid > 0) {
+			sfs_readahead(sv, uio);
+		}
 	}
 
 	/*
@@ -473,12 +825,12 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Now we should be block-aligned. Do the remaining whole blocks.
+	 * Now we should be block-aligned. Do the remaining whole blocks,
+	 * as many at a time as sfs_blockio can manage.
 	 */
 	assert(uio->uio_offset % SFS_BLOCKSIZE == 0);
-	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
-	for (i=0; i<nblocks; i++) {
-		result = sfs_blockio(sv, uio);
+	while (uio->uio_resid >= SFS_BLOCKSIZE) {
+		result = sfs_blockio(sv, uio, uio->uio_resid / SFS_BLOCKSIZE);
 		if (result) {
 			goto out;
 		}
@@ -498,6 +850,11 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 
  out:
 
+	/* Remember where a sequential read would continue */
+	if (uio->uio_rw == UIO_READ) {
+		sv->sv_raoff = uio->uio_offset;
+	}
+
 	/* If writing, adjust file length */
 	if (uio->uio_rw == UIO_WRITE && 
 	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
@@ -605,10 +962,284 @@ sfs_dir_nentries(struct sfs_vnode *sv)
 	return size / sizeof(struct sfs_dir);
 }
 
+////////////////////////////////////////////////////////////
+//
+// Directory index
+//
+// If anything goes wrong with the index (running out of memory, say)
+// it's just thrown away, and the directory is searched on disk until
+// the next time the index can be built.
+
+static
+unsigned
+di_hashname(const char *name, unsigned nbuckets)
+{
+	unsigned h = 0;
+
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h % nbuckets;
+}
+
+/*
+ * Throw away a directory's index.
+ */
+static
+void
+di_destroy(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di = sv->sv_dirindex;
+	struct sfs_direntry *de;
+	unsigned i;
+
+	if (di == NULL) {
+		return;
+	}
+	for (i=0; i<di->di_nbuckets; i++) {
+		while ((de = di->di_hash[i]) != NULL) {
+			di->di_hash[i] = de->de_next;
+			kfree(de);
+		}
+	}
+	kfree(di->di_hash);
+	if (di->di_free != NULL) {
+		kfree(di->di_free);
+	}
+	kfree(di);
+	sv->sv_dirindex = NULL;
+}
+
+static
+struct sfs_direntry *
+di_lookup(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_direntry *de;
+
+	for (de = di->di_hash[di_hashname(name, di->di_nbuckets)];
+	     de != NULL; de = de->de_next) {
+		if (!strcmp(de->de_name, name)) {
+			return de;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Double the size of the hash table.
+ */
+static
+int
+di_grow(struct sfs_dirindex *di)
+{
+	struct sfs_direntry **newhash, *de;
+	unsigned newsize = di->di_nbuckets*2;
+	unsigned i, h;
+
+	newhash = kmalloc(newsize*sizeof(struct sfs_direntry *));
+	if (newhash == NULL) {
+		return ENOMEM;
+	}
+	for (i=0; i<newsize; i++) {
+		newhash[i] = NULL;
+	}
+	for (i=0; i<di->di_nbuckets; i++) {
+		while ((de = di->di_hash[i]) != NULL) {
+			di->di_hash[i] = de->de_next;
+			h = di_hashname(de->de_name, newsize);
+			de->de_next = newhash[h];
+			newhash[h] = de;
+		}
+	}
+	kfree(di->di_hash);
+	di->di_hash = newhash;
+	di->di_nbuckets = newsize;
+	return 0;
+}
+
+static
+int
+di_add(struct sfs_dirindex *di, const char *name, u_int32_t ino, int slot)
+{
+	struct sfs_direntry *de;
+	unsigned h;
+
+	if (di->di_nentries >= 2*di->di_nbuckets) {
+		/* Not fatal; chains just get longer */
+		(void)di_grow(di);
+	}
+
+	de = kmalloc(sizeof(struct sfs_direntry));
+	if (de == NULL) {
+		return ENOMEM;
+	}
+	strcpy(de->de_name, name);
+	de->de_ino = ino;
+	de->de_slot = slot;
+
+	h = di_hashname(name, di->di_nbuckets);
+	de->de_next = di->di_hash[h];
+	di->di_hash[h] = de;
+	di->di_nentries++;
+	return 0;
+}
+
+static
+void
+di_remove(struct sfs_dirindex *di, const char *name)
+{
+	struct sfs_direntry **pp, *de;
+
+	pp = &di->di_hash[di_hashname(name, di->di_nbuckets)];
+	while ((de = *pp) != NULL) {
+		if (!strcmp(de->de_name, name)) {
+			*pp = de->de_next;
+			kfree(de);
+			di->di_nentries--;
+			return;
+		}
+		pp = &de->de_next;
+	}
+}
+
+/*
+ * Remember that SLOT is empty.
+ */
+static
+int
+di_addfree(struct sfs_dirindex *di, int slot)
+{
+	int *newfree;
+	unsigned i, newmax;
+
+	if (di->di_nfree == di->di_maxfree) {
+		newmax = di->di_maxfree ? di->di_maxfree*2 : SFS_DIRHASH;
+		newfree = kmalloc(newmax*sizeof(int));
+		if (newfree == NULL) {
+			return ENOMEM;
+		}
+		for (i=0; i<di->di_nfree; i++) {
+			newfree[i] = di->di_free[i];
+		}
+		if (di->di_free != NULL) {
+			kfree(di->di_free);
+		}
+		di->di_free = newfree;
+		di->di_maxfree = newmax;
+	}
+	di->di_free[di->di_nfree++] = slot;
+	return 0;
+}
+
+/*
+ * Build the index for a directory by reading through it a block at
+ * a time. Returns the index, or NULL if there isn't enough memory.
+ */
+static
+struct sfs_dirindex *
+di_build(struct sfs_vnode *sv)
+{
+	struct sfs_dirindex *di;
+	struct sfs_dir *sds;
+	struct uio ku;
+	int nentries = sfs_dir_nentries(sv);
+	int perblock = SFS_BLOCKSIZE / sizeof(struct sfs_dir);
+	int i, j, n, result;
+
+	assert(sv->sv_dirindex == NULL);
+
+	sds = kmalloc(SFS_BLOCKSIZE);
+	if (sds == NULL) {
+		return NULL;
+	}
+	di = kmalloc(sizeof(struct sfs_dirindex));
+	if (di == NULL) {
+		kfree(sds);
+		return NULL;
+	}
+	di->di_nbuckets = SFS_DIRHASH;
+	while (di->di_nbuckets*2 < (unsigned)nentries) {
+		di->di_nbuckets *= 2;
+	}
+	di->di_hash = kmalloc(di->di_nbuckets*sizeof(struct sfs_direntry *));
+	if (di->di_hash == NULL) {
+		kfree(di);
+		kfree(sds);
+		return NULL;
+	}
+	for (i=0; i<(int)di->di_nbuckets; i++) {
+		di->di_hash[i] = NULL;
+	}
+	di->di_nentries = 0;
+	di->di_free = NULL;
+	di->di_nfree = 0;
+	di->di_maxfree = 0;
+	sv->sv_dirindex = di;
+
+	for (i=0; i<nentries; i+=perblock) {
+		n = nentries - i;
+		if (n > perblock) {
+			n = perblock;
+		}
+		mk_kuio(&ku, sds, n*sizeof(struct sfs_dir),
+			i*sizeof(struct sfs_dir), UIO_READ);
+		result = sfs_io(sv, &ku);
+		if (result == 0 && ku.uio_resid > 0) {
+			panic("sfs: readdir: Short entry (inode %u)\n",
+			      sv->sv_ino);
+		}
+		for (j=0; result==0 && j<n; j++) {
+			if (sds[j].sfd_ino == SFS_NOINO) {
+				result = di_addfree(di, i+j);
+				continue;
+			}
+			/* Ensure null termination, just in case */
+			sds[j].sfd_name[sizeof(sds[j].sfd_name)-1] = 0;
+
+			/* Each name may legally appear only once... */
+			assert(di_lookup(di, sds[j].sfd_name) == NULL);
+
+			result = di_add(di, sds[j].sfd_name, sds[j].sfd_ino,
+					i+j);
+		}
+		if (result) {
+			di_destroy(sv);
+			kfree(sds);
+			return NULL;
+		}
+	}
+
+	kfree(sds);
+	return di;
+}
+
+/*
+ * Get a directory's index, building it if need be. NULL if it can't
+ * be built.
+ */
+static
+struct sfs_dirindex *
+di_get(struct sfs_vnode *sv)
+{
+	if (sv->sv_dirindex == NULL) {
+		return di_build(sv);
+	}
+	return sv->sv_dirindex;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Directory operations
+
 /*
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * Normally this is answered from the directory's index, and the
+ * empty slot comes off the index's list of them (so if it's asked
+ * for, it must be used). The directory is read through only if there
+ * is no index.
  */
 
 static
@@ -616,11 +1247,31 @@ int
 sfs_dir_findname(struct sfs_vnode *sv, const char *name,
 		    u_int32_t *ino, int *slot, int *emptyslot)
 {
+	struct sfs_dirindex *di;
+	struct sfs_direntry *de;
 	struct sfs_dir tsd;
 	int found = 0;
 	int nentries = sfs_dir_nentries(sv);
 	int i, result;
 
+	di = di_get(sv);
+	if (di != NULL) {
+		de = di_lookup(di, name);
+		if (de == NULL) {
+			if (emptyslot != NULL && di->di_nfree > 0) {
+				*emptyslot = di->di_free[--di->di_nfree];
+			}
+			return ENOENT;
+		}
+		if (slot != NULL) {
+			*slot = de->de_slot;
+		}
+		if (ino != NULL) {
+			*ino = de->de_ino;
+		}
+		return 0;
+	}
+
 	/* For each slot... */
 	for (i=0; i<nentries; i++) {
 
@@ -669,6 +1320,10 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 	int result;
 	struct sfs_dir sd;
 
+	if (strlen(name)+1 > sizeof(sd.sfd_name)) {
+		return ENAMETOOLONG;
+	}
+
 	/* Look up the name. We want to make sure it *doesn't* exist. */
 	result = sfs_dir_findname(sv, name, NULL, NULL, &emptyslot);
 	if (result!=0 && result!=ENOENT) {
@@ -678,10 +1333,6 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 		return EEXIST;
 	}
 
-	if (strlen(name)+1 > sizeof(sd.sfd_name)) {
-		return ENAMETOOLONG;
-	}
-
 	/* If we didn't get an empty slot, add the entry at the end. */
 	if (emptyslot < 0) {
 		emptyslot = sfs_dir_nentries(sv);
@@ -698,25 +1349,45 @@ sfs_dir_link(struct sfs_vnode *sv, const char *name, u_int32_t ino, int *slot)
 	}
 
 	/* Write the entry. */
-	return sfs_writedir(sv, &sd, emptyslot);
-	
+	result = sfs_writedir(sv, &sd, emptyslot);
+
+	/*
+	 * Keep the index up to date. If the write failed we don't
+	 * know what state the slot is in, so start again from disk.
+	 */
+	if (sv->sv_dirindex != NULL) {
+		if (result || di_add(sv->sv_dirindex, name, ino, emptyslot)) {
+			di_destroy(sv);
+		}
+	}
+	return result;
 }
 
 /*
- * Unlink a name in a directory, by slot number.
+ * Unlink NAME in a directory, by slot number.
  */
 static
 int
-sfs_dir_unlink(struct sfs_vnode *sv, int slot)
+sfs_dir_unlink(struct sfs_vnode *sv, const char *name, int slot)
 {
 	struct sfs_dir sd;
+	int result;
 
 	/* Initialize a suitable directory entry... */ 
 	bzero(&sd, sizeof(sd));
 	sd.sfd_ino = SFS_NOINO;
 
 	/* ... and write it */
-	return sfs_writedir(sv, &sd, slot);
+	result = sfs_writedir(sv, &sd, slot);
+
+	/* Keep the index up to date */
+	if (result == 0 && sv->sv_dirindex != NULL) {
+		di_remove(sv->sv_dirindex, name);
+		if (di_addfree(sv->sv_dirindex, slot)) {
+			di_destroy(sv);
+		}
+	}
+	return result;
 }
 
 /*
@@ -805,52 +1476,223 @@ sfs_open(struct vnode *v, int openflags)
 		return EUNIMP;
 	}
 
-	(void)v;
-
-	return 0;
+	(void)v;
+
+	return 0;
+}
+
+/*
+ * This is called on *each* open() of a directory.
+ * Directories may only be open for read.
+ */
+static
+int
+sfs_opendir(struct vnode *v, int openflags)
+{
+	switch (openflags & O_ACCMODE) {
+	    case O_RDONLY:
+		break;
+	    case O_WRONLY:
+	    case O_RDWR:
+	    default:
+		return EISDIR;
+	}
+	if (openflags & O_APPEND) {
+		return EISDIR;
+	}
+
+	(void)v;
+	return 0;
+}
+
+/*
+ * Called on the *last* close().
+ *
+ * This function should attempt to avoid returning errors, as handling
+ * them usefully is often not possible.
+ */
+static
+int
+sfs_close(struct vnode *v)
+{
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	/* Like any metadata change, this mustn't overlap a commit */
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+
+	/* Done writing for now; give back blocks reserved for it */
+	sfs_fbrelease(v->vn_data);
+
+	/*
+	 * Put the inode in the buffer cache. It goes to disk with the
+	 * rest of the cache, on fsync or sync.
+	 */
+	result = sfs_sync_inode(v->vn_data);
+	sfs_jend(sfs);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Vnode table (all called with sfs_vnlock held)
+
+#define VNHASH(ino) ((ino) % SFS_VNHASH)
+
+static
+struct sfs_vnode *
+vn_lookup(struct sfs_fs *sfs, u_int32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	for (sv = sfs->sfs_vnhash[VNHASH(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+vn_hashins(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	u_int32_t h = VNHASH(sv->sv_ino);
+
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+vn_unhash(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **pp;
+
+	pp = &sfs->sfs_vnhash[VNHASH(sv->sv_ino)];
+	while (*pp != sv) {
+		if (*pp == NULL) {
+			panic("sfs: vnode %u not in vnode table\n",
+			      sv->sv_ino);
+		}
+		pp = &(*pp)->sv_hashnext;
+	}
+	*pp = sv->sv_hashnext;
+	sv->sv_hashnext = NULL;
+	sfs->sfs_nvnodes--;
+}
+
+/*
+ * Put an unused vnode at the most recently used end of the LRU list.
+ */
+static
+void
+vn_cache(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	assert(!sv->sv_cached);
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = sfs->sfs_vnmru;
+	if (sfs->sfs_vnmru != NULL) {
+		sfs->sfs_vnmru->sv_lrunext = sv;
+	}
+	else {
+		sfs->sfs_vnlru = sv;
+	}
+	sfs->sfs_vnmru = sv;
+	sv->sv_cached = 1;
+	sfs->sfs_nvncached++;
+}
+
+/*
+ * Take a vnode off the LRU list, because it's being used again or
+ * thrown away.
+ */
+static
+void
+vn_uncache(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	assert(sv->sv_cached);
+	if (sv->sv_lruprev != NULL) {
+		sv->sv_lruprev->sv_lrunext = sv->sv_lrunext;
+	}
+	else {
+		sfs->sfs_vnlru = sv->sv_lrunext;
+	}
+	if (sv->sv_lrunext != NULL) {
+		sv->sv_lrunext->sv_lruprev = sv->sv_lruprev;
+	}
+	else {
+		sfs->sfs_vnmru = sv->sv_lruprev;
+	}
+	sv->sv_cached = 0;
+	sfs->sfs_nvncached--;
 }
 
 /*
- * This is called on *each* open() of a directory.
- * Directories may only be open for read.
+ * Throw away the least recently used unused vnode.
  */
 static
 int
-sfs_opendir(struct vnode *v, int openflags)
+vn_evict(struct sfs_fs *sfs)
 {
-	switch (openflags & O_ACCMODE) {
-	    case O_RDONLY:
-		break;
-	    case O_WRONLY:
-	    case O_RDWR:
-	    default:
-		return EISDIR;
-	}
-	if (openflags & O_APPEND) {
-		return EISDIR;
+	struct sfs_vnode *sv = sfs->sfs_vnlru;
+	int result;
+
+	assert(sv != NULL);
+
+	/* Normally already done by sfs_close */
+	result = sfs_sync_inode(sv);
+	if (result) {
+		return result;
 	}
 
-	(void)v;
+	vn_uncache(sfs, sv);
+	vn_unhash(sfs, sv);
+	di_destroy(sv);
+	VOP_KILL(&sv->sv_v);
+	kfree(sv);
 	return 0;
 }
 
 /*
- * Called on the *last* close().
- *
- * This function should attempt to avoid returning errors, as handling
- * them usefully is often not possible.
+ * Throw away all of SFS's unused vnodes. Called on unmount.
  */
-static
 int
-sfs_close(struct vnode *v)
+sfs_vnflush(struct sfs_fs *sfs)
 {
-	/* Sync it. */
-	return VOP_FSYNC(v);
+	int result;
+
+	/* vn_evict may sync inodes */
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(sfs->sfs_vnlock);
+	while (sfs->sfs_vnlru != NULL) {
+		result = vn_evict(sfs);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(sfs->sfs_vnlock);
+	sfs_jend(sfs);
+	return result;
 }
 
 /*
  * Called when the vnode refcount (in-memory usage count) hits zero.
  *
+ * A file that's still on disk stays in the vnode table, on the LRU
+ * list, still holding the reference VOP_DECREF gave us; the next
+ * sfs_loadvnode for it takes that over. Only when there are too many
+ * such vnodes does the least recently used one really go away.
+ *
  * This function should try to avoid returning errors other than EBUSY.
  */
 static
@@ -859,13 +1701,24 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	int ix, i, num, result;
+	int result;
+
+	/*
+	 * Everything below may change metadata, so it's one journal
+	 * operation. It has to start before sfs_vnlock is taken, as
+	 * other operations take that inside theirs.
+	 */
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
-	 * decision was made to reclaim it. (You must also synchronize
-	 * this with sfs_loadvnode.)
+	 * decision was made to reclaim it. Holding sfs_vnlock keeps
+	 * sfs_loadvnode from handing it out again while we decide.
 	 */
+	lock_acquire(sfs->sfs_vnlock);
 	lock_acquire(v->vn_countlock);
 	if (v->vn_refcount != 1) {
 
@@ -874,46 +1727,52 @@ sfs_reclaim(struct vnode *v)
 		v->vn_refcount--;
 
 		lock_release(v->vn_countlock);
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend(sfs);
 		return EBUSY;
 	}
 	lock_release(v->vn_countlock);
-	
 
-	/* If there are no on-disk references to the file either, erase it. */
-	if (sv->sv_i.sfi_linkcount==0) {
-		result = VOP_TRUNCATE(&sv->sv_v, 0);
-		if (result) {
-			return result;
-		}
-	}
+	sfs_fbrelease(sv);
 
-	/* Sync the inode to disk */
-	result = sfs_sync_inode(sv);
-	if (result) {
+	if (sv->sv_i.sfi_linkcount > 0) {
+		vn_cache(sfs, sv);
+		result = 0;
+		if (sfs->sfs_nvncached > SFS_VNCACHE) {
+			result = vn_evict(sfs);
+		}
+		lock_release(sfs->sfs_vnlock);
+		sfs_jend(sfs);
 		return result;
 	}
 
-	/* If there are no on-disk references, discard the inode */
-	if (sv->sv_i.sfi_linkcount==0) {
-		sfs_bfree(sfs, sv->sv_ino);
-	}
+	/*
+	 * There are no on-disk references to the file either, so erase
+	 * it. Nobody can find it once it's out of the table, so the rest
+	 * can be done without the lock.
+	 */
+	vn_unhash(sfs, sv);
+	lock_release(sfs->sfs_vnlock);
 
-	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	ix = -1;
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv2 = array_getguy(sfs->sfs_vnodes, i);
-		if (sv2==sv) {
-			ix = i;
-			break;
-		}
+	result = sfs_dotruncate(sv, 0);
+	if (result == 0) {
+		/* Sync the inode to disk */
+		result = sfs_sync_inode(sv);
+	}
+	if (result == 0) {
+		/* Discard the inode */
+		sfs_bfree(sfs, sv->sv_ino);
 	}
-	if (ix<0) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
+	sfs_jend(sfs);
+	if (result) {
+		/* Put it back, as if it were still in use */
+		lock_acquire(sfs->sfs_vnlock);
+		vn_hashins(sfs, sv);
+		lock_release(sfs->sfs_vnlock);
+		return result;
 	}
-	array_remove(sfs->sfs_vnodes, ix);
 
+	di_destroy(sv);
 	VOP_KILL(&sv->sv_v);
 
 	/* Release the storage for the vnode structure itself. */
@@ -943,8 +1802,37 @@ int
 sfs_write(struct vnode *v, struct uio *uio)
 {
 	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	size_t len, rest;
+	int result = 0;
+
 	assert(uio->uio_rw==UIO_WRITE);
-	return sfs_io(sv, uio);
+
+	/*
+	 * Each SFS_JWRITE blocks of the write is a separate journal
+	 * operation, so a big write can't allocate more metadata than
+	 * a commit holds.
+	 */
+	while (uio->uio_resid > 0 && result == 0) {
+		len = SFS_JWRITE*SFS_BLOCKSIZE - uio->uio_offset % SFS_BLOCKSIZE;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		rest = uio->uio_resid - len;
+		uio->uio_resid = len;
+
+		result = sfs_jbegin(sfs);
+		if (result == 0) {
+			result = sfs_io(sv, uio);
+			if (result == 0) {
+				result = sfs_sync_inode(sv);
+			}
+			sfs_jend(sfs);
+		}
+
+		uio->uio_resid += rest;
+	}
+	return result;
 }
 
 /*
@@ -1043,7 +1931,25 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
-	return sfs_sync_inode(sv);
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_sync_inode(sv);
+	sfs_jend(sfs);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * The cache doesn't know which blocks are this file's, so write
+	 * back everything dirty on the volume (committing the journal
+	 * first, if there is one).
+	 */
+	return sfs_jcommit(sfs);
 }
 
 /*
@@ -1058,33 +1964,103 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 }
 
 /*
- * Called for ftruncate() and from sfs_reclaim.
+ * Discard the blocks at or past file block BLOCKLEN under the indirect
+ * block *IDBLOCKP, which maps the file blocks from BASE on through
+ * LEVELS levels of indirect blocks (1 for a single indirect block).
+ * If that leaves it empty, free the indirect block too and zero
+ * *IDBLOCKP.
  */
 static
 int
-sfs_truncate(struct vnode *v, off_t len)
+sfs_truncate_ind(struct sfs_fs *sfs, u_int32_t *idblockp, int levels,
+		 u_int32_t base, u_int32_t blocklen)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
+	struct sfs_buf *idb;	/* the indirect block, from the buffer cache */
+	u_int32_t *idbuf;
+	u_int32_t j, span, old;
+	int i, result;
+	int hasnonzero, iddirty;
 
-	struct sfs_vnode *sv = v->vn_data;
+	/* Number of file blocks each entry covers */
+	span = 1;
+	for (i=1; i<levels; i++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	if (*idblockp == 0 || base + SFS_DBPERIDB*span <= blocklen) {
+		/* Nothing here past the proposed EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_bread(sfs, *idblockp, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = (u_int32_t *)idb->b_data;
+
+	hasnonzero = 0;
+	iddirty = 0;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		/* Discard any blocks that are past the new EOF */
+		if (idbuf[j] != 0 && base + (j+1)*span > blocklen) {
+			old = idbuf[j];
+			if (levels == 1) {
+				sfs_bfree(sfs, idbuf[j]);
+				idbuf[j] = 0;
+			}
+			else {
+				result = sfs_truncate_ind(sfs, &idbuf[j],
+							  levels-1,
+							  base + j*span,
+							  blocklen);
+				if (result) {
+					if (iddirty) {
+						sfs_bjdirty(idb);
+					}
+					sfs_brelse(idb);
+					return result;
+				}
+			}
+			if (idbuf[j] != old) {
+				iddirty = 1;
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j]!=0) {
+			hasnonzero=1;
+		}
+	}
+
+	if (iddirty) {
+		sfs_bjdirty(idb);
+	}
+	sfs_brelse(idb);
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_bfree(sfs, *idblockp);
+		*idblockp = 0;
+	}
+	return 0;
+}
+
+/*
+ * Discard the blocks of SV past LEN and set its size. The work of
+ * sfs_truncate, and of erasing a file in sfs_reclaim.
+ */
+static
+int
+sfs_dotruncate(struct sfs_vnode *sv, off_t len)
+{
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	u_int32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	u_int32_t i, j, block;
-	u_int32_t idblock, baseblock, highblock;
+	u_int32_t *roots[3];
+	u_int32_t i, block, base, old;
 	int result;
-	int hasnonzero, iddirty;
-
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1099,52 +2075,32 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
-	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
+	/* The indirect block bmap remembered may be about to go */
+	sv->sv_leaf = 0;
 
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
-		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
+	/* Don't leave blocks reserved past the new end */
+	sfs_fbrelease(sv);
 
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
+	/*
+	 * Then the single, double and triple indirect blocks, in turn.
+	 * BASE is the lowest file block each one maps.
+	 */
+	roots[0] = &sv->sv_i.sfi_indirect;
+	roots[1] = &sv->sv_i.sfi_dindirect;
+	roots[2] = &sv->sv_i.sfi_tindirect;
+	base = SFS_NDIRECT;
+	block = SFS_DBPERIDB;	/* file blocks under the current one */
+	for (i=0; i<3; i++) {
+		old = *roots[i];
+		result = sfs_truncate_ind(sfs, roots[i], i+1, base, blocklen);
+		if (*roots[i] != old) {
 			sv->sv_dirty = 1;
 		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				return result;
-			}
+		if (result) {
+			return result;
 		}
+		base += block;
+		block *= SFS_DBPERIDB;
 	}
 
 	/* Set the file size */
@@ -1156,6 +2112,29 @@ sfs_truncate(struct vnode *v, off_t len)
 	return 0;
 }
 
+/*
+ * Called for ftruncate().
+ */
+static
+int
+sfs_truncate(struct vnode *v, off_t len)
+{
+	struct sfs_vnode *sv = v->vn_data;
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int result;
+
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+	result = sfs_dotruncate(sv, len);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	sfs_jend(sfs);
+	return result;
+}
+
 /*
  * Get the full pathname for a file. This only needs to work on directories.
  * Since we don't support subdirectories, assume it's the root directory
@@ -1190,36 +2169,44 @@ sfs_creat(struct vnode *v, const char *name, int excl, struct vnode **ret)
 	u_int32_t ino;
 	int result;
 
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		return result;
+		goto out;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		return EEXIST;
+		result = EEXIST;
+		goto out;
 	}
 
 	if (result==0) {
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			return result;
+			goto out;
 		}
 		*ret = &newguy->sv_v;
-		return 0;
+		goto out;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		return result;
+		goto out;
 	}
 
 	/* Link it into the directory */
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
+		sfs_jend(sfs);
+		/* Not inside the operation: this erases it again */
 		VOP_DECREF(&newguy->sv_v);
 		return result;
 	}
@@ -1230,9 +2217,22 @@ sfs_creat(struct vnode *v, const char *name, int excl, struct vnode **ret)
 	/* and consequently mark it dirty. */
 	newguy->sv_dirty = 1;
 
+	/* Both inodes go in with the rest of the operation */
+	result = sfs_sync_inode(newguy);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	if (result) {
+		sfs_jend(sfs);
+		VOP_DECREF(&newguy->sv_v);
+		return result;
+	}
+
 	*ret = &newguy->sv_v;
-	
-	return 0;
+
+ out:
+	sfs_jend(sfs);
+	return result;
 }
 
 /*
@@ -1244,23 +2244,33 @@ static
 int
 sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *f = file->vn_data;
 	int result;
 
 	assert(file->vn_fs == dir->vn_fs);
 
-	/* Just create a link */
-	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
+	result = sfs_jbegin(sfs);
 	if (result) {
 		return result;
 	}
 
-	/* and update the link count, marking the inode dirty */
-	f->sv_i.sfi_linkcount++;
-	f->sv_dirty = 1;
+	/* Just create a link */
+	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
+	if (result == 0) {
+		/* and update the link count, marking the inode dirty */
+		f->sv_i.sfi_linkcount++;
+		f->sv_dirty = 1;
+
+		result = sfs_sync_inode(f);
+		if (result == 0) {
+			result = sfs_sync_inode(sv);
+		}
+	}
 
-	return 0;
+	sfs_jend(sfs);
+	return result;
 }
 
 /*
@@ -1270,27 +2280,40 @@ static
 int
 sfs_remove(struct vnode *dir, const char *name)
 {
+	struct sfs_fs *sfs = dir->vn_fs->fs_data;
 	struct sfs_vnode *sv = dir->vn_data;
 	struct sfs_vnode *victim;
 	int slot;
 	int result;
 
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
+		sfs_jend(sfs);
 		return result;
 	}
 
 	/* Erase its directory entry. */
-	result = sfs_dir_unlink(sv, slot);
+	result = sfs_dir_unlink(sv, name, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
 		assert(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = 1;
+
+		result = sfs_sync_inode(victim);
 	}
+	sfs_jend(sfs);
 
-	/* Discard the reference that sfs_lookonce got us */
+	/*
+	 * Discard the reference that sfs_lookonce got us. If it was the
+	 * last, this erases the file, as an operation of its own.
+	 */
 	VOP_DECREF(&victim->sv_v);
 
 	return result;
@@ -1307,6 +2330,7 @@ int
 sfs_rename(struct vnode *d1, const char *n1, 
 	   struct vnode *d2, const char *n2)
 {
+	struct sfs_fs *sfs = d1->vn_fs->fs_data;
 	struct sfs_vnode *sv = d1->vn_data;
 	struct sfs_vnode *g1;
 	int slot1, slot2;
@@ -1315,9 +2339,15 @@ sfs_rename(struct vnode *d1, const char *n1,
 	assert(d1==d2);
 	assert(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	result = sfs_jbegin(sfs);
+	if (result) {
+		return result;
+	}
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
+		sfs_jend(sfs);
 		return result;
 	}
 
@@ -1342,7 +2372,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_dirty = 1;
 
 	/* Unlink the old slot */
-	result = sfs_dir_unlink(sv, slot1);
+	result = sfs_dir_unlink(sv, n1, slot1);
 	if (result) {
 		goto puke_harder;
 	}
@@ -1355,16 +2385,22 @@ sfs_rename(struct vnode *d1, const char *n1,
 	g1->sv_i.sfi_linkcount--;
 	g1->sv_dirty = 1;
 
+	result = sfs_sync_inode(g1);
+	if (result == 0) {
+		result = sfs_sync_inode(sv);
+	}
+	sfs_jend(sfs);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 
-	return 0;
+	return result;
 
  puke_harder:
 	/*
 	 * Error recovery: try to undo what we already did
 	 */
-	result2 = sfs_dir_unlink(sv, slot2);
+	result2 = sfs_dir_unlink(sv, n2, slot2);
 	if (result2) {
 		kprintf("sfs: rename: %s\n", strerror(result));
 		kprintf("sfs: rename: while cleaning up: %s\n", 
@@ -1373,6 +2409,8 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	g1->sv_i.sfi_linkcount--;
  puke:
+	sfs_jend(sfs);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 	return result;
@@ -1548,39 +2586,43 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 		 struct sfs_vnode **ret)
 {
 	struct sfs_vnode *sv;
+	struct sfs_buf *b;
 	const struct vnode_ops *ops = NULL;
-	int i, num;
 	int result;
 
-	/* Look in the vnodes table */
-	num = array_getnum(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		sv = array_getguy(sfs->sfs_vnodes, i);
-
+	/*
+	 * Look in the vnodes table. Keep the lock while loading, so two
+	 * threads can't both load the same inode.
+	 */
+	lock_acquire(sfs->sfs_vnlock);
+	sv = vn_lookup(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
-
-			/* May only be set when creating new objects */
-			assert(forcetype==SFS_TYPE_INVAL);
+		/* May only be set when creating new objects */
+		assert(forcetype==SFS_TYPE_INVAL);
 
+		if (sv->sv_cached) {
+			/* Take over the reference sfs_reclaim left it */
+			vn_uncache(sfs, sv);
+		}
+		else {
 			VOP_INCREF(&sv->sv_v);
-			*ret = sv;
-			return 0;
 		}
+		lock_release(sfs->sfs_vnlock);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
 
 	sv = kmalloc(sizeof(struct sfs_vnode));
 	if (sv==NULL) {
+		lock_release(sfs->sfs_vnlock);
 		return ENOMEM;
 	}
 
@@ -1591,15 +2633,41 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	}
 
 	/* Read the block the inode is in */
-	result = sfs_rblock(sfs, &sv->sv_i, ino);
+	result = sfs_bread(sfs, ino, &b);
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
+	memcpy(&sv->sv_i, b->b_data, SFS_BLOCKSIZE);
+	sfs_brelse(b);
 
 	/* Not dirty yet */
 	sv->sv_dirty = 0;
 
+	/* No indirect blocks looked at yet */
+	sv->sv_leaf = 0;
+	sv->sv_leafbase = 0;
+
+	/* Put new blocks near the inode, until the file has some */
+	sv->sv_goal = ino + 1;
+	sv->sv_npre = 0;
+	sv->sv_pre = 0;
+
+	/* No reads yet */
+	sv->sv_raoff = 0;
+	sv->sv_rawin = 0;
+	sv->sv_raend = 0;
+
+	/* No directory index until it's searched */
+	sv->sv_dirindex = NULL;
+
+	/* In use */
+	sv->sv_cached = 0;
+	sv->sv_hashnext = NULL;
+	sv->sv_lrunext = NULL;
+	sv->sv_lruprev = NULL;
+
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
 	 * block on disk will have been zeroed out and thus the type
@@ -1631,6 +2699,7 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
 		kfree(sv);
+		lock_release(sfs->sfs_vnlock);
 		return result;
 	}
 
@@ -1638,12 +2707,8 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = array_add(sfs->sfs_vnodes, sv);
-	if (result) {
-		VOP_KILL(&sv->sv_v);
-		kfree(sv);
-		return result;
-	}
+	vn_hashins(sfs, sv);
+	lock_release(sfs->sfs_vnlock);
 
 	/* Hand it back */
 	*ret = sv;
@@ -0,0 +1,336 @@
+/*
+ * VFS pathname lookup cache.
+ *
+ * Remembers the results of looking up single pathname components:
+ * (directory vnode, name) -> vnode, or "no such file" (a negative
+ * entry, with nc_vn NULL). vfs_lookup and vfs_lookparent walk paths a
+ * component at a time through here, so a path that has been looked up
+ * before is translated without calling into the filesystem at all.
+ *
+ * Entries hold references to both vnodes. The pathname operations in
+ * vfspath.c drop the entry for any name they change, and vfs_unmount
+ * drops all of a filesystem's entries before unmounting it. "." and
+ * ".." are never cached.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#define NC_HASH   61	/* number of hash chains */
+#define NC_MAX    256	/* most entries kept */
+
+struct ncentry {
+	struct vnode *nc_dir;		/* directory */
+	char *nc_name;			/* name in it */
+	struct vnode *nc_vn;		/* what it names, or NULL */
+	struct ncentry *nc_hashnext;	/* hash chain */
+	struct ncentry *nc_lrunext;	/* next more recently used */
+	struct ncentry *nc_lruprev;	/* next less recently used */
+};
+
+static struct ncentry *nc_hash[NC_HASH];
+static struct ncentry *nc_lru, *nc_mru;
+static unsigned nc_count;
+
+/*
+ * Bumped whenever an entry is dropped. A lookup that goes to the
+ * filesystem only caches the answer if this hasn't changed meanwhile,
+ * so it can't put back something that was just invalidated.
+ */
+static unsigned nc_gen;
+
+static struct lock *nc_lock;
+
+/*
+ * Setup function
+ */
+void
+vfs_initnamecache(void)
+{
+	nc_lock = lock_create("namecache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+}
+
+static
+unsigned
+nc_hashfunc(struct vnode *dir, const char *name)
+{
+	unsigned h = (u_int32_t)dir >> 4;
+
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h % NC_HASH;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Lists (all called with nc_lock held)
+
+static
+void
+nc_lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lru = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_mru = nc->nc_lruprev;
+	}
+}
+
+static
+void
+nc_lru_append(struct ncentry *nc)
+{
+	nc->nc_lrunext = NULL;
+	nc->nc_lruprev = nc_mru;
+	if (nc_mru != NULL) {
+		nc_mru->nc_lrunext = nc;
+	}
+	else {
+		nc_lru = nc;
+	}
+	nc_mru = nc;
+}
+
+static
+struct ncentry **
+nc_find(struct vnode *dir, const char *name)
+{
+	struct ncentry **pp;
+
+	for (pp = &nc_hash[nc_hashfunc(dir, name)]; *pp != NULL;
+	     pp = &(*pp)->nc_hashnext) {
+		if ((*pp)->nc_dir == dir && !strcmp((*pp)->nc_name, name)) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take the entry *PP out of the cache and put it on the list *DEAD,
+ * to be freed (by nc_free) once nc_lock has been released, since
+ * dropping vnode references can mean disk I/O.
+ */
+static
+void
+nc_unlink(struct ncentry **pp, struct ncentry **dead)
+{
+	struct ncentry *nc = *pp;
+
+	*pp = nc->nc_hashnext;
+	nc_lru_remove(nc);
+	nc_count--;
+	nc_gen++;
+
+	nc->nc_hashnext = *dead;
+	*dead = nc;
+}
+
+/*
+ * Free entries taken out by nc_unlink.
+ */
+static
+void
+nc_free(struct ncentry *dead)
+{
+	struct ncentry *nc;
+
+	while (dead != NULL) {
+		nc = dead;
+		dead = nc->nc_hashnext;
+
+		if (nc->nc_vn != NULL) {
+			VOP_DECREF(nc->nc_vn);
+		}
+		VOP_DECREF(nc->nc_dir);
+		kfree(nc->nc_name);
+		kfree(nc);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+/*
+ * Remember that NAME in DIR is VN (or doesn't exist, if VN is NULL),
+ * unless the cache has changed since GEN.
+ */
+static
+void
+nc_enter(struct vnode *dir, const char *name, struct vnode *vn,
+	 unsigned gen)
+{
+	struct ncentry *nc, *dead = NULL;
+
+	nc = kmalloc(sizeof(struct ncentry));
+	if (nc == NULL) {
+		return;
+	}
+	nc->nc_name = kstrdup(name);
+	if (nc->nc_name == NULL) {
+		kfree(nc);
+		return;
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+
+	lock_acquire(nc_lock);
+	if (gen != nc_gen || nc_find(dir, name) != NULL) {
+		lock_release(nc_lock);
+		kfree(nc->nc_name);
+		kfree(nc);
+		return;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+
+	if (nc_count >= NC_MAX) {
+		nc_unlink(nc_find(nc_lru->nc_dir, nc_lru->nc_name), &dead);
+	}
+
+	nc->nc_hashnext = nc_hash[nc_hashfunc(dir, name)];
+	nc_hash[nc_hashfunc(dir, name)] = nc;
+	nc_lru_append(nc);
+	nc_count++;
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
+
+/*
+ * Look up the single pathname component NAME in DIR, going to the
+ * filesystem (VOP_LOOKUP) only if the answer isn't cached. Hands back
+ * a new reference, like VOP_LOOKUP.
+ */
+int
+vfs_lookone(struct vnode *dir, char *name, struct vnode **ret)
+{
+	struct ncentry **pp;
+	struct vnode *vn;
+	unsigned gen;
+	int result;
+
+	if (strlen(name) > NAME_MAX) {
+		return ENAMETOOLONG;
+	}
+	if (!strcmp(name, ".") || !strcmp(name, "..")) {
+		return VOP_LOOKUP(dir, name, ret);
+	}
+
+	lock_acquire(nc_lock);
+	pp = nc_find(dir, name);
+	if (pp != NULL) {
+		nc_lru_remove(*pp);
+		nc_lru_append(*pp);
+		vn = (*pp)->nc_vn;
+		if (vn != NULL) {
+			VOP_INCREF(vn);
+		}
+		lock_release(nc_lock);
+
+		if (vn == NULL) {
+			return ENOENT;
+		}
+		*ret = vn;
+		return 0;
+	}
+	gen = nc_gen;
+	lock_release(nc_lock);
+
+	result = VOP_LOOKUP(dir, name, &vn);
+	if (result == 0) {
+		nc_enter(dir, name, vn, gen);
+		*ret = vn;
+	}
+	else if (result == ENOENT) {
+		nc_enter(dir, name, NULL, gen);
+	}
+	return result;
+}
+
+/*
+ * Forget NAME in DIR, because it's being created, removed or renamed.
+ * If it named a directory, entries for names in that directory are
+ * dropped too, so they don't keep it in memory after it's gone.
+ */
+void
+vfs_ncforget(struct vnode *dir, const char *name)
+{
+	struct ncentry **pp, *dead = NULL;
+	struct vnode *vn;
+	int i;
+
+	lock_acquire(nc_lock);
+	pp = nc_find(dir, name);
+	if (pp == NULL) {
+		/* Make sure a lookup in progress doesn't cache it, either */
+		nc_gen++;
+		lock_release(nc_lock);
+		return;
+	}
+	vn = (*pp)->nc_vn;
+	nc_unlink(pp, &dead);
+
+	if (vn != NULL) {
+		for (i=0; i<NC_HASH; i++) {
+			pp = &nc_hash[i];
+			while (*pp != NULL) {
+				if ((*pp)->nc_dir == vn) {
+					nc_unlink(pp, &dead);
+				}
+				else {
+					pp = &(*pp)->nc_hashnext;
+				}
+			}
+		}
+	}
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
+
+/*
+ * Forget everything in filesystem FS, before unmounting it.
+ */
+void
+vfs_ncpurge(struct fs *fs)
+{
+	struct ncentry **pp, *dead = NULL;
+	int i;
+
+	lock_acquire(nc_lock);
+	for (i=0; i<NC_HASH; i++) {
+		pp = &nc_hash[i];
+		while (*pp != NULL) {
+			if ((*pp)->nc_dir->vn_fs == fs) {
+				nc_unlink(pp, &dead);
+			}
+			else {
+				pp = &(*pp)->nc_hashnext;
+			}
+		}
+	}
+	lock_release(nc_lock);
+
+	nc_free(dead);
+}
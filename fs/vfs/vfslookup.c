@@ -12,12 +12,13 @@
 #include <fs.h>
 
 static struct vnode *bootfs_vnode = NULL;
-static struct lock *bootfs_lock = NULL;
+/* Every absolute path lookup reads bootfs_vnode; only vfs_setbootfs writes it. */
+static struct rwlock *bootfs_lock = NULL;
 
 void
 vfs_initbootfs(void)
 {
-	bootfs_lock = lock_create("bootfs_lock");
+	bootfs_lock = rwlock_create("bootfs_lock");
 	if (bootfs_lock == NULL) {
 		panic("vfs: Could not create bootfs lock\n");
 	}
@@ -32,10 +33,10 @@ change_bootfs(struct vnode *newguy)
 {
 	struct vnode *oldguy;
 
-	lock_acquire(bootfs_lock);
+	rwlock_acquire_write(bootfs_lock);
 	oldguy = bootfs_vnode;
 	bootfs_vnode = newguy;
-	lock_release(bootfs_lock);
+	rwlock_release_write(bootfs_lock);
 
 	/* Do this without holding the lock so as to avoid deadlock */
 	if (oldguy != NULL) {
@@ -162,14 +163,14 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	assert(colon==0 || slash==0);
 
 	if (path[0]=='/') {
-		lock_acquire(bootfs_lock);
+		rwlock_acquire_read(bootfs_lock);
 		if (bootfs_vnode==NULL) {
-			lock_release(bootfs_lock);
+			rwlock_release_read(bootfs_lock);
 			return ENOENT;
 		}
 		VOP_INCREF(bootfs_vnode);
 		*startvn = bootfs_vnode;
-		lock_release(bootfs_lock);
+		rwlock_release_read(bootfs_lock);
 	}
 	else {
 		assert(path[0]==':');
@@ -200,9 +201,73 @@ getdevice(char *path, char **subpath, struct vnode **startvn)
 	return 0;
 }
 
+/*
+ * Walk PATH from directory DIR a component at a time, through the
+ * name cache (vfs_lookone). Consumes the reference to DIR.
+ *
+ * If BUF is NULL, hand back the vnode PATH names. Otherwise stop at
+ * the last component: copy it into BUF and hand back the directory
+ * it's in, as for lookparent. PATH must not be empty.
+ */
+static
+int
+walkpath(struct vnode *dir, char *path, struct vnode **retval,
+	 char *buf, size_t buflen)
+{
+	struct vnode *vn;
+	char *next;
+	int result;
+
+	while (1) {
+		while (*path=='/') {
+			path++;
+		}
+
+		/* Split off this component; NEXT is NULL if it's the last */
+		next = strchr(path, '/');
+		if (next != NULL) {
+			*next++ = 0;
+			while (*next=='/') {
+				next++;
+			}
+			if (*next==0) {
+				/* trailing slash */
+				next = NULL;
+			}
+		}
+
+		if (next == NULL && buf != NULL) {
+			if (strlen(path)+1 > buflen) {
+				VOP_DECREF(dir);
+				return ENAMETOOLONG;
+			}
+			strcpy(buf, path);
+			*retval = dir;
+			return 0;
+		}
+
+		result = vfs_lookone(dir, path, &vn);
+		VOP_DECREF(dir);
+		if (result) {
+			return result;
+		}
+
+		if (next == NULL) {
+			*retval = vn;
+			return 0;
+		}
+		dir = vn;
+		path = next;
+	}
+}
+
 /*
  * Name-to-vnode translation.
  * (In BSD, both of these are subsumed by namei().)
+ *
+ * Paths are translated here a component at a time, using
+ * VOP_LOOKUP on one name at a time, so that each step can be
+ * answered from the name cache (vfscache.c).
  */
 
 int
@@ -223,14 +288,11 @@ vfs_lookparent(char *path, struct vnode **retval,
 		 * a context where "lookparent" is the desired
 		 * operation.
 		 */
-		result = EINVAL;
-	}
-	else {
-		result = VOP_LOOKPARENT(startvn, path, retval, buf, buflen);
+		VOP_DECREF(startvn);
+		return EINVAL;
 	}
 
-	VOP_DECREF(startvn);
-	return result;
+	return walkpath(startvn, path, retval, buf, buflen);
 }
 
 int
@@ -249,8 +311,5 @@ vfs_lookup(char *path, struct vnode **retval)
 		return 0;
 	}
 
-	result = VOP_LOOKUP(startvn, path, retval);
-
-	VOP_DECREF(startvn);
-	return result;
+	return walkpath(startvn, path, retval, NULL, 0);
 }
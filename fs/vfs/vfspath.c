@@ -9,6 +9,8 @@
 #include <vfs.h>
 #include <vnode.h>
 #include <lib.h>
+#include <addrspace.h>
+#include "opt-A3.h"
 
 
 /* Does most of the work for open(). */
@@ -45,6 +47,10 @@ vfs_open(char *path, int openflags, struct vnode **ret)
 		}
 
 		result = VOP_CREAT(dir, name, excl, &vn);
+		if (result == 0) {
+			/* It may have been cached as not existing */
+			vfs_ncforget(dir, name);
+		}
 
 		VOP_DECREF(dir);
 	}
@@ -112,6 +118,9 @@ int
 vfs_remove(char *path)
 {
 	struct vnode *dir;
+#if OPT_A3
+	struct vnode *vn;
+#endif
 	char name[NAME_MAX+1];
 	int result;
 	
@@ -120,7 +129,19 @@ vfs_remove(char *path)
 		return result;
 	}
 
+#if OPT_A3
+	/*
+	 * Cached executable headers hold a reference, which would keep
+	 * the file from being erased.
+	 */
+	if (vfs_lookone(dir, name, &vn) == 0) {
+		elf_cache_invalidate(vn);
+		VOP_DECREF(vn);
+	}
+#endif
+
 	result = VOP_REMOVE(dir, name);
+	vfs_ncforget(dir, name);
 	VOP_DECREF(dir);
 
 	return result;
@@ -154,6 +175,8 @@ vfs_rename(char *oldpath, char *newpath)
 	}
 
 	result = VOP_RENAME(olddir, oldname, newdir, newname);
+	vfs_ncforget(olddir, oldname);
+	vfs_ncforget(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(olddir);
@@ -188,6 +211,7 @@ vfs_link(char *oldpath, char *newpath)
 	}
 
 	result = VOP_LINK(newdir, newname, oldfile);
+	vfs_ncforget(newdir, newname);
 
 	VOP_DECREF(newdir);
 	VOP_DECREF(oldfile);
@@ -215,6 +239,7 @@ vfs_symlink(const char *contents, char *path)
 	}
 
 	result = VOP_SYMLINK(newdir, newname, contents);
+	vfs_ncforget(newdir, newname);
 	VOP_DECREF(newdir);
 
 	return result;
@@ -261,6 +286,7 @@ vfs_mkdir(char *path)
 	}
 
 	result = VOP_MKDIR(parent, name);
+	vfs_ncforget(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -283,6 +309,7 @@ vfs_rmdir(char *path)
 	}
 
 	result = VOP_RMDIR(parent, name);
+	vfs_ncforget(parent, name);
 
 	VOP_DECREF(parent);
 
@@ -0,0 +1,375 @@
+/*
+ * Vnode operations for pipes. See pipe.h.
+ *
+ * The buffer is indexed by free-running byte counts: p_head counts bytes
+ * ever written and p_tail bytes ever read, so head - tail is the amount
+ * buffered (unsigned arithmetic takes care of wraparound) and a count
+ * masked with PIPE_SIZE-1 is its position in the ring.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <pipe.h>
+
+#define PIPE_MASK  (PIPE_SIZE-1)
+
+struct pipe {
+	char *p_buf;			/* ring buffer, PIPE_SIZE bytes */
+	unsigned p_head;		/* bytes ever written */
+	unsigned p_tail;		/* bytes ever read */
+	int p_readopen;			/* read end not yet closed */
+	int p_writeopen;		/* write end not yet closed */
+	int p_ends;			/* ends not yet reclaimed */
+	struct lock *p_lock;		/* protects all of the above */
+	struct cv *p_readcv;		/* readers wait here for data */
+	struct cv *p_writecv;		/* writers wait here for room */
+	struct vnode p_readvn;
+	struct vnode p_writevn;
+};
+
+/*
+ * Free a pipe once neither end is in use (or was ever set up).
+ */
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+/*
+ * Called for each open(). Pipes can't be opened by name, so this only
+ * happens through vfs_open on a vnode we handed out, which we don't do.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return EINVAL;
+}
+
+/*
+ * Called on the last close() of an end. Wake up whoever is waiting on
+ * the other end, so readers see end-of-file and writers get EPIPE.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		p->p_readopen = 0;
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+	else {
+		p->p_writeopen = 0;
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	lock_release(p->p_lock);
+	return 0;
+}
+
+/*
+ * Called when an end's refcount reaches zero. The pipe itself goes
+ * when both ends have.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	int last;
+
+	lock_acquire(p->p_lock);
+	VOP_KILL(v);
+	p->p_ends--;
+	last = (p->p_ends == 0);
+	lock_release(p->p_lock);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Called for read. Wait for data (or for the write end to close), then
+ * copy out as much as there is, in at most two pieces if it wraps.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t idx, len;
+	int result = 0;
+
+	assert(uio->uio_rw == UIO_READ);
+	if (v != &p->p_readvn) {
+		return EBADF;
+	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(p->p_lock);
+	while (p->p_head == p->p_tail && p->p_writeopen) {
+		cv_wait(p->p_readcv, p->p_lock);
+	}
+
+	while (uio->uio_resid > 0 && p->p_head != p->p_tail) {
+		idx = p->p_tail & PIPE_MASK;
+		len = p->p_head - p->p_tail;
+		if (len > PIPE_SIZE - idx) {
+			len = PIPE_SIZE - idx;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + idx, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_tail += len;
+	}
+
+	cv_broadcast(p->p_writecv, p->p_lock);
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Called for write. Copy in as room allows, waking readers as data
+ * arrives. A write of at most PIPE_BUF bytes waits until it fits
+ * entirely and then goes in without letting go of the lock.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t idx, len, room, need;
+	size_t start = uio->uio_resid;
+	int atomic = (uio->uio_resid <= PIPE_BUF);
+	int result = 0;
+
+	assert(uio->uio_rw == UIO_WRITE);
+	if (v != &p->p_writevn) {
+		return EBADF;
+	}
+
+	lock_acquire(p->p_lock);
+	while (uio->uio_resid > 0) {
+		if (!p->p_readopen) {
+			/* Report what got through, if anything did. */
+			if (uio->uio_resid == start) {
+				result = EPIPE;
+			}
+			break;
+		}
+
+		room = PIPE_SIZE - (p->p_head - p->p_tail);
+		need = atomic ? uio->uio_resid : 1;
+		if (room < need) {
+			cv_wait(p->p_writecv, p->p_lock);
+			continue;
+		}
+
+		idx = p->p_head & PIPE_MASK;
+		len = room;
+		if (len > PIPE_SIZE - idx) {
+			len = PIPE_SIZE - idx;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + idx, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_head += len;
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * Called for stat(). The size is the amount of data buffered.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO;
+	statbuf->st_nlink = 1;
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = p->p_head - p->p_tail;
+	lock_release(p->p_lock);
+
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, u_int32_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+/*
+ * Called for fsync(). Nothing to flush.
+ */
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+static
+int
+pipe_notdir(void)
+{
+	return ENOTDIR;
+}
+
+static
+int
+pipe_inval(void)
+{
+	return EINVAL;
+}
+
+static
+int
+pipe_spipe(void)
+{
+	return ESPIPE;
+}
+
+/*
+ * Casting through void * prevents warnings.
+ * All of the vnode ops return int, and it's ok to cast functions that
+ * take args to functions that take no args.
+ */
+
+#define NOTDIR ((void *)pipe_notdir)
+#define INVAL ((void *)pipe_inval)
+#define SPIPE ((void *)pipe_spipe)
+
+/*
+ * Function table for both ends of a pipe.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,	/* mark this a valid vnode ops table */
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+
+	pipe_read,
+	INVAL,   /* readlink */
+	NOTDIR,  /* getdirentry */
+	pipe_write,
+	INVAL,   /* ioctl */
+	pipe_stat,
+	pipe_gettype,
+	SPIPE,   /* tryseek */
+	pipe_fsync,
+	INVAL,   /* mmap */
+	INVAL,   /* truncate */
+	NOTDIR,  /* namefile */
+
+	NOTDIR,  /* creat */
+	NOTDIR,  /* symlink */
+	NOTDIR,  /* mkdir */
+	NOTDIR,  /* link */
+	NOTDIR,  /* remove */
+	NOTDIR,  /* rmdir */
+	NOTDIR,  /* rename */
+
+	NOTDIR,  /* lookup */
+	NOTDIR,  /* lookparent */
+};
+
+/*
+ * Create a pipe and hand back its two ends. See pipe.h.
+ */
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *p;
+	int result;
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	p->p_lock = lock_create("pipe");
+	p->p_readcv = cv_create("pipe-read");
+	p->p_writecv = cv_create("pipe-write");
+	if (p->p_buf == NULL || p->p_lock == NULL ||
+	    p->p_readcv == NULL || p->p_writecv == NULL) {
+		goto fail;
+	}
+
+	p->p_head = p->p_tail = 0;
+	p->p_readopen = p->p_writeopen = 1;
+	p->p_ends = 2;
+
+	result = VOP_INIT(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		goto fail;
+	}
+	result = VOP_INIT(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		VOP_KILL(&p->p_readvn);
+		goto fail;
+	}
+
+	/* What vfs_open would have done, so vfs_close undoes it. */
+	VOP_INCOPEN(&p->p_readvn);
+	VOP_INCOPEN(&p->p_writevn);
+
+	*readend = &p->p_readvn;
+	*writeend = &p->p_writevn;
+	return 0;
+
+ fail:
+	if (p->p_writecv != NULL) {
+		cv_destroy(p->p_writecv);
+	}
+	if (p->p_readcv != NULL) {
+		cv_destroy(p->p_readcv);
+	}
+	if (p->p_lock != NULL) {
+		lock_destroy(p->p_lock);
+	}
+	if (p->p_buf != NULL) {
+		kfree(p->p_buf);
+	}
+	kfree(p);
+	return ENOMEM;
+}
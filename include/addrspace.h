@@ -7,11 +7,14 @@
 #include "opt-A3.h"
 
 struct vnode;
+struct fs;
+struct rwlock;
 
 #if OPT_A3
 #include <segments.h>
 #include <pt.h>
 #define AS_NUM_SEG 3
+#define AS_NUM_MAP 8 /* mmap regions per address space */
 #endif /* OPT_A3 */
 
 /* 
@@ -34,8 +37,10 @@ struct addrspace {
 	/* Put stuff here for your VM system */
 #if OPT_A3
 	struct segment segments[AS_NUM_SEG];
+	struct segment mappings[AS_NUM_MAP]; /* mmap regions, placed below the stack */
 	struct vnode *file;
 	int num_segments;
+	struct rwlock *as_lock; /* segment table: lookups read, (re)defining writes */
 #endif /* OPT_A3 */
 #endif /* DUMBVM */
 };
@@ -76,6 +81,19 @@ struct addrspace {
  *    as_valid_read_addr - Check an address for valid user reads
  *
  *    as_valid_write_addr - Check an address for valid user writes
+ *
+ *    as_valid_range - Check that a whole user buffer is mapped
+ *
+ *    as_map    - add an mmap region: of file VN from OFFSET if VN is not
+ *                NULL, otherwise anonymous (zero-filled). The kernel picks
+ *                the address and hands it back. Shared regions write
+ *                modified pages back to the file.
+ *
+ *    as_unmap  - remove an mmap region, writing it back first. The range
+ *                must be exactly one region.
+ *
+ *    as_sync   - write back the modified pages of shared mmap regions in
+ *                a range.
  */
 
 #if OPT_A3
@@ -91,16 +109,26 @@ int as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 struct segment * as_get_segment(struct addrspace * as, vaddr_t v);
 int as_valid_read_addr(struct addrspace *as, vaddr_t *check_addr);
 int as_valid_write_addr(struct addrspace *as, vaddr_t *check_addr);
+int as_valid_range(struct addrspace *as, vaddr_t start, size_t len);
+int as_map(struct addrspace *as, struct vnode *vn, off_t offset, size_t len, int writeable, int shared, vaddr_t *ret);
+int as_unmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int as_sync(struct addrspace *as, vaddr_t vaddr, size_t len);
 
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
  *               address space. Returns the entry point (initial PC)
  *               in the space pointed to by ENTRYPOINT.
+ *    elf_cache_invalidate - drop any cached headers for a file; call
+ *               before changing its contents.
+ *    elf_cache_purge - drop the cached headers of every file in a
+ *               filesystem; call before unmounting it.
  */
 
 int load_elf(char* progname, vaddr_t *entrypoint);
 int load_segment_page(struct vnode *v, vaddr_t vaddr, struct segment *s, paddr_t paddr);
+void elf_cache_invalidate(struct vnode *v);
+void elf_cache_purge(struct fs *fs);
 paddr_t getppages(unsigned long npages);
 
 #else
@@ -115,6 +143,7 @@ int as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 #if OPT_A2
 int as_valid_read_addr(struct addrspace *as, vaddr_t *check_addr);
 int as_valid_write_addr(struct addrspace *as, vaddr_t *check_addr);
+int as_valid_range(struct addrspace *as, vaddr_t start, size_t len);
 #endif /* OPT_A2 */
 
 /*
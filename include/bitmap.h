@@ -9,6 +9,9 @@
  *                      Returns NULL on error.
  *     bitmap_getdata - return pointer to raw bit data (for I/O).
  *     bitmap_alloc   - locate a cleared bit, set it, and return its index.
+ *     bitmap_alloc_range - locate N cleared bits in a row, searching from
+ *                      a given index on (and then from the start), set
+ *                      them, and return the index of the first.
  *     bitmap_mark    - set a clear bit by its index.
  *     bitmap_unmark  - clear a set bit by its index.
  *     bitmap_isset   - return whether a particular bit is set or not.
@@ -20,6 +23,8 @@ struct bitmap;  /* Opaque. */
 struct bitmap *bitmap_create(u_int32_t nbits);
 void          *bitmap_getdata(struct bitmap *);
 int            bitmap_alloc(struct bitmap *, u_int32_t *index);
+int            bitmap_alloc_range(struct bitmap *, u_int32_t start,
+				  u_int32_t n, u_int32_t *index);
 void           bitmap_mark(struct bitmap *, u_int32_t index);
 void           bitmap_unmark(struct bitmap *, u_int32_t index);
 int	       bitmap_isset(struct bitmap *, u_int32_t index);
@@ -1,6 +1,7 @@
 #include "opt-A3.h"
 #if OPT_A3
 #include <types.h>
+#include <spinlock.h>
 
 #ifndef __COREMAP_H__
 #define __COREMAP_H__
@@ -25,6 +26,7 @@ struct cm {
         struct cm_detail *core_details;
         struct cm_detail *free_frame_list;
         struct cm_detail *last_free;
+        struct spinlock lock; //protects everything above; never held across swap I/O
 };
 
 //Called to set up the core map
@@ -36,14 +38,20 @@ int cm_getppage();
 //call to release a physical frame back into memory on program exit
 void cm_release_frame(int frame_number);
 
-//called by push to swap to get a frame ready for memory copy
-void cm_free_core(struct cm_detail *cd, int spl);
+//called by push to swap to get a frame ready for memory copy; releases core_map.lock
+void cm_free_core(struct cm_detail *cd);
 
 //called after we have copied memory to our frame, tlb add should be called before
 void cm_finish_paging(int frame, struct page_detail* pd);
 
 int cm_push_to_swap();
 
+//keep a resident page from being evicted (while it is written back); returns its frame, or -1 if it isn't resident
+int cm_pin_page(struct page_detail *pd);
+
+//let a page pinned by cm_pin_page be evicted again
+void cm_unpin_page(int frame);
+
 vaddr_t cm_request_kframes(int num);
 
 void cm_release_kframes(int frame_number);
@@ -0,0 +1,49 @@
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <spinlock.h>
+
+/*
+ * Per-CPU data.
+ *
+ * Anything that belongs to a processor rather than to the whole
+ * machine lives in its struct cpu instead of in a global: the run
+ * queue and the spinlock bookkeeping. curcpu points at the struct cpu
+ * of the processor we are running on.
+ *
+ * System/161 as this kernel drives it has a single processor, so
+ * there is exactly one struct cpu and curcpu never changes. Bringing
+ * up more processors means filling in more entries of allcpus and
+ * making curcpu read the right one.
+ */
+
+#define MAXCPUS 1
+
+struct thread;
+
+struct cpu {
+	unsigned c_number;		/* index into allcpus */
+
+	/* Spinlocks held; interrupts stay off while this is nonzero. */
+	int c_spinlocks;
+	int c_spinlock_spl;		/* spl to return to on the last release */
+
+	/* Run queue, linked through t_runnext. */
+	struct spinlock c_runqueue_lock;
+	struct thread *c_runqueue_head;
+	struct thread *c_runqueue_tail;
+	int c_runqueue_count;
+
+	/* Migration statistics, updated by the scheduler. */
+	unsigned c_stolen_in;		/* threads this CPU took from others */
+	unsigned c_stolen_out;		/* threads other CPUs took from us */
+};
+
+extern struct cpu allcpus[MAXCPUS];
+extern unsigned ncpus;
+extern struct cpu *curcpu;
+
+/* Call once, first thing during startup. */
+void cpu_bootstrap(void);
+
+#endif /* _CPU_H_ */
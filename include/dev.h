@@ -3,15 +3,40 @@
 
 struct uio;  /* in <uio.h> */
 
+/*
+ * Asynchronous block I/O request, for devices with d_strategy.
+ *
+ * The caller fills in br_uio (which must be UIO_SYSSPACE, since it is
+ * serviced from interrupt handlers), br_done and br_data. When the
+ * transfer is over, the device sets br_result and calls br_done, at
+ * interrupt level: br_done must not sleep. The request and the uio
+ * belong to the device until then.
+ */
+struct bioreq {
+	struct uio *br_uio;		/* What to transfer, and where */
+	void (*br_done)(struct bioreq *);	/* Completion callback */
+	void *br_data;			/* For the caller's use */
+	int br_result;			/* Error code, set on completion */
+
+	/* Private to the device */
+	u_int32_t br_block;		/* First block */
+	u_int32_t br_nblocks;		/* Number of blocks */
+	u_int32_t br_deadline;		/* When it must be started by */
+	struct bioreq *br_next;		/* Request queue */
+};
+
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates which should be done.
+ * d_strategy, if not NULL, queues a bioreq and returns without waiting;
+ * it fails at once (and br_done is not called) if the request is bad.
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
+	int (*d_strategy)(struct device *, struct bioreq *);
 
 	u_int32_t d_blocks;
 	u_int32_t d_blocksize;
@@ -3,47 +3,91 @@
 #ifndef _FILETABLE_H_
 #define _FILETABLE_H_
 
+#include <kern/limits.h>
+#include <spinlock.h>
+
 /*
  * Filetables
  * Filetables belongs to threads, and is responsible for the file descriptors (fd)
  * that are availiable to each of the threads.
- * Initially each thread have three fds, stdin, stdout, and stderr.
+ * The table has a fixed capacity of OPEN_MAX fds. User programs get stdin,
+ * stdout, and stderr when they start; forked processes inherit their parent's.
  * Filetables is required for operations that read, write operations,
  * such as write to terminal, write to file, open file, etc.
  *
  * Functions:
  *     ft_create  - allocate a new filetable object. Returns NULL if out of memory.
- *     ft_array_size    - returns the size of the filetable.
+ *     ft_attachstds - open the console as fds 0, 1 and 2. Returns an error code.
+ *     ft_array_size    - returns the capacity of the filetable.
+ *     ft_size    - returns the number of open fds.
  *     ft_get     - returns the fti th filedescriptor from the filetable.
- *     ft_add     - add a filedescriptor to the filetable.
+ *     ft_set     - put a filedescriptor at a given, free fd.
+ *     ft_add     - add a filedescriptor to the filetable at the lowest free fd.
+ *     ft_copy    - give an empty filetable the same fds as another (for fork).
  *     ft_remove  - remove the fti th filedescriptor from the filetable.
  *     ft_destroy - destroy the filetable.
  *     ft_test    - tests the implementation of the filetable, will crash the kernel.
  */
 
+/*
+ * Open files
+ * A filedescriptor is an open file: the vnode plus the mode and offset it
+ * was opened with. It is shared by every fd that refers to it, in this
+ * process or others (after fork or dup2), and freed when the last one closes.
+ *
+ * Functions:
+ *     fd_create  - allocate an open file for a vnode, with no owners yet.
+ *                  Returns NULL if out of memory.
+ *     fd_incref  - add an owner.
+ *     fd_decref  - drop an owner; closes the vnode when the last one goes.
+ *     fd_rw      - do the read or write a uio describes, as one VOP_READ or
+ *                  VOP_WRITE; either at the seek position, advancing it, or
+ *                  at the uio's own offset. Returns an error code.
+ *     fd_destroy - free an open file that never got an owner, closing its
+ *                  vnode.
+ */
+
+struct uio;
+
 // Structure of the filedescriptor
 struct filedescriptor;
 
 struct filedescriptor {
-	//The file descriptor number
+	//The file descriptor number it was first opened as
 	int fdn;
 	//The mode of the file descriptor in question
 	int mode;
-	//Number of owners of the file descriptor
+	//Number of fds (in all file tables) referring to this open file
 	int numOwners;
+	//Protects numOwners; never held across I/O, so closing a file
+	//doesn't wait for a read that may block forever (pipe, console)
+	struct spinlock reflock;
 	//The offset
 	int offset;
+	//Whether the vnode has a seek position at all (not a pipe or the console)
+	int seekable;
 	//The vnode
 	struct vnode* fdvnode;
+	//Protects offset. For seekable files it is held across each read or
+	//write so that processes sharing the file see each others' offset updates
+	struct lock *fdlock;
 };
 
+struct filedescriptor *fd_create(struct vnode *vn, int mode, int offset);
+void fd_incref(struct filedescriptor *fd);
+void fd_decref(struct filedescriptor *fd);
+void fd_destroy(struct filedescriptor *fd);
+int fd_rw(struct filedescriptor *fd, struct uio *u, int seek, int *retval);
+
 // Structure of the filetable
 struct filetable;
 
 struct filetable {
-	//The table of file descriptors
-	struct array *filedescriptor;
-	//The size of the filetable
+	//The table of file descriptors, indexed by fd
+	struct filedescriptor *filedescriptor[OPEN_MAX];
+	//Which fds are in use
+	struct bitmap *fdmap;
+	//The number of open fds
 	int size;
 };
 
@@ -54,6 +98,7 @@ int ft_size(struct filetable *ft);
 struct filedescriptor *ft_get(struct filetable *ft, int fti);
 int ft_set(struct filetable* ft, struct filedescriptor* fdn, int fti);
 int ft_add(struct filetable* ft, struct filedescriptor* fdn);
+void ft_copy(struct filetable* src, struct filetable* dst);
 int ft_remove(struct filetable* ft, int fti);
 int ft_destroy(struct filetable* ft);
 void ft_test_list(struct filetable* ft);
@@ -40,6 +40,14 @@
 #define SYS___getcwd     29
 #define SYS_stat         30
 #define SYS_lstat        31
+#define SYS_readv        32
+#define SYS_writev       33
+#define SYS_pread        34
+#define SYS_pwrite       35
+#define SYS_mmap         36
+#define SYS_munmap       37
+#define SYS_msync        38
+#define SYS_spawn        39
 /*CALLEND*/
 
 
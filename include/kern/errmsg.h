@@ -41,6 +41,8 @@ const char *const sys_errlist[] = {
 	"Bad file number",            /* EBADF */
 	#ifdef OPT_A2
 	"Invalid process ID",         /* ESRCH */
+	"No child processes",         /* ECHILD */
+	"Broken pipe",                /* EPIPE */
 	#endif
 };
 
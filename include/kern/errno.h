@@ -40,6 +40,8 @@
 #define EBADF        26     /* Bad file number */
 #ifdef OPT_A2
 #define ESRCH        27     /* Invalid Process ID */
+#define ECHILD       28     /* No child processes */
+#define EPIPE        29     /* Broken pipe */
 #endif
 
 #endif /* _KERN_ERRNO_H_ */
@@ -7,8 +7,17 @@
 /* Longest full path name */
 #define PATH_MAX   1024
 
+/* Max bytes of arguments to execv, including the argv pointers */
+#define ARG_MAX    4096
+
 /* Max number of opened files per process */
-#define OPEN_MAX       1024
+#define OPEN_MAX       128
+
+/* Max number of iovecs in one readv or writev */
+#define IOV_MAX        16
+
+/* Largest write to a pipe that is guaranteed not to be interleaved */
+#define PIPE_BUF       4096
 
 
 #endif /* _KERN_LIMITS_H_ */
@@ -11,6 +11,7 @@
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
 #define SFS_MAP_LOCATION   2            /* 1st block of the freemap */
 #define SFS_NOINO          0            /* inode # for free dir entry */
+#define SFS_JMAGIC        0x6a6f726e    /* magic number for journal header */
 
 /* Number of bits in a block */
 #define SFS_BLOCKBITS (SFS_BLOCKSIZE * CHAR_BIT)
@@ -36,7 +37,23 @@ struct sfs_super {
 	u_int32_t sp_magic;       /* Magic number, should be SFS_MAGIC */
 	u_int32_t sp_nblocks;     /* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];  /* Name of this volume */
-	u_int32_t reserved[118];
+	u_int32_t sp_jstart;      /* First block of journal, if any */
+	u_int32_t sp_jblocks;     /* Size of journal in blocks, or 0 */
+	u_int32_t reserved[116];
+};
+
+/*
+ * On-disk journal header, in the first block of the journal. If
+ * sjh_nblocks is not 0, the sjh_nblocks blocks after the header hold
+ * new contents for blocks sjh_blocks[0..sjh_nblocks-1], which may not
+ * all have been written to those blocks yet.
+ */
+#define SFS_JMAXLOG 125
+struct sfs_jheader {
+	u_int32_t sjh_magic;      /* Magic number, should be SFS_JMAGIC */
+	u_int32_t sjh_seq;        /* Number of this commit */
+	u_int32_t sjh_nblocks;    /* Blocks logged, or 0 if none */
+	u_int32_t sjh_blocks[SFS_JMAXLOG];  /* Where they belong */
 };
 
 /*
@@ -48,7 +65,9 @@ struct sfs_inode {
 	u_int16_t sfi_linkcount;   /* Number of hard links to this file */
 	u_int32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	u_int32_t sfi_indirect;			/* Indirect block */
-	u_int32_t sfi_waste[128-3-SFS_NDIRECT]; /* unused space */
+	u_int32_t sfi_dindirect;		/* Double indirect block */
+	u_int32_t sfi_tindirect;		/* Triple indirect block */
+	u_int32_t sfi_waste[128-5-SFS_NDIRECT]; /* unused space */
 };
 
 /*
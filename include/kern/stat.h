@@ -25,6 +25,7 @@ struct stat {
 #define S_IFLNK 030000		/* symbolic link */
 #define S_IFCHR 040000		/* character device */
 #define S_IFBLK 050000		/* block device */
+#define S_IFIFO 060000		/* pipe */
 
 /*
  * Macros for testing a mode value
@@ -34,5 +35,6 @@ struct stat {
 #define S_ISLNK(mode)	(((mode) & S_IFMT) == S_IFLNK)	/* symlink */
 #define S_ISCHR(mode)	(((mode) & S_IFMT) == S_IFCHR)	/* char device */
 #define S_ISBLK(mode)	(((mode) & S_IFMT) == S_IFBLK)	/* block device */
+#define S_ISFIFO(mode)	(((mode) & S_IFMT) == S_IFIFO)	/* pipe */
 
 #endif /* _KERN_STAT_H_ */
@@ -24,6 +24,9 @@
 #define STDOUT_FILENO 1      /* Standard output */
 #define STDERR_FILENO 2      /* Standard error */
 
+/* Flags for waitpid */
+#define WNOHANG       1      /* Return 0 instead of blocking if no child has exited */
+
 /* Codes for reboot */
 #define RB_REBOOT     0      /* Reboot system */
 #define RB_HALT       1      /* Halt system and do not reboot */
@@ -34,6 +37,16 @@
 #define SEEK_CUR      1      /* Seek relative to current position in file */
 #define SEEK_END      2      /* Seek relative to end of file */
 
+/* Protections for mmap */
+#define PROT_READ     1      /* Region can be read */
+#define PROT_WRITE    2      /* Region can be written */
+#define PROT_EXEC     4      /* Region can be executed */
+
+/* Flags for mmap */
+#define MAP_SHARED    1      /* Writes go back to the file */
+#define MAP_PRIVATE   2      /* Writes stay in this process */
+#define MAP_ANON      4      /* Zero-filled memory, no file */
+
 /* The codes for ioctl are in kern/ioctl.h */
 /* The codes for stat/fstat/lstat are in kern/stat.h */
 
@@ -2,13 +2,17 @@
 #if OPT_A2
 
 #define MIN_PID 100 //the minimum pid **MUST BE GREATER THAN THE NUMBER OF ERROR CODES**
+#define MAX_PID 1024 //one more than the largest pid; the process table has MAX_PID - MIN_PID slots
 
 #include <types.h>
 
+void pid_bootstrap();
 pid_t new_pid();
-void pid_process_exit(pid_t x);
+void pid_add_child(pid_t parent, pid_t child);
+void pid_process_exit(pid_t x, int exit_code);
 void pid_parent_done(pid_t x);
-void pid_free(pid_t x);
 int pid_claimed(pid_t x);
+int pid_is_child(pid_t parent, pid_t x);
+pid_t pid_wait(pid_t parent, pid_t x, int options, int *exit_code);
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+struct vnode;
+
+/*
+ * Pipes.
+ *
+ * A pipe is an in-kernel ring buffer with two vnodes, one for reading
+ * and one for writing. Neither end has a name or a filesystem; they are
+ * reached only through the file table, and each end goes away on its
+ * last vfs_close.
+ *
+ * Reads block until there is data, then return whatever is there, up
+ * to the amount asked for. Once the write end is closed and the buffer
+ * drains, reads return end-of-file. Writes block until there is room;
+ * a write of PIPE_BUF bytes or fewer goes in all at once and is never
+ * interleaved with other writers. Writing when the read end is closed
+ * fails with EPIPE.
+ *
+ * pipe_create hands back both ends, each already opened once (as if by
+ * vfs_open), or returns an error code.
+ */
+
+/* Size of the ring buffer. Must be a power of two. */
+#define PIPE_SIZE  8192
+
+int pipe_create(struct vnode **readend, struct vnode **writeend);
+
+#endif /* _PIPE_H_ */
@@ -15,6 +15,8 @@ struct page_detail {
 	int valid; //valid bit
 	int dirty; //dirty bit (can we modify)
 	int use; //use bit (have we used the page recently)
+	int modified; //written since last written back (shared mappings only)
+	struct segment *seg; //the segment the page belongs to
 };
 
 //struct page_table;
@@ -29,6 +31,8 @@ struct page_table {
 struct page_table* pt_create(struct segment *segments);
 
 void pt_page_in(vaddr_t vaddr, struct segment *s);
+void pt_mark_modified(vaddr_t vaddr, struct segment *s);
+int pt_write_back(struct segment *s, struct page_detail *pd, int frame);
 void pt_destroy(struct page_table *pt);
 
 #endif
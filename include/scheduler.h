@@ -5,11 +5,14 @@
  * Scheduler-related function calls.
  *
  *     scheduler     - run the scheduler and choose the next thread to run.
- *     make_runnable - add the specified thread to the run queue. If it's
- *                     already on the run queue or sleeping, weird things
- *                     may happen. Returns an error code.
+ *     make_runnable - add the specified thread to the run queue of the
+ *                     CPU it last ran on. If it's already on a run
+ *                     queue or sleeping, weird things may happen.
+ *                     Returns an error code.
  *
- *     print_run_queue - dump the run queue to the console for debugging.
+ *     print_run_queue - dump the run queues to the console for debugging.
+ *     scheduler_printstats - print per-CPU run queue lengths and
+ *                     migration counts.
  *
  *     scheduler_bootstrap - initialize scheduler data 
  *                           (must happen early in boot)
@@ -24,6 +27,7 @@ struct thread *scheduler(void);
 int make_runnable(struct thread *t);
 
 void print_run_queue(void);
+void scheduler_printstats(void);
 
 void scheduler_bootstrap(void);
 int scheduler_preallocate(int numthreads);
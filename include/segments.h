@@ -3,6 +3,8 @@
 #include "opt-A3.h"
 #if OPT_A3
 
+struct vnode;
+
 struct segment {
 	int active;
 	vaddr_t vbase; /*Base Virtual Address*/
@@ -16,6 +18,9 @@ struct segment {
 	u_int32_t p_filesz; /* Size of data within file */
 	u_int32_t p_memsz; /* Size of data to be loaded into memory*/
 	u_int32_t p_flags; /* Flags */
+
+	struct vnode *vn; /* File an mmap region pages from (NULL for ELF segments, the stack and anonymous mappings) */
+	int shared; /* mmap region whose modified pages are written back to vn */
 };
 #endif /* OPT_A3 */
 #endif
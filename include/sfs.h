@@ -18,18 +18,148 @@ struct sfs_vnode {
 	struct sfs_inode sv_i;		/* on-disk inode */
 	u_int32_t sv_ino;               /* inode number */
 	int sv_dirty;                   /* true if sv_i modified */
+	off_t sv_raoff;                 /* where the last read ended */
+	u_int32_t sv_rawin;             /* readahead window (blocks) */
+	u_int32_t sv_raend;             /* file block readahead got up to */
+	u_int32_t sv_leafbase;          /* first file block sv_leaf maps */
+	u_int32_t sv_leaf;              /* last single indirect block used */
+	u_int32_t sv_goal;              /* where to put the next new block */
+	u_int32_t sv_pre;               /* next preallocated block */
+	u_int32_t sv_npre;              /* preallocated blocks left */
+	struct sfs_dirindex *sv_dirindex; /* name index (directories), or NULL */
+	int sv_cached;                  /* true if unused, on the LRU list */
+	struct sfs_vnode *sv_hashnext;  /* vnode table hash chain */
+	struct sfs_vnode *sv_lrunext;   /* next more recently used */
+	struct sfs_vnode *sv_lruprev;   /* next less recently used */
 };
 
+/*
+ * In-memory index of the names in a directory (sfs_vnode.c). It's
+ * built the first time the directory is searched and kept up to date
+ * as entries are added and removed, for as long as the vnode stays
+ * in memory.
+ */
+struct sfs_direntry {
+	char de_name[SFS_NAMELEN];      /* name */
+	u_int32_t de_ino;               /* inode number */
+	int de_slot;                    /* slot in the directory */
+	struct sfs_direntry *de_next;   /* hash chain */
+};
+
+struct sfs_dirindex {
+	struct sfs_direntry **di_hash;  /* hash table of names */
+	unsigned di_nbuckets;           /* size of di_hash */
+	unsigned di_nentries;           /* names in the table */
+	int *di_free;                   /* empty slots, for reuse */
+	unsigned di_nfree;              /* number of them */
+	unsigned di_maxfree;            /* room in di_free */
+};
+
+/* Initial size of a directory index hash table */
+#define SFS_DIRHASH 16
+
+/* Blocks reserved at a time for a file being written */
+#define SFS_PREALLOC 8
+
+/* Number of hash chains in the vnode table */
+#define SFS_VNHASH 61
+
+/* Most unused vnodes kept in memory per volume */
+#define SFS_VNCACHE 64
+
+/*
+ * Metadata journal (sfs_journal.c). Changes to metadata blocks in the
+ * buffer cache pile up until a commit writes them all to the journal,
+ * then to where they belong. j_lock protects the rest of this.
+ */
+struct sfs_journal {
+	struct lock *j_lock;
+	struct cv *j_cv;                /* signalled when things change */
+	int j_nops;                     /* operations in progress */
+	int j_committing;               /* true while a commit waits or runs */
+	u_int32_t j_max;                /* most buffers to let pile up */
+	struct sfs_jheader j_head;      /* journal header */
+	char *j_log;                    /* blocks being logged */
+	struct sfs_buf *j_bufs[SFS_JMAXLOG]; /* and their buffers */
+	struct bitmap *j_freed;         /* blocks freed since the last commit */
+	u_int32_t j_freelo;             /* lowest block marked in j_freed */
+	u_int32_t j_freehi;             /* highest, plus one */
+	struct sfs_fs *j_next;          /* next journaled volume */
+};
+
+/*
+ * Most metadata blocks one operation changes, and most that are let
+ * pile up on a volume before a commit. Buffers waiting to be journaled
+ * can't be replaced, so SFS_JMAX is a quarter of the cache: a few busy
+ * volumes together still leave it room to work. A volume whose
+ * freemap leaves less room than that in the journal header gets a
+ * smaller limit, but not below SFS_JMIN.
+ */
+#define SFS_JOPMAX 10
+#define SFS_JMAX (SFS_NBUF/4)
+#define SFS_JMIN (2*SFS_JOPMAX)
+
+/* File blocks written per operation, so writes stay under SFS_JOPMAX */
+#define SFS_JWRITE 4
+
+/* Journal size: header, SFS_JMAX blocks, the freemap and the superblock */
+#define SFS_JBLOCKS(nblocks) (1 + SFS_JMAX + SFS_BITBLOCKS(nblocks) + 1)
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	int sfs_superdirty;             /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct array *sfs_vnodes;       /* vnodes loaded into memory */
+	/*
+	 * Vnodes loaded into memory, hashed by inode number. Ones no
+	 * longer in use stay here, on an LRU list, until there are more
+	 * than SFS_VNCACHE of them. sfs_vnlock protects all of this.
+	 */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASH];
+	struct sfs_vnode *sfs_vnlru;    /* least recently used unused vnode */
+	struct sfs_vnode *sfs_vnmru;    /* most recently used unused vnode */
+	unsigned sfs_nvnodes;           /* vnodes in the table */
+	unsigned sfs_nvncached;         /* how many of those are unused */
+	struct lock *sfs_vnlock;
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	int sfs_freemapdirty;           /* true if freemap modified */
+	struct bitmap *sfs_mapdirty;    /* freemap sectors not yet written */
+	struct bitmap *sfs_resmap;      /* in use but free on disk: reserved */
+	u_int32_t sfs_nextfree;         /* where to start looking for blocks */
+	struct sfs_journal *sfs_journal; /* metadata journal, or NULL */
+	unsigned sfs_njdirty;           /* buffers waiting to be journaled */
+};
+
+/*
+ * Buffer in the disk buffer cache (sfs_cache.c). b_data and the
+ * valid/dirty flags belong to whoever has the buffer busy.
+ */
+struct sfs_buf {
+	struct sfs_fs *b_fs;            /* volume, or NULL if unused */
+	u_int32_t b_block;              /* block number on the volume */
+	int b_valid;                    /* true if b_data holds the block */
+	int b_dirty;                    /* true if b_data is newer than disk */
+	int b_jdirty;                   /* true if it must be journaled first */
+	int b_busy;                     /* true while handed out */
+	struct sfs_buf *b_hashnext;     /* hash chain */
+	struct sfs_buf *b_lrunext;      /* next more recently used */
+	struct sfs_buf *b_lruprev;      /* next less recently used */
+	char b_data[SFS_BLOCKSIZE];
 };
 
+/* Number of buffers in the cache */
+#define SFS_NBUF 128
+
+/* Seconds between runs of the syncer thread */
+#define SFS_SYNCER_SECS 5
+
+/* Readahead window for sequential reads: starts at RAMIN, up to RAMAX */
+#define SFS_RAMIN 2
+#define SFS_RAMAX 16
+
+/* Most cached blocks moved in one device request */
+#define SFS_MAXRUN 16
+
 /*
  * Function for mounting a sfs (calls vfs_mount)
  */
@@ -49,7 +179,45 @@ int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 
+/* Buffer cache */
+int sfs_bufinit(void);
+int sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+int sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+void sfs_bprefetch(struct sfs_fs *sfs, u_int32_t block, u_int32_t n);
+int sfs_bcached(struct sfs_fs *sfs, u_int32_t block);
+struct sfs_buf *sfs_bpeek(struct sfs_fs *sfs, u_int32_t block);
+void sfs_bdirty(struct sfs_buf *b);
+void sfs_bjdirty(struct sfs_buf *b);
+void sfs_brelse(struct sfs_buf *b);
+void sfs_binval(struct sfs_fs *sfs, u_int32_t block);
+int sfs_bsync(struct sfs_fs *sfs);
+void sfs_bpurge(struct sfs_fs *sfs);
+int sfs_bjgather(struct sfs_fs *sfs, struct sfs_buf **bufs, u_int32_t max,
+		 u_int32_t *ret);
+void sfs_bjrelease(struct sfs_buf **bufs, u_int32_t n);
+int sfs_bjwrite(struct sfs_buf **bufs, u_int32_t n);
+
+/* Metadata journal */
+int sfs_jreplay(struct sfs_fs *sfs);
+int sfs_jinit(struct sfs_fs *sfs);
+void sfs_jdestroy(struct sfs_fs *sfs);
+int sfs_jbegin(struct sfs_fs *sfs);
+void sfs_jend(struct sfs_fs *sfs);
+void sfs_jfree(struct sfs_fs *sfs, u_int32_t block);
+int sfs_jcommit(struct sfs_fs *sfs);
+void sfs_jcommitall(void);
+
+/* Freemap and superblock */
+void sfs_mapdirty(struct sfs_fs *sfs, u_int32_t diskblock);
+int sfs_writemeta(struct sfs_fs *sfs);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
+/* Put a vnode's inode in the buffer cache, if it has changed */
+int sfs_sync_inode(struct sfs_vnode *sv);
+
+/* Throw away unused vnodes, on unmount */
+int sfs_vnflush(struct sfs_fs *sfs);
+
 #endif /* _SFS_H_ */
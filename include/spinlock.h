@@ -0,0 +1,43 @@
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_
+
+/*
+ * Spinlock.
+ *
+ * A spinlock protects short critical sections that must not sleep.
+ * Acquiring one raises the spl to high on the acquiring CPU (so an
+ * interrupt handler on this CPU can never try to take a lock we
+ * already hold) and then spins until the lock word is free; releasing
+ * the last spinlock a CPU holds puts the spl back to whatever it was
+ * before the first one was acquired. Spinlocks may therefore be
+ * released in any order.
+ *
+ * Operations:
+ *    spinlock_init      - set up a spinlock (a zeroed spinlock, or
+ *                         SPINLOCK_INITIALIZER, is already set up).
+ *    spinlock_cleanup   - check that a spinlock is free before it goes
+ *                         away.
+ *    spinlock_acquire   - get the lock, spinning if another CPU has it.
+ *    spinlock_release   - give it back. Only the holder may do this.
+ *    spinlock_do_i_hold - return true if the current CPU holds the lock.
+ *
+ * A thread must not sleep or yield while holding a spinlock; mi_switch
+ * checks this.
+ */
+
+struct cpu;
+
+struct spinlock {
+	volatile u_int32_t splk_lock;	/* nonzero while held */
+	struct cpu *splk_holder;	/* CPU holding the lock */
+};
+
+#define SPINLOCK_INITIALIZER	{ 0, NULL }
+
+void spinlock_init(struct spinlock *lk);
+void spinlock_cleanup(struct spinlock *lk);
+void spinlock_acquire(struct spinlock *lk);
+void spinlock_release(struct spinlock *lk);
+int spinlock_do_i_hold(struct spinlock *lk);
+
+#endif /* _SPINLOCK_H_ */
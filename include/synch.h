@@ -92,20 +92,11 @@ void         lock_destroy(struct lock *);
  * internally.
  */
 
-#if OPT_A1
-//a list structure for use in my CV implementation
-struct wait_list {
-    volatile int signal; //1 if the thread should be woken up, 0 otherwise
-    struct lock *lock;
-    struct wait_list *next;
-};
-#endif
- 
 struct cv {
 	char *name;
 #if OPT_A1
-    struct wait_list *first; //next thread to be woken up
-    struct wait_list *last; //most recently added thread
+    struct thread *first; //next thread to be woken up (linked through t_waitnext)
+    struct thread *last; //most recently added thread
 #endif
 };
 
@@ -115,4 +106,53 @@ void       cv_signal(struct cv *cv, struct lock *lock);
 void       cv_broadcast(struct cv *cv, struct lock *lock);
 void       cv_destroy(struct cv *);
 
+
+/*
+ * Reader-writer lock.
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Any number of
+ *                           readers may hold the lock at the same time.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for writing. A writer excludes
+ *                           both readers and other writers.
+ *    rwlock_release_write - Give up the write hold. Only the thread
+ *                           holding the lock for writing may do this.
+ *    rwlock_upgrade       - Turn a read hold into a write hold without
+ *                           letting another writer in between. Only one
+ *                           reader can be upgrading at a time; if another
+ *                           reader already is, this returns false and the
+ *                           caller still holds the lock for reading (it
+ *                           should release it and use rwlock_acquire_write).
+ *                           Returns true once the caller holds the lock
+ *                           for writing.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds the
+ *                           lock for writing; false otherwise.
+ *
+ * Writers are preferred: once a writer is waiting, new readers block
+ * until it has had its turn, so a steady stream of lookups cannot
+ * starve an update. Read holds are not recursive.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct rwlock {
+	char *name;
+#if OPT_A1
+	struct thread *writer; //the thread holding the lock for writing, if any
+	volatile int readers; //number of threads holding the lock for reading
+	volatile int waiting_writers; //writers blocked in rwlock_acquire_write
+	volatile int upgrading; //whether a reader is waiting in rwlock_upgrade
+#endif
+};
+
+struct rwlock *rwlock_create(const char *name);
+void           rwlock_acquire_read(struct rwlock *);
+void           rwlock_release_read(struct rwlock *);
+void           rwlock_acquire_write(struct rwlock *);
+void           rwlock_release_write(struct rwlock *);
+int            rwlock_upgrade(struct rwlock *);
+int            rwlock_do_i_hold_write(struct rwlock *);
+void           rwlock_destroy(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
@@ -2,9 +2,12 @@
 #define _SYSCALL_H_
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #if OPT_A2
 #include <types.h>
 #include <machine/trapframe.h>
+
+struct iovec;
 #endif
 
 /*
@@ -18,10 +21,30 @@ int sys_write(int *retval, int filehandle, const void *buf, size_t size);
 int sys_read(int *retval, int filehandle, const void *buf, size_t size);
 int sys_open(int *retval, char *filename, int flags, int modes);
 int sys_close(int *retval, int fdn);
+int sys_dup2(int *retval, int oldfd, int newfd);
+int sys_lseek(int *retval, int fdn, off_t pos, int whence);
+int sys_readv(int *retval, int fdn, const struct iovec *iov, int iovcnt);
+int sys_writev(int *retval, int fdn, const struct iovec *iov, int iovcnt);
+int sys_pread(int *retval, int fdn, void *buf, size_t nbytes, off_t pos);
+int sys_pwrite(int *retval, int fdn, const void *buf, size_t nbytes, off_t pos);
+int sys_pipe(int *retval, int *fds);
 pid_t sys_getpid();
 int sys_waitpid(pid_t PID, int *status, int options);
 pid_t sys_fork(struct trapframe *tf);
 int sys_execv(char *progname, char ** args);
+int sys_spawn(int *retval, char *progname, char **args);
+
+/*
+ * Helpers in execv.c for staging a new program's arguments; also used
+ * by spawn.
+ */
+int copyin_exec(char *progname, char **args, char **kprogname, char **kargs, int *nargs, size_t *len);
+int copyout_args(char *buf, int nargs, size_t len, vaddr_t *stackptr, userptr_t *argv);
+#endif
+#if OPT_A3
+int sys_mmap(int *retval, void *addr, size_t len, int prot, int flags, int fdn, off_t offset);
+int sys_munmap(int *retval, void *addr, size_t len);
+int sys_msync(int *retval, void *addr, size_t len, int flags);
 #endif
 
 
@@ -11,11 +11,11 @@
 #include "opt-A2.h"
 #if OPT_A2
 #include <types.h>
-#include <child_table.h>
 #include <synch.h>
 #endif
 
 struct addrspace;
+struct cpu;
 
 struct thread {
 	/**********************************************************/
@@ -26,15 +26,16 @@ struct thread {
 	char *t_name;
 	const void *t_sleepaddr;
 	char *t_stack;
+	struct thread *t_waitnext;	/* next thread on the same wait queue */
+	struct thread *t_runnext;	/* next thread on the same run queue */
+	struct cpu *t_cpu;		/* CPU whose run queue we go back on */
 	
 	/**********************************************************/
 	/* Public thread members - can be used by other code      */
 	/**********************************************************/
 	
 	#if OPT_A2
-	pid_t pid;
-	struct thread *parent;
-	struct child_table *children;
+	pid_t pid; //parent, children and exit code are kept in the pid's process table slot
 	int exit_status;
 	/*
 	 * This is the filetable for the thread.
@@ -111,6 +112,23 @@ void thread_sleep(const void *addr);
  */
 void thread_wakeup(const void *addr);
 
+/*
+ * Cause the current thread to yield to the next runnable thread and go
+ * to sleep without a sleep address. The thread is not placed in the
+ * sleepers table; the caller must already have queued it somewhere
+ * (e.g. on a CV's wait queue through t_waitnext) so that it can later
+ * be handed to thread_unblock.
+ * Interrupts must be disabled.
+ */
+void thread_block(void);
+
+/*
+ * Make a thread that went to sleep with thread_block runnable again.
+ * Only that thread is woken.
+ * Interrupts must be disabled.
+ */
+void thread_unblock(struct thread *t);
+
 /*
  * Return nonzero if there are any threads sleeping on the specified
  * address. Meant only for diagnostic purposes.
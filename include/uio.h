@@ -2,8 +2,10 @@
 #define _UIO_H_
 
 /*
- * Like BSD uio, but simplified a bit. (In BSD, there can be more than one
- * iovec in a uio.)
+ * Like BSD uio, but simplified a bit. As in BSD, a uio can scatter or
+ * gather over an array of iovecs (uio_iov, uio_iovcnt). The common case
+ * of a single buffer uses the iovec embedded in the uio, uio_iovec; set
+ * uio_iov to point at it and uio_iovcnt to 1 (mk_kuio and mk_uuio do this).
  */
 
 enum uio_rw {
@@ -28,7 +30,9 @@ struct iovec {
 #define iov_ubase  iov_un.un_ubase
 
 struct uio {
-	struct iovec      uio_iovec;       /* Data block */
+	struct iovec     *uio_iov;         /* Data blocks */
+	unsigned          uio_iovcnt;      /* Number of data blocks left */
+	struct iovec      uio_iovec;       /* Storage for a single data block */
 	off_t             uio_offset;      /* desired offset into object */
 	size_t            uio_resid;       /* Remaining amt of data to xfer */
 	enum uio_seg      uio_segflg;      /* what kind of pointer we have */
@@ -43,7 +47,8 @@ struct uio {
  * fields as well.
  *
  * Before calling this, you should
- *   (1) set up uio_iovec to point to the buffer you want to transfer to;
+ *   (1) set up uio_iov and uio_iovcnt to point to the buffer(s) you want
+ *       to transfer to;
  *   (2) initialize uio_offset as desired;
  *   (3) initialize uio_resid to the total amount of data that can be 
  *       transferred through this uio;
@@ -53,8 +58,8 @@ struct uio {
  *       should be found.
  *
  * After calling, 
- *   (1) the contents of uio_iovec may be altered and should not be 
- *       interpreted;
+ *   (1) uio_iov, uio_iovcnt, and the contents of the iovecs may be
+ *       altered and should not be interpreted;
  *   (2) uio_offset will have been incremented by the amount transferred;
  *   (3) uio_resid will have been decremented by the amount transferred;
  *   (4) uio_segflg, uio_rw, and uio_space will be unchanged.
@@ -83,4 +88,21 @@ int uiomovezeros(size_t len, struct uio *uio);
  */
 void mk_kuio(struct uio *, void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Initialize uio for I/O from a user buffer in the current address space.
+ * The caller should have checked the whole buffer is mapped.
+ */
+void mk_uuio(struct uio *, userptr_t ubuf, size_t len, off_t pos,
+	     enum uio_rw rw);
+
+/*
+ * Initialize uio for I/O from an array of iovcnt user iovecs, found at
+ * uiov in the current address space. The iovecs are copied into kiov,
+ * which must have room for IOV_MAX of them, and each buffer is checked
+ * to be mapped. Returns EINVAL if iovcnt is out of range or the lengths
+ * add up to more than a read or write can return, or EFAULT.
+ */
+int mk_uuiov(struct uio *, struct iovec *kiov, const_userptr_t uiov,
+	     int iovcnt, off_t pos, enum uio_rw rw);
+
 #endif /* _UIO_H_ */
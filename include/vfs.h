@@ -42,12 +42,26 @@ const char *vfs_getdevname(struct fs *fs);
  *    vfs_lookparent - Likewise, for VOP_LOOKPARENT.
  *
  * Both of these may destroy the path passed in.
+ *
+ * Pathname lookup cache (vfscache.c):
+ *
+ *    vfs_lookone    - VOP_LOOKUP of a single name, answered from the
+ *                     cache if possible.
+ *    vfs_ncforget   - Drop whatever is cached for a name in a
+ *                     directory; call after anything that creates,
+ *                     removes or renames it.
+ *    vfs_ncpurge    - Drop everything cached for a filesystem (before
+ *                     unmounting it).
  */
 
 int vfs_lookup(char *path, struct vnode **result);
 int vfs_lookparent(char *path, struct vnode **result,
 		   char *buf, size_t buflen);
 
+int vfs_lookone(struct vnode *dir, char *name, struct vnode **result);
+void vfs_ncforget(struct vnode *dir, const char *name);
+void vfs_ncpurge(struct fs *fs);
+
 /*
  * VFS layer high-level operations on pathnames
  * Because namei may destroy pathnames, these all may too.
@@ -91,6 +105,10 @@ int vfs_getcwd(struct uio *buf);
  *                    bootfs-related structures. (Called from 
  *                    vfs_bootstrap.)
  *
+ *    vfs_initnamecache - Call during system initialization to set up
+ *                    the pathname lookup cache. (Called from
+ *                    vfs_bootstrap.)
+ *
  *    vfs_setbootfs - Set the filesystem that paths beginning with a
  *                    slash are sent to. If not set, these paths fail
  *                    with ENOENT. The argument should be the device
@@ -133,6 +151,7 @@ int vfs_getcwd(struct uio *buf);
 void vfs_bootstrap(void);
 
 void vfs_initbootfs(void);
+void vfs_initnamecache(void);
 int vfs_setbootfs(const char *fsname);
 void vfs_clearbootfs(void);
 
@@ -69,6 +69,34 @@ bitmap_getdata(struct bitmap *b)
 	return b->v;
 }
 
+/*
+ * Return the index of the first word from IX on (below MAXIX) that
+ * isn't all ones, or MAXIX if there isn't one. Most of a full disk's
+ * map is, so this checks sizeof(u_int32_t) words at a time where it
+ * can, copying them into a local word so that the map needn't be
+ * aligned for it. (Comparing against all ones doesn't care about
+ * byte order.)
+ */
+static
+u_int32_t
+bitmap_skipfull(struct bitmap *b, u_int32_t ix, u_int32_t maxix)
+{
+	const u_int32_t wide = sizeof(u_int32_t) / sizeof(WORD_TYPE);
+	u_int32_t w;
+
+	while (ix + wide <= maxix) {
+		memcpy(&w, &b->v[ix], sizeof(w));
+		if (w != 0xffffffff) {
+			break;
+		}
+		ix += wide;
+	}
+	while (ix < maxix && b->v[ix] == WORD_ALLBITS) {
+		ix++;
+	}
+	return ix;
+}
+
 int
 bitmap_alloc(struct bitmap *b, u_int32_t *index)
 {
@@ -76,20 +104,21 @@ bitmap_alloc(struct bitmap *b, u_int32_t *index)
 	u_int32_t maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
 	u_int32_t offset;
 
-	for (ix=0; ix<maxix; ix++) {
-		if (b->v[ix]!=WORD_ALLBITS) {
-			for (offset = 0; offset < BITS_PER_WORD; offset++) {
-				WORD_TYPE mask = ((WORD_TYPE)1)<<offset;
-				if ((b->v[ix] & mask)==0) {
-					b->v[ix] |= mask;
-					*index = (ix*BITS_PER_WORD)+offset;
-					assert(*index < b->nbits);
-					return 0;
-				}
-			}
-			assert(0);
+	ix = bitmap_skipfull(b, 0, maxix);
+	if (ix == maxix) {
+		return ENOSPC;
+	}
+
+	for (offset = 0; offset < BITS_PER_WORD; offset++) {
+		WORD_TYPE mask = ((WORD_TYPE)1)<<offset;
+		if ((b->v[ix] & mask)==0) {
+			b->v[ix] |= mask;
+			*index = (ix*BITS_PER_WORD)+offset;
+			assert(*index < b->nbits);
+			return 0;
 		}
 	}
+	assert(0);
 	return ENOSPC;
 }
 
@@ -104,6 +133,74 @@ bitmap_translate(u_int32_t bitno, u_int32_t *ix, WORD_TYPE *mask)
 	*mask = ((WORD_TYPE)1) << offset;
 }
 
+/*
+ * Look for N clear bits in a row among bits FROM up to (not including)
+ * LIMIT. Return the index of the first, or LIMIT if there aren't any.
+ */
+static
+u_int32_t
+bitmap_findrun(struct bitmap *b, u_int32_t from, u_int32_t limit,
+	       u_int32_t n)
+{
+	u_int32_t i, ix, skip, run = 0;
+	WORD_TYPE mask;
+
+	for (i=from; i<limit; i++) {
+		bitmap_translate(i, &ix, &mask);
+		if (run == 0 && mask == 1) {
+			/* Skip whole words that are all in use */
+			skip = bitmap_skipfull(b, ix, limit / BITS_PER_WORD);
+			if (skip > ix) {
+				i = skip*BITS_PER_WORD - 1;
+				continue;
+			}
+		}
+		if (b->v[ix] & mask) {
+			run = 0;
+		}
+		else if (++run == n) {
+			return i+1-n;
+		}
+	}
+	return limit;
+}
+
+int
+bitmap_alloc_range(struct bitmap *b, u_int32_t start, u_int32_t n,
+		   u_int32_t *index)
+{
+	u_int32_t first, limit, i, ix;
+	WORD_TYPE mask;
+
+	assert(n > 0);
+	if (n > b->nbits) {
+		return ENOSPC;
+	}
+	if (start >= b->nbits) {
+		start = 0;
+	}
+
+	first = bitmap_findrun(b, start, b->nbits, n);
+	if (first == b->nbits) {
+		/* Wrap around; include runs that cross START */
+		limit = start+n-1;
+		if (limit > b->nbits) {
+			limit = b->nbits;
+		}
+		first = bitmap_findrun(b, 0, limit, n);
+		if (first == limit) {
+			return ENOSPC;
+		}
+	}
+
+	for (i=first; i<first+n; i++) {
+		bitmap_translate(i, &ix, &mask);
+		b->v[ix] |= mask;
+	}
+	*index = first;
+	return 0;
+}
+
 void
 bitmap_mark(struct bitmap *b, u_int32_t index)
 {
@@ -11,6 +11,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <scheduler.h>
+#include <cpu.h>
 #include <dev.h>
 #include <vfs.h>
 #include <vm.h>
@@ -79,6 +80,9 @@ boot(void) {
             GROUP_VERSION, buildconfig, buildversion);
     kprintf("\n");
 
+    /* Per-CPU data first: everything after this may take spinlocks. */
+    cpu_bootstrap();
+
 #if OPT_A3
     ram_bootstrap();
     
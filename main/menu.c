@@ -9,6 +9,7 @@
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <scheduler.h>
 #include <syscall.h>
 #include <uio.h>
 #include <vfs.h>
@@ -358,6 +359,18 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	scheduler_printstats();
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -428,6 +441,7 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] RW lock test          (1)     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
@@ -463,6 +477,7 @@ static const char *mainmenu[] = {
 	"[1b] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ss] Scheduler stats                ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -518,6 +533,7 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ss",         cmd_schedstats },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -536,6 +552,7 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
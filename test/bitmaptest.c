@@ -1,5 +1,6 @@
 #include <types.h>
 #include <lib.h>
+#include <kern/errno.h>
 #include <bitmap.h>
 #include <test.h>
 
@@ -72,6 +73,28 @@ bitmaptest(int nargs, char **args)
 		assert(data[i]==0);
 	}
 
+	/* Runs: free [100,110) and [300,305), then allocate out of them */
+	for (i=100; i<110; i++) {
+		bitmap_unmark(b, i);
+	}
+	for (i=300; i<305; i++) {
+		bitmap_unmark(b, i);
+	}
+	assert(bitmap_alloc_range(b, 0, 8, &x)==0 && x==100);
+	assert(bitmap_alloc_range(b, 200, 5, &x)==0 && x==300);
+	assert(bitmap_alloc_range(b, 310, 2, &x)==0 && x==108);
+	assert(bitmap_alloc_range(b, 0, 1, &x)==ENOSPC);
+	for (i=0; i<TESTSIZE; i++) {
+		assert(bitmap_isset(b, i));
+	}
+
+	/* Single free bits after long full stretches, incl. the last word */
+	bitmap_unmark(b, 259);
+	bitmap_unmark(b, 530);
+	assert(bitmap_alloc(b, &x)==0 && x==259);
+	assert(bitmap_alloc(b, &x)==0 && x==530);
+	assert(bitmap_alloc(b, &x)==ENOSPC);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
@@ -12,6 +12,7 @@
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NRWLOOPS      60
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -20,6 +21,7 @@ static volatile unsigned long testval3;
 static struct semaphore *testsem;
 static struct lock *testlock;
 static struct cv *testcv;
+static struct rwlock *testrwlock;
 static struct semaphore *donesem;
 
 static
@@ -44,6 +46,12 @@ inititems(void)
 			panic("synchtest: cv_create failed\n");
 		}
 	}
+	if (testrwlock==NULL) {
+		testrwlock = rwlock_create("testrwlock");
+		if (testrwlock == NULL) {
+			panic("synchtest: rwlock_create failed\n");
+		}
+	}
 	if (donesem==NULL) {
 		donesem = sem_create("donesem", 0);
 		if (donesem == NULL) {
@@ -272,3 +280,88 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Every fourth thread is a writer; every eighth writer gets there by
+ * upgrading a read hold. Readers check that they never see a writer's
+ * update half done, and that no writer is in while they are.
+ */
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	unsigned long v;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			if (num % 8 == 0) {
+				rwlock_acquire_read(testrwlock);
+				if (!rwlock_upgrade(testrwlock)) {
+					rwlock_release_read(testrwlock);
+					rwlock_acquire_write(testrwlock);
+				}
+			}
+			else {
+				rwlock_acquire_write(testrwlock);
+			}
+			assert(rwlock_do_i_hold_write(testrwlock));
+			testval3 = 1;
+			testval1 = num;
+			thread_yield();
+			testval2 = num*num;
+			testval3 = 0;
+			rwlock_release_write(testrwlock);
+		}
+		else {
+			rwlock_acquire_read(testrwlock);
+			if (testval3 != 0) {
+				fail(num, "testval3 (writer inside)");
+			}
+			v = testval1;
+			thread_yield();
+			if (testval1 != v) {
+				fail(num, "testval1 changed under a read hold");
+			}
+			if (testval2 != v*v) {
+				fail(num, "testval2/testval1");
+			}
+			rwlock_release_read(testrwlock);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = 0;
+	testval2 = 0;
+	testval3 = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, i, rwtestthread,
+				     NULL);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
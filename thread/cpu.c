@@ -0,0 +1,38 @@
+/*
+ * Per-CPU data. See cpu.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+
+struct cpu allcpus[MAXCPUS];
+unsigned ncpus;
+
+/*
+ * Statically pointed at the boot CPU so spinlocks work even before
+ * cpu_bootstrap runs.
+ */
+struct cpu *curcpu = &allcpus[0];
+
+void
+cpu_bootstrap(void)
+{
+	unsigned i;
+
+	/* Only the boot processor exists on System/161 as we run it. */
+	ncpus = 1;
+
+	for (i=0; i<ncpus; i++) {
+		allcpus[i].c_number = i;
+		allcpus[i].c_spinlocks = 0;
+		allcpus[i].c_spinlock_spl = 0;
+		spinlock_init(&allcpus[i].c_runqueue_lock);
+		allcpus[i].c_runqueue_head = NULL;
+		allcpus[i].c_runqueue_tail = NULL;
+		allcpus[i].c_runqueue_count = 0;
+		allcpus[i].c_stolen_in = 0;
+		allcpus[i].c_stolen_out = 0;
+	}
+	curcpu = &allcpus[0];
+}
@@ -2,22 +2,153 @@
  * Filetables for the thread. See filetable.h for details.
  */
 #include "opt-A2.h"
+#include "opt-A3.h"
 #if OPT_A2
 #include <types.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/limits.h>
-#include <machine/spl.h>
 #include <lib.h>
-#include <array.h>
-#include <queue.h>
+#include <bitmap.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <synch.h>
+#include <uio.h>
 #include <filetable.h>
+#if OPT_A3
+#include <addrspace.h>
+#endif
+
+/*
+ * fd_create()
+ * Creates an open file for the vnode, with no owners yet.
+ */
+struct filedescriptor *fd_create(struct vnode *vn, int mode, int offset) {
+    struct filedescriptor *fd = kmalloc(sizeof (struct filedescriptor));
+    if (fd == NULL) {
+        return NULL;
+    }
+    fd->fdlock = lock_create("fdlock");
+    if (fd->fdlock == NULL) {
+        kfree(fd);
+        return NULL;
+    }
+    spinlock_init(&fd->reflock);
+    fd->fdn = -1;
+    fd->mode = mode;
+    fd->numOwners = 0;
+    fd->offset = offset;
+    //Pipes and character devices refuse every seek with ESPIPE
+    fd->seekable = (VOP_TRYSEEK(vn, 0) != ESPIPE);
+    fd->fdvnode = vn;
+    return fd;
+}
+
+/*
+ * fd_destroy()
+ * Closes the vnode and frees the open file. It must have no owners.
+ */
+void fd_destroy(struct filedescriptor *fd) {
+    assert(fd->numOwners == 0);
+    vfs_close(fd->fdvnode);
+    spinlock_cleanup(&fd->reflock);
+    lock_destroy(fd->fdlock);
+    kfree(fd);
+}
+
+/*
+ * fd_incref()
+ * Adds an owner to the open file.
+ */
+void fd_incref(struct filedescriptor *fd) {
+    spinlock_acquire(&fd->reflock);
+    fd->numOwners++;
+    spinlock_release(&fd->reflock);
+}
+
+/*
+ * fd_decref()
+ * Drops an owner from the open file, closing the vnode and freeing the open
+ * file when it was the last one.
+ */
+void fd_decref(struct filedescriptor *fd) {
+    int last;
+    spinlock_acquire(&fd->reflock);
+    assert(fd->numOwners > 0);
+    fd->numOwners--;
+    last = (fd->numOwners == 0);
+    spinlock_release(&fd->reflock);
+    if (last) {
+        //nobody else can reach it any more
+        fd_destroy(fd);
+    }
+}
+/*
+ * fd_rw()
+ * Reads or writes (by u->uio_rw) the open file, as one VOP_READ or VOP_WRITE
+ * however many buffers u gathers from. If seek is set, the I/O starts at the
+ * seek position and advances it; otherwise it starts at u->uio_offset and the
+ * seek position is left alone (pread, pwrite). On seekable files it holds
+ * fdlock throughout, so each call is atomic relative to other I/O on the same
+ * open file, including from other processes sharing it. Pipes and the console
+ * have no seek position, and a read from them can block indefinitely, so no
+ * lock is held for them. Puts the byte count in retval.
+ */
+int fd_rw(struct filedescriptor *fd, struct uio *u, int seek, int *retval) {
+    size_t len = u->uio_resid;
+    int result;
+    //Make sure that the file is opened the right way for this
+    switch (O_ACCMODE & fd->mode) {
+        case O_RDONLY:
+            if (u->uio_rw != UIO_READ) {
+                return EBADF;
+            }
+            break;
+        case O_WRONLY:
+            if (u->uio_rw != UIO_WRITE) {
+                return EBADF;
+            }
+            break;
+        case O_RDWR:
+            break;
+        default:
+            return EBADF;
+    }
+    if (fd->seekable) {
+        lock_acquire(fd->fdlock);
+        if (seek) {
+            u->uio_offset = fd->offset;
+        }
+    } else if (seek) {
+        //nothing to start from or advance
+        u->uio_offset = 0;
+        seek = 0;
+    }
+    if (u->uio_rw == UIO_READ) {
+        result = VOP_READ(fd->fdvnode, u);
+    } else {
+#if OPT_A3
+        elf_cache_invalidate(fd->fdvnode);
+#endif
+        result = VOP_WRITE(fd->fdvnode, u);
+    }
+    if (result == 0) {
+        *retval = len - u->uio_resid;
+        if (seek) {
+            fd->offset += *retval;
+        }
+    }
+    if (fd->seekable) {
+        lock_release(fd->fdlock);
+    }
+    return result;
+}
+
 /*
  * ft_create()
- * Creates a file table that is attached to the thread library.
- * 
+ * Creates a file table that is attached to the thread library. The table has
+ * room for OPEN_MAX descriptors and never grows, so nothing is allocated when
+ * files are opened.
  */
 struct filetable *ft_create() {
     //Allocate memory for the filetable structures
@@ -26,99 +157,59 @@ struct filetable *ft_create() {
         return NULL;
     }
     ft->size = 0;
-    //Allocate memory for the array of file descriptors
-    ft->filedescriptor = array_create();
-    if (ft->filedescriptor == NULL) {
-        ft_destroy(ft);
+    bzero(ft->filedescriptor, sizeof (ft->filedescriptor));
+    //One bit per descriptor number, so the lowest free one is found without walking the table
+    ft->fdmap = bitmap_create(OPEN_MAX);
+    if (ft->fdmap == NULL) {
+        kfree(ft);
         return NULL;
     }
-    //preallocate the array to 20 files
-    array_preallocate(ft->filedescriptor, 20);
-    //Reserve the first three file descriptors for in out err.
-    array_add(ft->filedescriptor, NULL);
-    array_add(ft->filedescriptor, NULL);
-    array_add(ft->filedescriptor, NULL);
     //Return the file table
     return ft;
 }
 
 /*
- * ft_attachstds()
- * Attach the standard in, out, err to the file table, this can't be located the
- * ft_create function because that the device "con:" etc are not attached to the
- * list of device when the os is the boot sequence.
+ * ft_attachstd()
+ * Opens the console with the given mode and puts it at descriptor fti.
  */
-int ft_attachstds(struct filetable *ft) {
-    char *console = NULL;
-    int mode;
-    int result = 0;
-    //STDIN
-    struct vnode *vn_stdin;
-    mode = O_RDONLY;
-    struct filedescriptor *fd_stdin = NULL;
-    fd_stdin = (struct filedescriptor *) kmalloc(sizeof ( struct filedescriptor));
-    if (fd_stdin == NULL) {
-        ft_destroy(ft);
-        return 0;
-    }
-    console = kstrdup("con:");
-    result = vfs_open(console, mode, &vn_stdin);
+static int ft_attachstd(struct filetable *ft, int mode, int fti) {
+    char console[] = "con:"; //vfs_open may destroy the path it is given
+    struct vnode *vn;
+    struct filedescriptor *fd;
+    int result;
+    result = vfs_open(console, mode, &vn);
     if (result) {
-        vfs_close(vn_stdin);
-        ft_destroy(ft);
-        return 0;
+        return result;
     }
-    kfree(console);
-    fd_stdin->mode = mode;
-    fd_stdin->offset = 0;
-    fd_stdin->fdvnode = vn_stdin;
-    fd_stdin->numOwners = 1;
-    ft_set(ft, fd_stdin, STDIN_FILENO);
-    //STDOUT
-    struct vnode *vn_stdout;
-    mode = O_WRONLY;
-    struct filedescriptor *fd_stdout = NULL;
-    fd_stdout = (struct filedescriptor *) kmalloc(sizeof (struct filedescriptor));
-    if (fd_stdout == NULL) {
-        ft_destroy(ft);
-        return 0;
+    fd = fd_create(vn, mode, 0);
+    if (fd == NULL) {
+        vfs_close(vn);
+        return ENOMEM;
     }
-    console = kstrdup("con:");
-    result = vfs_open(console, mode, &vn_stdout);
+    fd->fdn = fti;
+    ft_set(ft, fd, fti);
+    return 0;
+}
+
+/*
+ * ft_attachstds()
+ * Attach the standard in, out, err to the file table. This can't be done in the
+ * ft_create function because the device "con:" etc are not attached to the
+ * list of devices while the os is in the boot sequence, so it is done once when
+ * a user program is started; forked processes inherit them with the rest of
+ * the table. Returns 0 or an error code.
+ */
+int ft_attachstds(struct filetable *ft) {
+    int result;
+    result = ft_attachstd(ft, O_RDONLY, STDIN_FILENO);
     if (result) {
-        vfs_close(vn_stdout);
-        ft_destroy(ft);
-        return 0;
-    }
-    kfree(console);
-    fd_stdout->mode = mode;
-    fd_stdout->offset = 0;
-    fd_stdout->fdvnode = vn_stdout;
-    fd_stdout->numOwners = 1;
-    ft_set(ft, fd_stdout, STDOUT_FILENO);
-    //STDERR
-    struct vnode *vn_stderr;
-    mode = O_WRONLY;
-    struct filedescriptor *fd_stderr = NULL;
-    fd_stderr = (struct filedescriptor *) kmalloc(sizeof (struct filedescriptor));
-    if (fd_stderr == NULL) {
-        ft_destroy(ft);
-        return 0;
+        return result;
     }
-    console = kstrdup("con:");
-    result = vfs_open(console, mode, &vn_stderr);
+    result = ft_attachstd(ft, O_WRONLY, STDOUT_FILENO);
     if (result) {
-        vfs_close(vn_stderr);
-        ft_destroy(ft);
-        return 0;
+        return result;
     }
-    kfree(console);
-    fd_stderr->mode = mode;
-    fd_stderr->offset = 0;
-    fd_stderr->fdvnode = vn_stderr;
-    fd_stderr->numOwners = 1;
-    ft_set(ft, fd_stderr, STDERR_FILENO);
-    return 1;
+    return ft_attachstd(ft, O_WRONLY, STDERR_FILENO);
 }
 
 /*
@@ -128,7 +219,7 @@ int ft_attachstds(struct filetable *ft) {
  */
 int ft_array_size(struct filetable *ft) {
     assert(ft != NULL);
-    return (array_getnum(ft->filedescriptor));
+    return OPEN_MAX;
 }
 
 /*
@@ -137,14 +228,7 @@ int ft_array_size(struct filetable *ft) {
  */
 int ft_size(struct filetable *ft) {
     assert(ft != NULL);
-    int total = array_getnum(ft->filedescriptor);
-    int i = 0;
-    for (i = 0; i < ft_array_size(ft); i++) {
-        if (ft_get(ft, i) == NULL) {
-            total--;
-        }
-    }
-    return total;
+    return ft->size;
 }
 
 /*
@@ -152,77 +236,79 @@ int ft_size(struct filetable *ft) {
  * This gets the file descriptor from a file table and the given file descriptor id.
  */
 struct filedescriptor *ft_get(struct filetable *ft, int fti) {
-    if (fti < 0) {
-        return NULL;
-    }
-    //Since the stds are not attached to the thread, if the fd <=2 is requested,
-    //then we will attach the stds to the thread.
-    if (fti < 3) {
-        if (array_getguy(ft->filedescriptor, fti) == NULL) {
-            ft_attachstds(ft);
-        }
-    }
     //Doesn't exist.
-    if (fti >= ft_array_size(ft)) { //changed > to >= since there shouldn't be an element ARRAY_SIZE --Matt
+    if (fti < 0 || fti >= OPEN_MAX) {
         return NULL;
     }
-    struct filedescriptor *ret = array_getguy(ft->filedescriptor, fti);
-    return ret;
+    return ft->filedescriptor[fti];
 }
 
+/*
+ * ft_set()
+ * Puts the file descriptor at descriptor id fti, which must not be in use, and
+ * adds the table as an owner. Returns 0, or EBADF if fti is out of range.
+ */
 int ft_set(struct filetable* ft, struct filedescriptor* fd, int fti) {
-    if (fti >= ft_array_size(ft)) {
-        return 1;
-    }
-    array_setguy(ft->filedescriptor, fti, fd);
-    if (ft_get(ft, fti) == fd) {
-        return 1;
+    if (fti < 0 || fti >= OPEN_MAX) {
+        return EBADF;
     }
+    assert(ft->filedescriptor[fti] == NULL);
+    bitmap_mark(ft->fdmap, fti);
+    ft->filedescriptor[fti] = fd;
+    ft->size++;
+    fd_incref(fd);
     return 0;
 }
 
 /*
  * ft_add()
- * This adds the file descriptor to the file table, it does by checking if there
- * is a free file descriptor in the queue, if not, it will add to the end of the
- * array. This will recover and reuse closed file descriptor ids.
+ * This adds the file descriptor to the file table at the lowest free
+ * descriptor id and returns that id, or -1 if the table is full.
  */
 int ft_add(struct filetable* ft, struct filedescriptor* fd) {
-    int fdn = 0;
-    for (fdn = 0; fdn < ft_array_size(ft) && fdn < OPEN_MAX; fdn++) {
-        if (ft_get(ft, fdn) == NULL) {
-            array_setguy(ft->filedescriptor, fdn, fd);
-            return fdn;
-        }
-    }
-    if (fdn == OPEN_MAX) {
+    u_int32_t fdn;
+    if (bitmap_alloc(ft->fdmap, &fdn)) {
         return -1;
     }
-    if (array_add(ft->filedescriptor, fd) != 0) { //if error (ENOMEM)
-        return -1;
+    //ft_set marks it again
+    bitmap_unmark(ft->fdmap, fdn);
+    ft_set(ft, fd, fdn);
+    if (fd->fdn < 0) {
+        fd->fdn = fdn;
     }
-    fd->numOwners++;
-    assert(fdn != 0);
     return fdn;
 }
 
+/*
+ * ft_copy()
+ * Gives dst the same file descriptors as src, at the same ids, as fork needs.
+ * Stops as soon as every open descriptor has been copied. dst must be empty.
+ */
+void ft_copy(struct filetable* src, struct filetable* dst) {
+    int fti;
+    int copied = 0;
+    assert(dst->size == 0);
+    for (fti = 0; copied < src->size; fti++) {
+        assert(fti < OPEN_MAX);
+        if (src->filedescriptor[fti] != NULL) {
+            ft_set(dst, src->filedescriptor[fti], fti);
+            copied++;
+        }
+    }
+}
+
 /*
  * ft_remove()
- * This removes the file descriptor from the file table, it will add the file
- * descriptor id to the queue of availiable ids to use.
+ * This removes the file descriptor from the file table, freeing its id for
+ * reuse, and closes the file once no table refers to it any more.
  */
 int ft_remove(struct filetable* ft, int fti) {
     struct filedescriptor * fd = ft_get(ft, fti);
     if (fd != NULL) {
-        //  q_addtail(ft->nextfiledescriptor, (void *) fd->fdn);
-        int spl = splhigh();
-        fd->numOwners--;
-        if (fd->numOwners == 0) {
-            vfs_close(fd->fdvnode);
-            kfree(fd);
-        }
-        splx(spl);
-        array_setguy(ft->filedescriptor, fti, NULL);
+        ft->filedescriptor[fti] = NULL;
+        bitmap_unmark(ft->fdmap, fti);
+        ft->size--;
+        fd_decref(fd);
     }
     return 1;
 }
@@ -230,14 +316,15 @@ int ft_remove(struct filetable* ft, int fti) {
 /*
  * ft_destroy()
  * This will close and destroy all file descriptors in the file table. Should
- * only be called when the thread is exiting. In theory there shouldn't be
- * anything in here, except the stds, if they are attached to the thread.
+ * only be called when the thread is exiting.
  */
 int ft_destroy(struct filetable* ft) {
     int i;
-    for (i = ft_array_size(ft) - 1; i >= 0; i--) {
+    for (i = 0; ft->size > 0; i++) {
+        assert(i < OPEN_MAX);
         ft_remove(ft, i);
     }
+    bitmap_destroy(ft->fdmap);
     kfree(ft);
     return 1;
 }
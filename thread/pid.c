@@ -1,6 +1,9 @@
 /*
-This file contains the methods used for assigning process IDs to new threads and
-freeing these IDs for re-use when the thread exits. These operations are atomic.
+This file contains the process table. Every PID has a fixed slot holding what
+has to outlive the thread itself: its exit code, its parent, and its place in
+its parent's list of children. Free slots are tracked with a bitmap, so fork,
+exit and waitpid never allocate memory and never search a list.
+These operations are atomic; they are serialized by pid_lock.
 */
 
 #include "opt-A2.h"
@@ -8,148 +11,262 @@ freeing these IDs for re-use when the thread exits. These operations are atomic.
 
 #include <types.h>
 #include <lib.h>
-#include <types.h>
+#include <bitmap.h>
 #include <pid.h>
+#include <thread.h>
+#include <spinlock.h>
 #include <machine/spl.h>
+#include <kern/unistd.h>
 
 #define PID_FREE   0 //the process can be recycled
 #define PID_PARENT 1 //the process has not exited, but the parent has exited
 #define PID_EXITED 2 //the process has exited, but the parent has not exited or waited on this pid
 #define PID_NEW    3 //neither the process nor its parent have exited
 
-struct pid_clist {
-    pid_t pid;
+#define PID_NONE   0 //"no process"; never a real pid since pids start at MIN_PID
+
+struct pid_slot {
     int status;
-    struct pid_clist *next;
+    int exit_code;       //valid once the process has exited
+    pid_t parent;        //PID_NONE if there never was one or it no longer cares
+    pid_t first_child;   //children whose exit we still care about, linked through
+    pid_t next_sibling;  //next_sibling/prev_sibling so unlinking one is O(1).
+    pid_t prev_sibling;  //Children that have exited are kept at the front.
 };
 
-struct pid_list {
-    pid_t pid;
-    struct pid_list *next;
-};
+/*
+A process's own slot is also its exit notification channel: a child that exits
+wakes its parent's slot, and waitpid sleeps on the caller's slot. Slots are
+kernel addresses private to the process, so this cannot collide with other
+sleep channels.
+*/
+
+static struct pid_slot pid_table[MAX_PID - MIN_PID];
+static struct bitmap *pid_map; //bit (pid - MIN_PID) is set while the pid is in use
+
+//protects the table and the bitmap. It is a spinlock, so nothing may sleep
+//while holding it
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
 
-unsigned int unused_pids = MIN_PID;
-struct pid_list *recycled_pids;
-struct pid_clist *unavailable_pids;
+#define PID_SLOT(x) (&pid_table[(x) - MIN_PID])
+
+static int pid_in_range(pid_t x) {
+    return (x >= MIN_PID && x < MAX_PID);
+}
+
+/*
+Set up the pid bitmap. Must be called before the first thread is created.
+*/
+void pid_bootstrap() {
+    pid_map = bitmap_create(MAX_PID - MIN_PID);
+    if (pid_map == NULL) {
+        panic("pid: Could not create pid bitmap\n");
+    }
+}
 
 /*
-Find a pid for a new process
+Find a pid for a new process. Returns -1 if the process table is full.
 */
 pid_t new_pid() {
-    int spl = splhigh();
-    if (recycled_pids == NULL) {
-        assert(unused_pids < 0x7FFFFFFF); //can't even happen with sys161's available memory
-        struct pid_clist *new_entry = kmalloc(sizeof(struct pid_clist));
-        new_entry->pid = unused_pids;
-        new_entry->status = PID_NEW;
-        new_entry->next = unavailable_pids;
-        unavailable_pids = new_entry;
-        unused_pids += 1;
-        splx(spl);
-        DEBUG(DB_PID, "A thread has been assigned PID #%d\n", unused_pids-1);
-        return (unused_pids - 1);
-    } else {
-        struct pid_list *first = recycled_pids;
-        recycled_pids = recycled_pids->next;
-        struct pid_clist *new_entry = kmalloc(sizeof(struct pid_clist));
-        new_entry->pid = first->pid;
-        new_entry->status = PID_NEW;
-        new_entry->next = unavailable_pids;
-        unavailable_pids = new_entry;
-        kfree(first);
-        splx(spl);
-        DEBUG(DB_PID, "A thread has been assigned PID #%d\n", (int) new_entry->pid);
-        return (new_entry->pid);
+    u_int32_t ix;
+    struct pid_slot *s;
+    spinlock_acquire(&pid_lock);
+    if (bitmap_alloc(pid_map, &ix)) {
+        spinlock_release(&pid_lock);
+        DEBUG(DB_PID, "Process table full\n");
+        return -1;
     }
+    s = &pid_table[ix];
+    s->status = PID_NEW;
+    s->exit_code = 0;
+    s->parent = PID_NONE;
+    s->first_child = PID_NONE;
+    s->next_sibling = PID_NONE;
+    s->prev_sibling = PID_NONE;
+    spinlock_release(&pid_lock);
+    DEBUG(DB_PID, "A thread has been assigned PID #%d\n", (int) (ix + MIN_PID));
+    return (pid_t) (ix + MIN_PID);
 }
 
-//"private" function
-void pid_change_status(pid_t x, int and_mask) {
-    int spl = splhigh();
+//"private" function; pid_lock must be held
+static void pid_change_status(pid_t x, int and_mask) {
+    struct pid_slot *s = PID_SLOT(x);
+    assert(spinlock_do_i_hold(&pid_lock));
+    assert(s->status != PID_FREE);
     DEBUG(DB_PID, "PID #%d: change status %d\n", (int) x, and_mask);
-    assert(unavailable_pids != NULL);
-    if (unavailable_pids->pid == x) {
-        unavailable_pids->status &= and_mask;
-        DEBUG(DB_PID, "PID #%d: new status is %d\n", (int) x, unavailable_pids->status);
-        if (unavailable_pids->status == PID_FREE) {
-            //add pid to recycled_pids list
-            struct pid_list *new_entry = kmalloc(sizeof(struct pid_list));
-            new_entry->pid = x;
-            new_entry->next = recycled_pids;
-            recycled_pids = new_entry;
-            //remove pid from unavailable_pids list
-            struct pid_clist *temp = unavailable_pids;
-            unavailable_pids = unavailable_pids->next;
-            kfree(temp);
-            DEBUG(DB_PID, "PID #%d: free for re-use\n", (int) x);
-        }
+    s->status &= and_mask;
+    DEBUG(DB_PID, "PID #%d: new status is %d\n", (int) x, s->status);
+    if (s->status == PID_FREE) {
+        assert(s->first_child == PID_NONE);
+        bitmap_unmark(pid_map, x - MIN_PID);
+        DEBUG(DB_PID, "PID #%d: free for re-use\n", (int) x);
+    }
+}
+
+//"private" function; pid_lock must be held. Puts X at the front of its parent's children
+static void pid_link_child(pid_t x) {
+    struct pid_slot *s = PID_SLOT(x);
+    struct pid_slot *p = PID_SLOT(s->parent);
+    assert(spinlock_do_i_hold(&pid_lock));
+    s->prev_sibling = PID_NONE;
+    s->next_sibling = p->first_child;
+    if (p->first_child != PID_NONE) {
+        PID_SLOT(p->first_child)->prev_sibling = x;
+    }
+    p->first_child = x;
+}
+
+//"private" function; pid_lock must be held. Takes X out of its parent's children
+static void pid_unlink_child(pid_t x) {
+    struct pid_slot *s = PID_SLOT(x);
+    assert(spinlock_do_i_hold(&pid_lock));
+    if (s->prev_sibling != PID_NONE) {
+        PID_SLOT(s->prev_sibling)->next_sibling = s->next_sibling;
     } else {
-        int found = 0;
-        struct pid_clist *p = unavailable_pids;
-        while (p->next != NULL) {
-            if (p->next->pid == x) {
-                found = 1;
-                p->next->status &= and_mask;
-                DEBUG(DB_PID, "PID #%d: new status is %d\n", (int) x, p->next->status);
-                if (p->next->status == PID_FREE) {
-                    //add pid to recycled_pids list
-                    struct pid_list *new_entry = kmalloc(sizeof(struct pid_list));
-                    new_entry->pid = x;
-                    new_entry->next = recycled_pids;
-                    recycled_pids = new_entry;
-                    //remove pid from unavailable_pids list
-                    struct pid_clist *temp = p->next;
-                    p->next = p->next->next;
-                    kfree(temp);
-                    DEBUG(DB_PID, "PID #%d: free for re-use\n", (int) x);
-                }
-            }
-            p = p->next;
-        }
-        assert(found);
+        assert(PID_SLOT(s->parent)->first_child == x);
+        PID_SLOT(s->parent)->first_child = s->next_sibling;
     }
-    splx(spl);
+    if (s->next_sibling != PID_NONE) {
+        PID_SLOT(s->next_sibling)->prev_sibling = s->prev_sibling;
+    }
+    s->next_sibling = PID_NONE;
+    s->prev_sibling = PID_NONE;
 }
 
 /*
-Changes a pid's status to indicate that process's parent has exited, so the pid
-does not need to be saved after the process exits. Frees the pid it if can be recycled
+Record that PARENT forked CHILD, so the parent can wait on it.
 */
-void pid_parent_done(pid_t x) {
-    pid_change_status(x, PID_PARENT);
+void pid_add_child(pid_t parent, pid_t child) {
+    struct pid_slot *c = PID_SLOT(child);
+    spinlock_acquire(&pid_lock);
+    assert(c->parent == PID_NONE);
+    c->parent = parent;
+    pid_link_child(child);
+    spinlock_release(&pid_lock);
 }
 
 /*
-Changes a pid's status to indicate that the process with that pid has closed,
-freeing it if it can be recycled
+Changes a pid's status to indicate that process's parent has exited or has
+collected its exit code, so the pid does not need to be saved after the
+process exits. Frees the pid if it can be recycled
 */
-void pid_process_exit(pid_t x) {
-    pid_change_status(x, PID_EXITED);
+void pid_parent_done(pid_t x) {
+    struct pid_slot *s = PID_SLOT(x);
+    spinlock_acquire(&pid_lock);
+    if (s->parent != PID_NONE) {
+        pid_unlink_child(x);
+        s->parent = PID_NONE;
+    }
+    pid_change_status(x, PID_PARENT);
+    spinlock_release(&pid_lock);
 }
 
 /*
-recycles the pid; used when a thread with no parent exits
+Records the exit code of the process with pid X, lets go of its children, and
+wakes its parent if the parent may be waiting. Frees the pid if nobody will
+collect the exit code.
 */
-void pid_free(pid_t x) {
-    pid_change_status(x, PID_FREE);
+void pid_process_exit(pid_t x, int exit_code) {
+    struct pid_slot *s = PID_SLOT(x);
+    pid_t c, next;
+    spinlock_acquire(&pid_lock);
+    s->exit_code = exit_code;
+    //our children's exit codes are of no interest to anyone any more
+    for (c = s->first_child; c != PID_NONE; c = next) {
+        next = PID_SLOT(c)->next_sibling;
+        PID_SLOT(c)->parent = PID_NONE;
+        PID_SLOT(c)->next_sibling = PID_NONE;
+        PID_SLOT(c)->prev_sibling = PID_NONE;
+        pid_change_status(c, PID_PARENT);
+    }
+    s->first_child = PID_NONE;
+    if (s->parent == PID_NONE) {
+        pid_change_status(x, PID_FREE);
+    } else {
+        pid_change_status(x, PID_EXITED);
+        //move to the front so waiting for any child finds us without a search
+        pid_unlink_child(x);
+        pid_link_child(x);
+        thread_wakeup(PID_SLOT(s->parent));
+    }
+    spinlock_release(&pid_lock);
 }
 
-
 /*
 checks weather or not a PID is in use. This is only used when an invalid PID
 is used in waitpid to determine weather we should give error EINVAL or ESRCH
 */
 int pid_claimed(pid_t x) {
+    int claimed;
+    if (!pid_in_range(x)) {
+        return 0;
+    }
+    spinlock_acquire(&pid_lock);
+    claimed = bitmap_isset(pid_map, x - MIN_PID);
+    spinlock_release(&pid_lock);
+    return claimed;
+}
+
+/*
+checks whether X is a child of PARENT that PARENT may still wait on
+*/
+int pid_is_child(pid_t parent, pid_t x) {
+    int result;
+    if (!pid_in_range(x)) {
+        return 0;
+    }
+    spinlock_acquire(&pid_lock);
+    result = bitmap_isset(pid_map, x - MIN_PID) && PID_SLOT(x)->parent == parent;
+    spinlock_release(&pid_lock);
+    return result;
+}
+
+/*
+Waits for a child of PARENT to exit: the child with pid X, or any child if X is
+-1. Stores its exit code in *EXIT_CODE, releases its pid and returns it.
+With WNOHANG in OPTIONS, returns 0 instead of sleeping if no such child has
+exited yet. Returns -1 if X is -1 and PARENT has no children left to wait for.
+If X is not -1 it must be a child of PARENT.
+*/
+pid_t pid_wait(pid_t parent, pid_t x, int options, int *exit_code) {
+    struct pid_slot *p = PID_SLOT(parent);
+    pid_t found;
+    //interrupts stay off from the check to the sleep so the wakeup can't be missed
     int spl = splhigh();
-    struct pid_clist *p;
-    for (p = unavailable_pids; p != NULL; p = p->next) {
-        if (p->pid == x) {
-            splx(spl);
-            return 1;
+    spinlock_acquire(&pid_lock);
+    while (1) {
+        if (x == -1) {
+            //exited children are always at the front
+            found = p->first_child;
+            if (found == PID_NONE) {
+                found = -1;
+                break;
+            }
+        } else {
+            assert(PID_SLOT(x)->parent == parent);
+            found = x;
+        }
+        if (PID_SLOT(found)->status == PID_EXITED) {
+            break;
+        }
+        if (options & WNOHANG) {
+            found = 0;
+            break;
         }
+        spinlock_release(&pid_lock);
+        thread_sleep(p); //our exiting children wake our slot
+        spinlock_acquire(&pid_lock);
     }
+    if (found > 0) {
+        *exit_code = PID_SLOT(found)->exit_code;
+    }
+    spinlock_release(&pid_lock);
     splx(spl);
-    return 0;
+
+    if (found > 0) {
+        pid_parent_done(found);
+    }
+    return found;
 }
 
 #endif
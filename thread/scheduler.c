@@ -1,8 +1,8 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Round-robin over per-CPU run queues. A CPU whose own queue is empty
+ * steals from the busiest of its siblings before going idle.
  */
 
 #include <types.h>
@@ -10,14 +10,107 @@
 #include <scheduler.h>
 #include <thread.h>
 #include <machine/spl.h>
-#include <queue.h>
+#include <spinlock.h>
+#include <cpu.h>
 
 /*
  *  Scheduler data
+ *
+ * Each CPU has its own run queue in its struct cpu, linked through
+ * t_runnext and protected by c_runqueue_lock. Because the queue lives
+ * in the thread structures themselves, putting a thread on it never
+ * needs memory.
+ */
+
+/*
+ * Append T to C's run queue. C's run queue lock must be held.
  */
+static
+void
+runqueue_addtail(struct cpu *c, struct thread *t)
+{
+	assert(spinlock_do_i_hold(&c->c_runqueue_lock));
+	t->t_runnext = NULL;
+	if (c->c_runqueue_tail == NULL) {
+		c->c_runqueue_head = t;
+	}
+	else {
+		c->c_runqueue_tail->t_runnext = t;
+	}
+	c->c_runqueue_tail = t;
+	c->c_runqueue_count++;
+}
+
+/*
+ * Take the first thread off C's run queue, or return NULL if it is
+ * empty. C's run queue lock must be held.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
 
-// Queue of runnable threads
-static struct queue *runqueue;
+	assert(spinlock_do_i_hold(&c->c_runqueue_lock));
+	t = c->c_runqueue_head;
+	if (t != NULL) {
+		c->c_runqueue_head = t->t_runnext;
+		if (c->c_runqueue_head == NULL) {
+			c->c_runqueue_tail = NULL;
+		}
+		t->t_runnext = NULL;
+		c->c_runqueue_count--;
+	}
+	return t;
+}
+
+/*
+ * Called by an idle CPU C: take the longest-waiting thread from the
+ * sibling with the most runnable threads, and move it over to C.
+ * Returns NULL if every other run queue is empty.
+ *
+ * C's own run queue lock must not be held, so two idle CPUs stealing
+ * from each other never hold both locks at once. The queue lengths
+ * are read unlocked to pick a victim; that is only a hint, and the
+ * victim's queue is checked again under its lock.
+ */
+static
+struct thread *
+scheduler_steal(struct cpu *c)
+{
+	struct cpu *victim = NULL;
+	struct thread *t;
+	unsigned i;
+
+	assert(!spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (i=0; i<ncpus; i++) {
+		if (&allcpus[i] == c || allcpus[i].c_runqueue_count == 0) {
+			continue;
+		}
+		if (victim == NULL ||
+		    allcpus[i].c_runqueue_count > victim->c_runqueue_count) {
+			victim = &allcpus[i];
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = runqueue_remhead(victim);
+	if (t != NULL) {
+		victim->c_stolen_out++;
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	if (t != NULL) {
+		/* It stays with us from now on. */
+		t->t_cpu = c;
+		c->c_stolen_in++;
+	}
+	return t;
+}
 
 /*
  * Setup function
@@ -25,24 +118,26 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
-		panic("scheduler: Could not create run queue\n");
+	unsigned i;
+
+	for (i=0; i<ncpus; i++) {
+		assert(allcpus[i].c_runqueue_head == NULL);
+		assert(allcpus[i].c_runqueue_count == 0);
 	}
 }
 
 /*
  * Ensure space for handling at least NTHREADS threads.
  * This is done only to ensure that make_runnable() does not fail -
- * if you change the scheduler to not require space outside the 
- * thread structure, for instance, this function can reasonably
- * do nothing.
+ * the run queues are linked through the thread structures, so there
+ * is nothing to allocate and this does nothing.
  */
 int
 scheduler_preallocate(int nthreads)
 {
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+	(void)nthreads;
+	return 0;
 }
 
 /*
@@ -54,28 +149,37 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	unsigned i;
+	struct thread *t;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
-		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+	for (i=0; i<ncpus; i++) {
+		spinlock_acquire(&allcpus[i].c_runqueue_lock);
+		while ((t = runqueue_remhead(&allcpus[i])) != NULL) {
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
+		spinlock_release(&allcpus[i].c_runqueue_lock);
 	}
 }
 
 /*
  * Cleanup function.
  *
- * The queue objects to being destroyed if it's got stuff in it.
- * Use scheduler_killall to make sure this is the case. During
- * ordinary shutdown, normally it should be.
+ * Use scheduler_killall to make sure the run queues are empty.
+ * During ordinary shutdown, normally they should be.
  */
 void
 scheduler_shutdown(void)
 {
+	unsigned i;
+
 	scheduler_killall();
 
 	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+	for (i=0; i<ncpus; i++) {
+		assert(allcpus[i].c_runqueue_head == NULL);
+		spinlock_cleanup(&allcpus[i].c_runqueue_lock);
+	}
 }
 
 /*
@@ -87,10 +191,26 @@ scheduler_shutdown(void)
 struct thread *
 scheduler(void)
 {
+	struct cpu *c = curcpu;
+	struct thread *t;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	while (q_empty(runqueue)) {
+	while (1) {
+		spinlock_acquire(&c->c_runqueue_lock);
+		t = runqueue_remhead(c);
+		spinlock_release(&c->c_runqueue_lock);
+		if (t != NULL) {
+			break;
+		}
+
+		t = scheduler_steal(c);
+		if (t != NULL) {
+			break;
+		}
+
+		/* Never idle holding a lock; interrupts must get in. */
 		cpu_idle();
 	}
 
@@ -101,40 +221,70 @@ scheduler(void)
 	// 
 	//print_run_queue();
 	
-	return q_remhead(runqueue);
+	return t;
 }
 
 /* 
  * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ * Add it to the end of the run queue of the CPU it last ran on, so it
+ * finds its cache warm there. New threads start on their creator's CPU.
  */
 int
 make_runnable(struct thread *t)
 {
+	struct cpu *c = t->t_cpu;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 
-	return q_addtail(runqueue, t);
+	if (c == NULL) {
+		c = curcpu;
+		t->t_cpu = c;
+	}
+
+	spinlock_acquire(&c->c_runqueue_lock);
+	runqueue_addtail(c, t);
+	spinlock_release(&c->c_runqueue_lock);
+	return 0;
 }
 
 /*
- * Debugging function to dump the run queue.
+ * Debugging function to dump the run queues.
  */
 void
 print_run_queue(void)
 {
-	/* Turn interrupts off so the whole list prints atomically. */
-	int spl = splhigh();
+	unsigned i;
+	int k;
+	struct thread *t;
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
-		k++;
+	for (i=0; i<ncpus; i++) {
+		/* Hold the lock so the whole list prints atomically. */
+		spinlock_acquire(&allcpus[i].c_runqueue_lock);
+		k = 0;
+		for (t = allcpus[i].c_runqueue_head; t != NULL; t = t->t_runnext) {
+			kprintf("  cpu%u %2d: %s %p\n", i, k, t->t_name,
+				t->t_sleepaddr);
+			k++;
+		}
+		spinlock_release(&allcpus[i].c_runqueue_lock);
+	}
+}
+
+/*
+ * Print per-CPU run queue lengths and how many threads have moved
+ * between CPUs by work stealing.
+ */
+void
+scheduler_printstats(void)
+{
+	unsigned i;
+
+	kprintf("Scheduler statistics (%u cpu%s):\n", ncpus,
+		ncpus == 1 ? "" : "s");
+	for (i=0; i<ncpus; i++) {
+		kprintf("  cpu%u: %d runnable, %u stolen in, %u stolen out\n",
+			i, allcpus[i].c_runqueue_count,
+			allcpus[i].c_stolen_in, allcpus[i].c_stolen_out);
 	}
-	
-	splx(spl);
 }
@@ -0,0 +1,97 @@
+/*
+ * Spinlocks. See spinlock.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <machine/spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+
+/*
+ * Set the lock word and return what it was before.
+ *
+ * The r2000/r3000 has no ll/sc, but this is only ever called with
+ * interrupts off on a uniprocessor, where a plain load and store
+ * cannot be interleaved with anything else. A multiprocessor port
+ * replaces this with an ll/sc loop.
+ */
+static
+u_int32_t
+spinlock_testandset(volatile u_int32_t *word)
+{
+	u_int32_t old;
+
+	assert(curspl>0);
+	old = *word;
+	*word = 1;
+	return old;
+}
+
+void
+spinlock_init(struct spinlock *lk)
+{
+	lk->splk_lock = 0;
+	lk->splk_holder = NULL;
+}
+
+void
+spinlock_cleanup(struct spinlock *lk)
+{
+	assert(lk->splk_holder == NULL);
+	assert(lk->splk_lock == 0);
+}
+
+void
+spinlock_acquire(struct spinlock *lk)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu;
+
+	if (lk->splk_holder == c) {
+		panic("Deadlock on spinlock %p\n", lk);
+	}
+
+	/*
+	 * Spin reading first, so a multiprocessor would only write the
+	 * lock word once it looks free.
+	 */
+	while (1) {
+		if (lk->splk_lock != 0) {
+			continue;
+		}
+		if (spinlock_testandset(&lk->splk_lock) == 0) {
+			break;
+		}
+	}
+	lk->splk_holder = c;
+
+	if (c->c_spinlocks++ == 0) {
+		c->c_spinlock_spl = spl;
+	}
+}
+
+void
+spinlock_release(struct spinlock *lk)
+{
+	struct cpu *c = curcpu;
+
+	assert(lk->splk_holder == c);
+	assert(c->c_spinlocks > 0);
+
+	lk->splk_holder = NULL;
+	lk->splk_lock = 0;
+
+	if (--c->c_spinlocks == 0) {
+		splx(c->c_spinlock_spl);
+	}
+}
+
+int
+spinlock_do_i_hold(struct spinlock *lk)
+{
+	return (lk->splk_holder == curcpu);
+}
@@ -229,29 +229,19 @@ cv_wait(struct cv *cv, struct lock *lock)
 {
 #if OPT_A1
 	int spl = splhigh(); //disable interrupts
-	struct wait_list *sleeper;
-	sleeper = kmalloc(sizeof(struct wait_list));
-	if (sleeper == NULL) {
-	    panic("Out of memory!");
-	}
-	sleeper->signal = 0;
-	sleeper->lock = lock;
-	sleeper->next = NULL;
-	//add new sleeper to list of waiting threads
+	//add ourselves to the end of the list of waiting threads
+	curthread->t_waitnext = NULL;
 	if (cv->first == NULL) {
-	    cv->first = sleeper;
+	    cv->first = curthread;
 	} else {
-	    cv->last->next = sleeper;
+	    cv->last->t_waitnext = curthread;
 	}
-	cv->last = sleeper;
+	cv->last = curthread;
 	
 	lock_release(lock); //release the lock
 	
-	while (sleeper->signal == 0) {
-	    thread_sleep(cv);
-	}
+	thread_block(); //only cv_signal/cv_broadcast can make us runnable again
 	
-	kfree(sleeper); //safe, since when cv_signal sets the signal value to 1, cv->first no longer points to it
 	lock_acquire(lock); //re-aquire the lock
 	splx(spl); //re-enable interrupts
 #else
@@ -265,23 +255,16 @@ cv_signal(struct cv *cv, struct lock *lock)
 {
 #if OPT_A1
 	int spl = splhigh(); //disable interrupts
-	struct wait_list *p = cv->first;
-	struct wait_list *prev;
-	while (p != NULL) {
-	    if (p->lock == lock) {
-	        p->signal = 1; //set the next waiting thread to be woken up
-	        if (p == cv->first) {
-	            cv->first = cv->first->next; //move the rest of the threads up in line
-	        } else {
-	            prev->next = p->next; //remove this link from the list
-	        }
-	        break;
-	    } else {
-	        prev = p;
-	        p = p->next;
+	struct thread *t = cv->first;
+	if (t != NULL) {
+	    cv->first = t->t_waitnext; //move the rest of the threads up in line
+	    if (cv->first == NULL) {
+	        cv->last = NULL;
 	    }
+	    t->t_waitnext = NULL;
+	    thread_unblock(t); //wake exactly the thread we dequeued
 	}
-	thread_wakeup(cv);
+	(void)lock;
 	splx(spl); //re-enable interrupts
 #else
     (void)cv;
@@ -294,24 +277,189 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 {
 #if OPT_A1
 	int spl = splhigh(); //disable interrupts
-	struct wait_list *p = cv->first;
-	struct wait_list *prev;
-	while (p != NULL) {
-	    if (p->lock == lock) {
-	        p->signal = 1; //set the next waiting thread to be woken up
-	        if (p == cv->first) {
-	            cv->first = cv->first->next; //move the rest of the threads up in line
-	        } else {
-	            prev->next = p->next; //remove this link from the list
-	        }
-	    }
-	    prev = p;
-	    p = p->next;
+	//detach the whole queue at once, then wake everyone that was on it
+	struct thread *t = cv->first;
+	cv->first = NULL;
+	cv->last = NULL;
+	while (t != NULL) {
+	    struct thread *next = t->t_waitnext;
+	    t->t_waitnext = NULL;
+	    thread_unblock(t);
+	    t = next;
 	}
-	thread_wakeup(cv);
+	(void)lock;
 	splx(spl); //re-enable interrupts
 #else
 	(void)cv;
 	(void)lock;
 #endif
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+//
+// Readers sleep on &rw->readers, writers sleep on rw itself and a reader
+// waiting to upgrade sleeps on &rw->upgrading, so a release only wakes
+// the threads that can actually make progress.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->name = kstrdup(name);
+	if (rw->name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+#if OPT_A1
+	rw->writer = NULL;
+	rw->readers = 0;
+	rw->waiting_writers = 0;
+	rw->upgrading = 0;
+#endif
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	assert(rw != NULL);
+#if OPT_A1
+    //nobody may hold or be waiting for the lock when it is destroyed
+    assert(rw->writer == NULL);
+    assert(rw->readers == 0);
+    assert(rw->waiting_writers == 0);
+#endif
+
+	kfree(rw->name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+#if OPT_A1
+    assert(rw != NULL);
+    assert(in_interrupt == 0);
+    int spl = splhigh(); //disable interrupts
+    assert(rw->writer != curthread); //would deadlock against ourselves
+    //writer preference: stay out while anyone is writing or waiting to
+    while (rw->writer != NULL || rw->waiting_writers > 0 || rw->upgrading) {
+        thread_sleep((void *)&rw->readers);
+    }
+    rw->readers++;
+    splx(spl); //re-enable interrupts
+#else
+    (void)rw;
+#endif
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+#if OPT_A1
+    assert(rw != NULL);
+    int spl = splhigh();
+    assert(rw->readers > 0);
+    assert(rw->writer == NULL);
+    rw->readers--;
+    if (rw->upgrading && rw->readers == 1) {
+        thread_wakeup((void *)&rw->upgrading); //only the upgrading reader is left
+    } else if (rw->readers == 0 && rw->waiting_writers > 0) {
+        thread_wakeup(rw);
+    }
+    splx(spl);
+#else
+    (void)rw;
+#endif
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+#if OPT_A1
+    assert(rw != NULL);
+    assert(in_interrupt == 0);
+    int spl = splhigh(); //disable interrupts
+    assert(rw->writer != curthread);
+    rw->waiting_writers++;
+    while (rw->writer != NULL || rw->readers > 0 || rw->upgrading) {
+        thread_sleep(rw);
+    }
+    rw->waiting_writers--;
+    rw->writer = curthread;
+    splx(spl); //re-enable interrupts
+#else
+    (void)rw;
+#endif
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+#if OPT_A1
+    assert(rw != NULL);
+    int spl = splhigh();
+    assert(rw->writer == curthread);
+    rw->writer = NULL;
+    if (rw->waiting_writers > 0) {
+        thread_wakeup(rw); //readers keep waiting until the writers are done
+    } else {
+        thread_wakeup((void *)&rw->readers);
+    }
+    splx(spl);
+#else
+    (void)rw;
+#endif
+}
+
+int
+rwlock_upgrade(struct rwlock *rw)
+{
+#if OPT_A1
+    assert(rw != NULL);
+    assert(in_interrupt == 0);
+    int spl = splhigh();
+    assert(rw->readers > 0);
+    assert(rw->writer == NULL);
+    if (rw->upgrading) {
+        //two readers waiting for each other to leave would never wake up
+        splx(spl);
+        return 0;
+    }
+    //new readers and writers both stay out while we wait for the others
+    rw->upgrading = 1;
+    while (rw->readers > 1) {
+        thread_sleep((void *)&rw->upgrading);
+    }
+    rw->upgrading = 0;
+    rw->readers = 0;
+    rw->writer = curthread;
+    splx(spl);
+    return 1;
+#else
+    (void)rw;
+    return 1;
+#endif
+}
+
+int
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+#if OPT_A1
+    assert(rw != NULL);
+    return (rw->writer == curthread);
+#else
+    (void)rw;
+    return 1;
+#endif
+}
@@ -10,6 +10,7 @@
 #include <thread.h>
 #include <curthread.h>
 #include <scheduler.h>
+#include <cpu.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <filetable.h>
@@ -19,13 +20,13 @@
 
 #if OPT_A2
 #include <pid.h>
-#include <child_table.h>
 #endif
 /* States a thread can be in. */
 typedef enum {
 	S_RUN,
 	S_READY,
 	S_SLEEP,
+	S_BLOCK,
 	S_ZOMB,
 } threadstate_t;
 
@@ -62,6 +63,10 @@ thread_create(const char *name)
 	}
 	thread->t_sleepaddr = NULL;
 	thread->t_stack = NULL;
+	thread->t_waitnext = NULL;
+	thread->t_runnext = NULL;
+	/* Start out on the creating thread's CPU (the parent's, for fork). */
+	thread->t_cpu = curcpu;
 	
 	thread->t_vmspace = NULL;
 
@@ -69,8 +74,11 @@ thread_create(const char *name)
 	
 	#if OPT_A2
 	  thread->pid = new_pid();
-	  thread->parent = NULL;
-	  thread->children = NULL;
+	  if (thread->pid < 0) { //process table is full
+	      kfree(thread->t_name);
+	      kfree(thread);
+	      return NULL;
+	  }
 	  thread->exit_status = -1; //will be changed if _exit() is called
 	#endif
 	
@@ -107,37 +115,13 @@ thread_destroy(struct thread *thread)
 	}
 	
 	#if OPT_A2
-	struct child_table *p;
-	for (p = thread->children; p != NULL;) {
-	    struct child_table *temp = p;
-	    pid_parent_done(p->pid);
-	    p = p->next;
-	    kfree(temp);
-	}
-	int pid_update_success = 0;
-	int spl = splhigh();
-	if (thread->parent != NULL) {
-        for (p = thread->parent->children; p != NULL;) {
-            if (p->pid == thread->pid) {
-                pid_update_success = 1;
-                p->finished = 1;
-                p->exit_code = thread->exit_status;
-                p = NULL; //won't let me use break in a for loop, so I'll do this instead
-            } else {
-                p = p->next;
-            }
-        }
-        assert(pid_update_success);
-        pid_process_exit(thread->pid);
-	} else {
-	    pid_free(thread->pid);
-	}
-	splx(spl);
+	//record the exit code for the parent (and wake it) or free the pid
+	pid_process_exit(thread->pid, thread->exit_status);
 	
-	assert(thread->ft != NULL);
-	ft_destroy(thread->ft);
-	
-	thread_wakeup((void *) thread->pid);
+	//normally closed in thread_exit; still here if the thread never ran
+	if (thread->ft != NULL) {
+	    ft_destroy(thread->ft);
+	}
 	
 	#endif
 
@@ -261,6 +245,9 @@ thread_bootstrap(void)
 	struct thread *me;
 
 	/* Create the data structures we need. */
+#if OPT_A2
+	pid_bootstrap();
+#endif
 	sleepers = array_create();
 	if (sleepers==NULL) {
 		panic("Cannot create sleepers array\n");
@@ -434,6 +421,9 @@ mi_switch(threadstate_t nextstate)
 	/* Interrupts should already be off. */
 	assert(curspl>0);
 
+	/* Sleeping or yielding with a spinlock held would hang the CPU. */
+	assert(curcpu->c_spinlocks==0);
+
 	if (curthread != NULL && curthread->t_stack != NULL) {
 		/*
 		 * Check the magic number we put on the bottom end of
@@ -474,6 +464,13 @@ mi_switch(threadstate_t nextstate)
 		 */
 		result = array_add(sleepers, cur);
 	}
+	else if (nextstate==S_BLOCK) {
+		/*
+		 * Whoever blocked us has already queued us on their own
+		 * wait queue, so there is nothing to stash.
+		 */
+		result = 0;
+	}
 	else {
 		assert(nextstate==S_ZOMB);
 		result = array_add(zombies, cur);
@@ -536,6 +533,18 @@ thread_exit(void)
 		assert(curthread->t_stack[3] == (char)0x33);
 	}
 
+	#if OPT_A2
+	/*
+	 * Close our files here, in our own context, rather than in
+	 * thread_destroy: closing may have to wait for an open file's
+	 * lock, and exorcise must not sleep.
+	 */
+	if (curthread->ft != NULL) {
+	    ft_destroy(curthread->ft);
+	    curthread->ft = NULL;
+	}
+	#endif
+
 	splhigh();
 
 	if (curthread->t_vmspace) {
@@ -631,6 +640,41 @@ thread_wakeup(const void *addr)
 	}
 }
 
+/*
+ * Go to sleep without a sleep address. The caller must have put
+ * curthread on some wait queue of its own first, or it will never be
+ * woken up. Same restrictions as thread_sleep.
+ */
+void
+thread_block(void)
+{
+	// may not sleep in an interrupt handler
+	assert(in_interrupt==0);
+	assert(curspl>0);
+
+	mi_switch(S_BLOCK);
+}
+
+/*
+ * Wake up exactly the thread T, which went to sleep in thread_block.
+ */
+void
+thread_unblock(struct thread *t)
+{
+	int result;
+
+	// meant to be called with interrupts off
+	assert(curspl>0);
+	assert(t->t_sleepaddr == NULL);
+
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	result = make_runnable(t);
+	assert(result==0);
+}
+
 /*
  * Return nonzero if there are any threads who are sleeping on "sleep address"
  * ADDR. This is meant to be used only for diagnostic purposes.
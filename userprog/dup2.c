@@ -0,0 +1,65 @@
+/*
+Name
+dup2 - clone file handles
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+int
+dup2(int oldfd, int newfd);
+
+Description
+dup2 clones the file handle oldfd onto the file handle newfd. If newfd names an
+already-open file, that file is closed.
+
+The two handles refer to the same "open" of the file - that is, they are
+references to the same object and share the same seek pointer. Note that this
+is different from opening the same file twice.
+
+dup2 is commonly used to implement shell redirections.
+
+Using dup2 to clone a file handle onto itself has no effect.
+
+Return Values
+dup2 returns newfd. On error, -1 is returned, and errno is set according to the
+error encountered.
+
+Errors
+The following error codes should be returned under the conditions given. Other
+error codes may be returned for other errors not mentioned here.
+
+
+    EBADF 	oldfd is not a valid file handle, or newfd is a value that cannot
+                be a valid file handle.
+    EMFILE 	The process's file table was full, or a process-specific limit on
+                open files was reached.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <lib.h>
+#include <filetable.h>
+#include <curthread.h>
+#include <thread.h>
+
+int sys_dup2(int *retval, int oldfd, int newfd) {
+    struct filedescriptor *fd = ft_get(curthread->ft, oldfd);
+    if (fd == NULL || newfd < 0 || newfd >= OPEN_MAX) {
+        return EBADF;
+    }
+    if (oldfd != newfd) {
+        //newfd now refers to oldfd's open file, so close whatever it had
+        ft_remove(curthread->ft, newfd);
+        ft_set(curthread->ft, fd, newfd);
+    }
+    *retval = newfd;
+    return 0;
+}
+
+#endif /* OPT_A2 */
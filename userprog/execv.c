@@ -45,10 +45,11 @@ Errors
 
 #include "opt-A2.h"
 #include "opt-A3.h"
-#if OPT_A3
+#if OPT_A2
 #include <types.h>
 #include <kern/unistd.h>
 #include <kern/errno.h>
+#include <kern/limits.h>
 #include <lib.h>
 #include <addrspace.h>
 #include <thread.h>
@@ -57,57 +58,142 @@ Errors
 #include <vfs.h>
 #include <test.h>
 
-int sys_execv(char *progname, char ** args) {
-    DEBUG(DB_EXEC, "EXECV[%d] Entered EXECV - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, progname, (int) curthread->t_vmspace);
+/*
+ * The arguments for the new program are staged in one ARG_MAX buffer:
+ * the strings packed back to back, then the argv array, laid out exactly
+ * as they will sit at the top of the new user stack. That way the whole
+ * block goes out with a single copyout once the new address space is up.
+ *
+ * ARG_MAX covers the strings, their NULs and the argv pointers
+ * (including the terminating NULL), which is what E2BIG is about.
+ */
 
-    /* We should be a an existing thread. */
-    assert(curthread->t_vmspace != NULL);
+/*
+ * Copy the NULL-terminated user array ARGS, and the strings it points
+ * to, into BUF (ARG_MAX bytes). Sets *NARGS and *LEN, the number of bytes
+ * of strings (with their NULs) in BUF.
+ */
+static int copyin_args(char **args, char *buf, int *nargs, size_t *len) {
+    userptr_t arg;
+    size_t used = 0, got;
+    int n = 0, result;
+
+    while (1) {
+        result = copyin((const_userptr_t) (args + n), &arg, sizeof (arg));
+        if (result) {
+            return result;
+        }
+        if (arg == NULL) {
+            break;
+        }
+        //leave room for this arg's pointer and the terminating NULL
+        if (used + (n + 2) * sizeof (userptr_t) >= ARG_MAX) {
+            return E2BIG;
+        }
+        result = copyinstr((const_userptr_t) arg, buf + used,
+                ARG_MAX - used - (n + 2) * sizeof (userptr_t), &got);
+        if (result) {
+            return result == ENAMETOOLONG ? E2BIG : result;
+        }
+        if (got == 1) {
+            return EINVAL;
+        }
+        used += got;
+        n++;
+    }
 
-    //check the arguments are valid pointers
-    if (!(as_valid_read_addr(curthread->t_vmspace, (vaddr_t*) progname) && as_valid_read_addr(curthread->t_vmspace, (vaddr_t*) args))) {
-        return EFAULT;
+    if (ROUNDUP(used, sizeof (userptr_t)) + (n + 1) * sizeof (userptr_t) > ARG_MAX) {
+        return E2BIG;
     }
-    if (strlen(progname) < 1) {
-        return EINVAL;
+    *nargs = n;
+    *len = used;
+    return 0;
+}
+
+/*
+ * Build the argv array after the strings in BUF and copy the lot to the
+ * top of the user stack at *STACKPTR. Sets *STACKPTR to the new (8-byte
+ * aligned) stack pointer and *ARGV to the user address of argv.
+ */
+int copyout_args(char *buf, int nargs, size_t len, vaddr_t *stackptr, userptr_t *argv) {
+    size_t strsize = ROUNDUP(len, sizeof (userptr_t));
+    size_t total = strsize + (nargs + 1) * sizeof (userptr_t);
+    vaddr_t base = (*stackptr - total) & ~(vaddr_t) 7;
+    userptr_t *kargv = (userptr_t *) (buf + strsize);
+    size_t off = 0;
+    int i;
+
+    for (i = 0; i < nargs; i++) {
+        kargv[i] = (userptr_t) (base + off);
+        off += strlen(buf + off) + 1;
     }
+    kargv[nargs] = NULL;
 
-    /* We need to copy the programname and args into kernel space */
-    //first we need to calculate the size of the args
-    int nargs = 0;
-    int i = 0;
-    while (args[i] != NULL) {
-        nargs++;
-        i++;
+    *stackptr = base;
+    *argv = (userptr_t) (base + strsize);
+    return copyout(buf, (userptr_t) base, total);
+}
+
+/*
+ * Copy in the program name and arguments for execv or spawn. On success
+ * *KPROGNAME (PATH_MAX bytes) and *KARGS (ARG_MAX bytes) must be freed by
+ * the caller.
+ */
+int copyin_exec(char *progname, char **args, char **kprogname, char **kargs, int *nargs, size_t *len) {
+    int result;
+
+    *kprogname = kmalloc(PATH_MAX);
+    *kargs = kmalloc(ARG_MAX);
+    if (*kprogname == NULL || *kargs == NULL) {
+        result = ENOMEM;
+        goto fail;
     }
 
-    //check that we don't have too many arguments
-    if (nargs > 16) { //same as MAXMENUARGS from the menu
-        return E2BIG;
+    result = copyinstr((const_userptr_t) progname, *kprogname, PATH_MAX, NULL);
+    if (result) {
+        goto fail;
+    }
+    if (**kprogname == '\0') {
+        result = EINVAL;
+        goto fail;
     }
 
-    //allocate space for copied progname
-    char* kern_progname = kmalloc(sizeof (char) * (strlen(progname) + 1));
-    //copy the programname
-    copyinstr((const_userptr_t) progname, kern_progname, (strlen(progname) + 1), NULL);
+    result = copyin_args(args, *kargs, nargs, len);
+    if (result) {
+        goto fail;
+    }
+    return 0;
 
-    //allocate space for copied args array
-    char** kern_argumentPointer = kmalloc(sizeof (char*) * nargs);
-    //allocate the space for the argument strings and copy them into kernel memory
-    for (i = 0; i < nargs; i++) {
-        if (!as_valid_read_addr(curthread->t_vmspace, (vaddr_t*) args[i])) {
-            return EFAULT;
-        }
-        if (strlen(args[i]) < 1) {
-            return EINVAL;
-        }
-        int arg_size = strlen(args[i]);
-        kern_argumentPointer[i] = kmalloc(sizeof (char) * (arg_size + 1));
-        copyinstr((const_userptr_t) args[i], kern_argumentPointer[i], (arg_size + 1), NULL);
+fail:
+    if (*kprogname != NULL) {
+        kfree(*kprogname);
+    }
+    if (*kargs != NULL) {
+        kfree(*kargs);
     }
+    return result;
+}
+#endif /* OPT_A2 */
 
+#if OPT_A3
+int sys_execv(char *progname, char ** args) {
+    char *kern_progname, *kern_args;
+    int nargs;
+    size_t argslen;
     vaddr_t entrypoint, stackptr;
+    userptr_t argv;
     int result;
 
+    DEBUG(DB_EXEC, "EXECV[%d] Entered EXECV - Address space: [%d]\n", (int) curthread->pid, (int) curthread->t_vmspace);
+
+    /* We should be a an existing thread. */
+    assert(curthread->t_vmspace != NULL);
+
+    /* We need to copy the programname and args into kernel space */
+    result = copyin_exec(progname, args, &kern_progname, &kern_args, &nargs, &argslen);
+    if (result) {
+        return result;
+    }
 
     DEBUG(DB_EXEC, "EXECV[%d] Before AS_DESTROY - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
     /* Destory ourcurrent address space */
@@ -121,8 +207,8 @@ int sys_execv(char *progname, char ** args) {
     /* Create a new address space. */
     curthread->t_vmspace = as_create();
     if (curthread->t_vmspace == NULL) {
-
-        return ENOMEM;
+        result = ENOMEM;
+        goto done;
     }
 
     DEBUG(DB_EXEC, "EXECV[%d] After AS_CREATE - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
@@ -136,55 +222,30 @@ int sys_execv(char *progname, char ** args) {
     result = load_elf(kern_progname, &entrypoint);
     if (result) {
         /* thread_exit destroys curthread->t_vmspace */
-
-        return result;
+        goto done;
     }
     DEBUG(DB_EXEC, "EXECV[%d] After LOAD_ELF - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
 
-
-
     /* Define the user stack in the address space */
     result = as_define_stack(curthread->t_vmspace, &stackptr);
     if (result) {
         /* thread_exit destroys curthread->t_vmspace */
-        return result;
-    }
-
-    /* calculate the size of the stack frame for the main() function */
-    int stackFrameSize = 8; //minimum size for argc=0, argv[0]=NULL
-    for (i = 0; i < nargs; i++) {
-        stackFrameSize += strlen(kern_argumentPointer[i]) + 1 + 4; //add the length of each argument, plus the space for the pointer
-    }
-
-    /* Decide the stackpointer address */
-    stackptr -= stackFrameSize;
-    //decrement the stackptr until it is divisible by 8
-    for (; (stackptr % 8) > 0; stackptr--) {
+        goto done;
     }
 
-    /* copy the arguments to the proper location on the stack */
-    int argumentStringLocation = (int) stackptr + 4 + ((nargs + 1) * 4); //begining of where strings will be stored
-    copyout((void *) & nargs, (userptr_t) stackptr, (size_t) 4); //copy argc
-
-    for (i = 0; i < nargs; i++) {
-        copyout((void *) & argumentStringLocation, (userptr_t) (stackptr + 4 + (4 * i)), (size_t) 4); //copy address of string into argv[i+1]
-        copyoutstr(kern_argumentPointer[i], (userptr_t) argumentStringLocation, (size_t) strlen(kern_argumentPointer[i]), NULL); //copy the argument string
-        argumentStringLocation += strlen(kern_argumentPointer[i]) + 1; //update the location for the next iteration
-    }
-    int *nullValue = NULL;
-    copyout((void *) & nullValue, (userptr_t) (stackptr + 4 + (4 * i)), (size_t) 4); //copy null into last position of argv
+    /* copy the arguments to the top of the new stack */
+    result = copyout_args(kern_args, nargs, argslen, &stackptr, &argv);
 
+done:
     /* free up the memory we copied our arguments to in the kernel */
     kfree(kern_progname);
-
-    //free up each string in the arguments
-    for (i = 0; i < nargs; i++) {
-        kfree(kern_argumentPointer[i]);
+    kfree(kern_args);
+    if (result) {
+        return result;
     }
-    kfree(kern_argumentPointer);
 
     DEBUG(DB_EXEC, "EXECV[%d] Leaving EXECV (md_usermode) - nargs:[%d]\n", (int) curthread->pid, nargs);
-    md_usermode(nargs /*argc*/, (userptr_t) (stackptr + 4) /*userspace addr of argv*/, stackptr, entrypoint);
+    md_usermode(nargs /*argc*/, argv /*userspace addr of argv*/, stackptr, entrypoint);
 
     /* md_usermode does not return */
     panic("md_usermode returned\n");
@@ -192,77 +253,32 @@ int sys_execv(char *progname, char ** args) {
 }
 #else
 #if OPT_A2
-#include <types.h>
-#include <kern/unistd.h>
-#include <kern/errno.h>
-#include <lib.h>
-#include <addrspace.h>
-#include <thread.h>
-#include <curthread.h>
-#include <vm.h>
-#include <vfs.h>
-#include <test.h>
-
 int sys_execv(char *progname, char ** args) {
-    DEBUG(DB_EXEC, "EXECV[%d] Entered EXECV - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, progname, (int) curthread->t_vmspace);
+    char *kern_progname, *kern_args;
+    int nargs;
+    size_t argslen;
+    struct vnode *v;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv;
+    int result;
+
+    DEBUG(DB_EXEC, "EXECV[%d] Entered EXECV - Address space: [%d]\n", (int) curthread->pid, (int) curthread->t_vmspace);
 
     /* We should be a an existing thread. */
     assert(curthread->t_vmspace != NULL);
 
-    //check the arguments are valid pointers
-    if (!(as_valid_read_addr(curthread->t_vmspace, (vaddr_t*) progname) && as_valid_read_addr(curthread->t_vmspace, (vaddr_t*) args))) {
-        return EFAULT;
-    }
-    if (strlen(progname) < 1) {
-        return EINVAL;
-    }
-
     /* We need to copy the programname and args into kernel space */
-    //first we need to calculate the size of the args
-    int nargs = 0;
-    int i = 0;
-    while (args[i] != NULL) {
-        nargs++;
-        i++;
-    }
-
-    //check that we don't have too many arguments
-    if (nargs > 16) { //same as MAXMENUARGS from the menu
-        return E2BIG;
-    }
-
-    //allocate space for copied progname
-    char* kern_progname = kmalloc(sizeof (char) * (strlen(progname) + 1));
-    //copy the programname
-    copyinstr((const_userptr_t) progname, kern_progname, (strlen(progname) + 1), NULL);
-
-    //allocate space for copied args array
-    char** kern_argumentPointer = kmalloc(sizeof (char*) * nargs);
-    //allocate the space for the argument strings and copy them into kernel memory
-    for (i = 0; i < nargs; i++) {
-        if (!as_valid_read_addr(curthread->t_vmspace, (vaddr_t*) args[i])) {
-            return EFAULT;
-        }
-        if (strlen(args[i]) < 1) {
-            return EINVAL;
-        }
-        int arg_size = strlen(args[i]);
-        kern_argumentPointer[i] = kmalloc(sizeof (char) * (arg_size + 1));
-        copyinstr((const_userptr_t) args[i], kern_argumentPointer[i], (arg_size + 1), NULL);
+    result = copyin_exec(progname, args, &kern_progname, &kern_args, &nargs, &argslen);
+    if (result) {
+        return result;
     }
 
-    struct vnode *v;
-    vaddr_t entrypoint, stackptr;
-    int result;
-
     /* Open the file. */
     result = vfs_open(kern_progname, O_RDONLY, &v);
     if (result) {
-        return result;
+        goto done;
     }
 
-
-
     DEBUG(DB_EXEC, "EXECV[%d] Before AS_DESTROY - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
     /* Destory ourcurrent address space */
     as_destroy(curthread->t_vmspace);
@@ -276,7 +292,8 @@ int sys_execv(char *progname, char ** args) {
     curthread->t_vmspace = as_create();
     if (curthread->t_vmspace == NULL) {
         vfs_close(v);
-        return ENOMEM;
+        result = ENOMEM;
+        goto done;
     }
 
     DEBUG(DB_EXEC, "EXECV[%d] After AS_CREATE - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
@@ -288,59 +305,34 @@ int sys_execv(char *progname, char ** args) {
     DEBUG(DB_EXEC, "EXECV[%d] Before LOAD_ELF - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
     /* Load the executable. */
     result = load_elf(v, &entrypoint);
+    /* Done with the file now. */
+    vfs_close(v);
     if (result) {
         /* thread_exit destroys curthread->t_vmspace */
-        vfs_close(v);
-        return result;
+        goto done;
     }
     DEBUG(DB_EXEC, "EXECV[%d] After LOAD_ELF - progname: [%s] - Address space: [%d]\n", (int) curthread->pid, kern_progname, (int) curthread->t_vmspace);
 
-
-    /* Done with the file now. */
-    vfs_close(v);
-
     /* Define the user stack in the address space */
     result = as_define_stack(curthread->t_vmspace, &stackptr);
     if (result) {
         /* thread_exit destroys curthread->t_vmspace */
-        return result;
-    }
-
-    /* calculate the size of the stack frame for the main() function */
-    int stackFrameSize = 8; //minimum size for argc=0, argv[0]=NULL
-    for (i = 0; i < nargs; i++) {
-        stackFrameSize += strlen(kern_argumentPointer[i]) + 1 + 4; //add the length of each argument, plus the space for the pointer
-    }
-
-    /* Decide the stackpointer address */
-    stackptr -= stackFrameSize;
-    //decrement the stackptr until it is divisible by 8
-    for (; (stackptr % 8) > 0; stackptr--) {
+        goto done;
     }
 
-    /* copy the arguments to the proper location on the stack */
-    int argumentStringLocation = (int) stackptr + 4 + ((nargs + 1) * 4); //begining of where strings will be stored
-    copyout((void *) & nargs, (userptr_t) stackptr, (size_t) 4); //copy argc
-
-    for (i = 0; i < nargs; i++) {
-        copyout((void *) & argumentStringLocation, (userptr_t) (stackptr + 4 + (4 * i)), (size_t) 4); //copy address of string into argv[i+1]
-        copyoutstr(kern_argumentPointer[i], (userptr_t) argumentStringLocation, (size_t) strlen(kern_argumentPointer[i]), NULL); //copy the argument string
-        argumentStringLocation += strlen(kern_argumentPointer[i]) + 1; //update the location for the next iteration
-    }
-    int *nullValue = NULL;
-    copyout((void *) & nullValue, (userptr_t) (stackptr + 4 + (4 * i)), (size_t) 4); //copy null into last position of argv
+    /* copy the arguments to the top of the new stack */
+    result = copyout_args(kern_args, nargs, argslen, &stackptr, &argv);
 
+done:
     /* free up the memory we copied our arguments to in the kernel */
     kfree(kern_progname);
-
-    //free up each string in the arguments
-    for (i = 0; i < nargs; i++) {
-        kfree(kern_argumentPointer[i]);
+    kfree(kern_args);
+    if (result) {
+        return result;
     }
-    kfree(kern_argumentPointer);
 
     DEBUG(DB_EXEC, "EXECV[%d] Leaving EXECV (md_usermode) - nargs:[%d]\n", (int) curthread->pid, nargs);
-    md_usermode(nargs /*argc*/, (userptr_t) (stackptr + 4) /*userspace addr of argv*/, stackptr, entrypoint);
+    md_usermode(nargs /*argc*/, argv /*userspace addr of argv*/, stackptr, entrypoint);
 
     /* md_usermode does not return */
     panic("md_usermode returned\n");
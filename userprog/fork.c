@@ -8,7 +8,7 @@
 #include <curthread.h>
 #include <lib.h>
 #include <kern/errno.h>
-#include <child_table.h>
+#include <pid.h>
 #include <machine/pcb.h>
 #include <machine/spl.h>
 #include <machine/trapframe.h>
@@ -24,12 +24,6 @@ pid_t sys_fork(struct trapframe *tf) {
         return ENOMEM;
     }
     child_name = strcpy(child_name, curthread->t_name);
-    struct child_table *new_child = kmalloc(sizeof(struct child_table));
-    if (new_child == NULL) {
-        //error
-        splx(spl);
-        return ENOMEM;
-    }
     struct thread *child = NULL;
 
     void (*func_pt)(void *, unsigned long) = &md_forkentry;
@@ -37,19 +31,13 @@ pid_t sys_fork(struct trapframe *tf) {
     int result = thread_fork(strcat(child_name, "'s child"), tf, 0, func_pt, &child);
    
     if (result != 0) {
-        kfree(new_child);
         //ERROR
         splx(spl);
         return result;
     }  
     
-    child->parent = curthread;
-    //add new process to list of children
-    new_child->pid = child->pid;
-    new_child->finished = 0;
-    new_child->exit_code = -2; //not really needed
-    new_child->next = curthread->children;
-    curthread->children = new_child;
+    //add new process to our children in the process table
+    pid_add_child(curthread->pid, child->pid);
     
     //we don't need to copy t_sleepaddr because the thread can't be sleeping if it's calling fork()
     //we also don't need to copy t_cwd since it's already been coppied when thread_fork() was called
@@ -57,23 +45,13 @@ pid_t sys_fork(struct trapframe *tf) {
     if (err != 0) {
         DEBUG(DB_THREADS, "Not enough memory to copy address space in fork. Closing child...\n");
         child->t_vmspace = NULL;
-        child->parent = NULL; //to prevent thread_destroy from freeing a non-existant pid
+        pid_parent_done(child->pid); //nobody will wait for it, so its pid is freed when it exits
         md_initpcb(&child->t_pcb, child->t_stack, 0, 0, &thread_exit); //set new thread to delete itself
         splx(spl);
         return err;
     }
-    //now copy the file table
-    int j;
-    for (j = 0; j < ft_size(curthread->ft); j++) {
-        if (ft_add(child->ft, ft_get(curthread->ft, j)) == -1) {
-            DEBUG(DB_THREADS, "Not enough memory to copy file table in fork. Closing child...\n");
-            child->parent = NULL; //to prevent thread_destroy from freeing a non-existant pid
-            md_initpcb(&child->t_pcb, child->t_stack, 0, 0, &thread_exit); //set new thread to delete itself
-            splx(spl);
-            return ENOMEM;
-        }
-    }
-    
+    //now copy the file table; it has a fixed size, so this can't fail
+    ft_copy(curthread->ft, child->ft);
     
     int retval = child->pid;
     splx(spl);
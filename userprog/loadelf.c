@@ -25,6 +25,8 @@
 #include <kern/unistd.h>
 #include <vfs.h>
 #include <vmstats.h>
+#include <kern/stat.h>
+#include <spinlock.h>
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -55,6 +57,8 @@ int load_segment_page(struct vnode *v, vaddr_t vaddr, struct segment *s, paddr_t
 
     int read_size = 0;
 
+    u.uio_iov = &u.uio_iovec;
+    u.uio_iovcnt = 1;
     u.uio_iovec.iov_kbase = (void *) PADDR_TO_KVADDR(paddr);
     u.uio_iovec.iov_len = PAGE_SIZE; // length of the memory space
     u.uio_offset = vaddr - s->vbase + s->p_offset;
@@ -110,40 +114,176 @@ int load_segment_page(struct vnode *v, vaddr_t vaddr, struct segment *s, paddr_t
 }
 
 /*
- * Load an ELF executable user program into the current address space.
+ * What load_elf needs from an executable's headers: the entry point and
+ * the loadable segments.
+ */
+struct elf_info {
+    vaddr_t entry;
+    int nsegs;
+    struct {
+        vaddr_t vaddr;
+        size_t memsz;
+        int flags;
+        u_int32_t offset;
+        u_int32_t filesz;
+    } segs[AS_NUM_SEG - 1];
+};
+
+/*
+ * Cache of parsed headers, so running the same program again does no
+ * header I/O. Each entry holds a reference to its vnode, which stops the
+ * vnode (the key) from being reused for another file while it's cached.
+ * An entry also remembers the file's size and is only used while the size
+ * is unchanged; writes and truncation through the file table or a shared
+ * mapping drop it outright (see elf_cache_invalidate), and so do removing
+ * the file and unmounting its filesystem (elf_cache_purge), so the
+ * reference never keeps a file or a volume around. The least recently
+ * used entry is replaced first.
  *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * elf_cache_lock is never held across a VOP call.
  */
-int load_elf(char * progname, vaddr_t *entrypoint) {
-    
+#define ELF_CACHE_SIZE 4
+
+struct elf_cache_entry {
+    struct vnode *vn; //NULL if the entry is free
+    off_t size; //file size when the headers were read
+    unsigned lastuse; //elf_cache_clock at the last lookup
+    struct elf_info info;
+};
+
+static struct elf_cache_entry elf_cache[ELF_CACHE_SIZE];
+static unsigned elf_cache_clock;
+static struct spinlock elf_cache_lock = SPINLOCK_INITIALIZER;
+
+static int elf_cache_lookup(struct vnode *v, off_t size, struct elf_info *info) {
+    int i, found = 0;
+    spinlock_acquire(&elf_cache_lock);
+    for (i = 0; i < ELF_CACHE_SIZE; i++) {
+        if (elf_cache[i].vn == v && elf_cache[i].size == size) {
+            elf_cache[i].lastuse = ++elf_cache_clock;
+            *info = elf_cache[i].info;
+            found = 1;
+            break;
+        }
+    }
+    spinlock_release(&elf_cache_lock);
+    return found;
+}
+
+static void elf_cache_insert(struct vnode *v, off_t size, const struct elf_info *info) {
+    struct elf_cache_entry *e = NULL;
+    struct vnode *old;
+    int i;
+
+    VOP_INCREF(v);
+    spinlock_acquire(&elf_cache_lock);
+    //replace v's own stale entry if there is one, else a free one, else the oldest
+    for (i = 0; i < ELF_CACHE_SIZE; i++) {
+        if (elf_cache[i].vn == v) {
+            e = &elf_cache[i];
+            break;
+        }
+        if (e == NULL || (e->vn != NULL &&
+                (elf_cache[i].vn == NULL || elf_cache[i].lastuse < e->lastuse))) {
+            e = &elf_cache[i];
+        }
+    }
+    old = e->vn;
+    e->vn = v;
+    e->size = size;
+    e->lastuse = ++elf_cache_clock;
+    e->info = *info;
+    spinlock_release(&elf_cache_lock);
+
+    if (old != NULL) {
+        VOP_DECREF(old);
+    }
+}
+
+/*
+ * Forget the cached headers of a file that is about to change.
+ */
+void elf_cache_invalidate(struct vnode *v) {
+    int i, found = 0;
+    spinlock_acquire(&elf_cache_lock);
+    for (i = 0; i < ELF_CACHE_SIZE; i++) {
+        if (elf_cache[i].vn == v) {
+            elf_cache[i].vn = NULL;
+            found = 1;
+            break;
+        }
+    }
+    spinlock_release(&elf_cache_lock);
+
+    if (found) {
+        VOP_DECREF(v);
+    }
+}
+
+/*
+ * Forget the cached headers of every file in filesystem FS, before
+ * unmounting it.
+ */
+void elf_cache_purge(struct fs *fs) {
+    struct vnode *dead[ELF_CACHE_SIZE];
+    int i, n = 0;
+    spinlock_acquire(&elf_cache_lock);
+    for (i = 0; i < ELF_CACHE_SIZE; i++) {
+        if (elf_cache[i].vn != NULL && elf_cache[i].vn->vn_fs == fs) {
+            dead[n++] = elf_cache[i].vn;
+            elf_cache[i].vn = NULL;
+        }
+    }
+    spinlock_release(&elf_cache_lock);
+
+    for (i = 0; i < n; i++) {
+        VOP_DECREF(dead[i]);
+    }
+}
+
+/*
+ * How much of the file to read for the headers. The program headers
+ * normally follow the executable header directly, so this one read
+ * usually gets all of them.
+ */
+#define ELF_HEADER_READ 512
+
+/*
+ * Most program headers an executable may have. A few more than the
+ * segments we can load, to allow for the ones that are skipped.
+ */
+#define ELF_MAXPHDRS 32
+
+/*
+ * Read and check an executable's headers and fill in INFO.
+ */
+static int elf_read_info(struct vnode *v, struct elf_info *info) {
     Elf_Ehdr eh; /* Executable header */
     Elf_Phdr ph; /* "Program header" = segment header */
+    char *buf, *phdrs;
+    size_t got, phsize;
     int result, i;
     struct uio ku;
-    struct vnode *v;
 
-    /* Open the file. */
-    result = vfs_open(progname, O_RDONLY, &v);
-    if (result) {
-        return result;
+    buf = kmalloc(ELF_HEADER_READ);
+    if (buf == NULL) {
+        return ENOMEM;
     }
 
-    curthread->t_vmspace->file = v;
-    /*
-     * Read the executable header from offset 0 in the file.
-     */
-
-    mk_kuio(&ku, &eh, sizeof (eh), 0, UIO_READ);
+    mk_kuio(&ku, buf, ELF_HEADER_READ, 0, UIO_READ);
     result = VOP_READ(v, &ku);
     if (result) {
-        return result;
+        goto out;
     }
+    got = ELF_HEADER_READ - ku.uio_resid;
 
-    if (ku.uio_resid != 0) {
+    if (got < sizeof (eh)) {
         /* short read; problem with executable? */
         kprintf("ELF: short read on header - file truncated?\n");
-        return ENOEXEC;
+        result = ENOEXEC;
+        goto out;
     }
+    memcpy(&eh, buf, sizeof (eh));
 
     /*
      * Check to make sure it's a 32-bit ELF-version-1 executable
@@ -165,39 +305,57 @@ int load_elf(char * progname, vaddr_t *entrypoint) {
             eh.e_ident[EI_VERSION] != EV_CURRENT ||
             eh.e_version != EV_CURRENT ||
             eh.e_type != ET_EXEC ||
-            eh.e_machine != EM_MACHINE) {
-        return ENOEXEC;
+            eh.e_machine != EM_MACHINE ||
+            eh.e_phentsize != sizeof (ph) ||
+            eh.e_phnum > ELF_MAXPHDRS) {
+        result = ENOEXEC;
+        goto out;
     }
 
     /*
-     * Go through the list of segments and set up the address space.
+     * Get the whole program header table into memory: it's normally in
+     * what we already read, otherwise read it in one go.
+     */
+    phsize = eh.e_phnum * sizeof (ph);
+    if (eh.e_phoff <= got && phsize <= got - eh.e_phoff) {
+        phdrs = buf + eh.e_phoff;
+    } else {
+        kfree(buf);
+        buf = kmalloc(phsize);
+        if (buf == NULL) {
+            return ENOMEM;
+        }
+        mk_kuio(&ku, buf, phsize, eh.e_phoff, UIO_READ);
+        result = VOP_READ(v, &ku);
+        if (result) {
+            goto out;
+        }
+        if (ku.uio_resid != 0) {
+            /* short read; problem with executable? */
+            kprintf("ELF: short read on phdr - file truncated?\n");
+            result = ENOEXEC;
+            goto out;
+        }
+        phdrs = buf;
+    }
+
+    /*
+     * Go through the list of segments and note the loadable ones.
      *
      * Ordinarily there will be one code segment, one read-only
      * data segment, and one data/bss segment, but there might
      * conceivably be more. You don't need to support such files
      * if it's unduly awkward to do so.
      *
-     * Note that the expression eh.e_phoff + i*eh.e_phentsize is
-     * mandated by the ELF standard - we use sizeof(ph) to load,
-     * because that's the structure we know, but the file on disk
-     * might have a larger structure, so we must use e_phentsize
-     * to find where the phdr starts.
+     * The ELF standard lets e_phentsize be larger than the structure
+     * we know, but we insist on an exact match (checked above), so
+     * that the size of the table can't be made to overflow.
      */
 
+    info->entry = eh.e_entry;
+    info->nsegs = 0;
     for (i = 0; i < eh.e_phnum; i++) {
-        off_t offset = eh.e_phoff + i * eh.e_phentsize;
-        mk_kuio(&ku, &ph, sizeof (ph), offset, UIO_READ);
-
-        result = VOP_READ(v, &ku);
-        if (result) {
-            return result;
-        }
-
-        if (ku.uio_resid != 0) {
-            /* short read; problem with executable? */
-            kprintf("ELF: short read on phdr - file truncated?\n");
-            return ENOEXEC;
-        }
+        memcpy(&ph, phdrs + i * sizeof (ph), sizeof (ph));
 
         switch (ph.p_type) {
             case PT_NULL: /* skip */ continue;
@@ -206,21 +364,78 @@ int load_elf(char * progname, vaddr_t *entrypoint) {
             case PT_LOAD: break;
             default:
                 kprintf("loadelf: unknown segment type %d\n", ph.p_type);
-                return ENOEXEC;
+                result = ENOEXEC;
+                goto out;
         }
 
-        result = as_define_region(curthread->t_vmspace,
-                ph.p_vaddr, ph.p_memsz,
-                ph.p_flags, ph.p_offset, ph.p_filesz);
+        if (info->nsegs == AS_NUM_SEG - 1) {
+            kprintf("loadelf: Warning: too many regions\n");
+            result = EUNIMP;
+            goto out;
+        }
+        info->segs[info->nsegs].vaddr = ph.p_vaddr;
+        info->segs[info->nsegs].memsz = ph.p_memsz;
+        info->segs[info->nsegs].flags = ph.p_flags;
+        info->segs[info->nsegs].offset = ph.p_offset;
+        info->segs[info->nsegs].filesz = ph.p_filesz;
+        info->nsegs++;
+    }
+    result = 0;
 
+out:
+    kfree(buf);
+    return result;
+}
 
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int load_elf(char * progname, vaddr_t *entrypoint) {
+
+    struct elf_info info;
+    struct stat st;
+    int result, i;
+    struct vnode *v;
+
+    /* Open the file. */
+    result = vfs_open(progname, O_RDONLY, &v);
+    if (result) {
+        return result;
+    }
+
+    curthread->t_vmspace->file = v;
 
+    /*
+     * Get the headers, from the cache if this file's are there.
+     */
+    result = VOP_STAT(v, &st);
+    if (result) {
+        return result;
+    }
+
+    if (!elf_cache_lookup(v, st.st_size, &info)) {
+        result = elf_read_info(v, &info);
         if (result) {
             return result;
         }
+        elf_cache_insert(v, st.st_size, &info);
     }
 
-    *entrypoint = eh.e_entry;
+    /*
+     * Set up the address space.
+     */
+    for (i = 0; i < info.nsegs; i++) {
+        result = as_define_region(curthread->t_vmspace,
+                info.segs[i].vaddr, info.segs[i].memsz,
+                info.segs[i].flags, info.segs[i].offset, info.segs[i].filesz);
+        if (result) {
+            return result;
+        }
+    }
+
+    *entrypoint = info.entry;
 
     return 0;
 }
@@ -257,6 +472,8 @@ load_segment(struct vnode *v, off_t offset, vaddr_t vaddr,
     DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n",
             (unsigned long) filesize, (unsigned long) vaddr);
 
+    u.uio_iov = &u.uio_iovec;
+    u.uio_iovcnt = 1;
     u.uio_iovec.iov_ubase = (userptr_t) vaddr;
     u.uio_iovec.iov_len = memsize; // length of the memory space
     u.uio_resid = filesize; // amount to actually read
@@ -0,0 +1,98 @@
+/*
+Name
+lseek - change current position in file
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+off_t
+lseek(int fd, off_t pos, int whence);
+
+Description
+lseek alters the current seek position of the file handle fd, seeking to a new
+position based on pos and whence.
+
+If whence is
+    SEEK_SET, the new position is pos.
+    SEEK_CUR, the new position is the current position plus pos.
+    SEEK_END, the new position is the position of end-of-file plus pos.
+    anything else, lseek fails.
+
+Note that pos is a signed quantity.
+
+It is not meaningful to seek on certain objects (such as the console device).
+All seeks on these objects fail.
+
+Seek positions less than zero are invalid. Seek positions beyond EOF are legal.
+
+Return Values
+On success, lseek returns the new position. On error, -1 is returned, and
+errno is set according to the error encountered.
+
+Errors
+The following error codes should be returned under the conditions given. Other
+error codes may be returned for other errors not mentioned here.
+
+    EBADF 	fd is not a valid file handle.
+    ESPIPE 	fd refers to an object which does not support seeking.
+    EINVAL 	whence is invalid, or the resulting seek position would be
+                negative.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <filetable.h>
+#include <curthread.h>
+#include <thread.h>
+#include <vnode.h>
+#include <synch.h>
+
+int sys_lseek(int *retval, int fdn, off_t pos, int whence) {
+    struct stat st;
+    int result;
+    struct filedescriptor *fd = ft_get(curthread->ft, fdn);
+    if (fd == NULL) {
+        return EBADF;
+    }
+    //The seek position is shared with every fd referring to this open file
+    lock_acquire(fd->fdlock);
+    switch (whence) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            pos += fd->offset;
+            break;
+        case SEEK_END:
+            result = VOP_STAT(fd->fdvnode, &st);
+            if (result) {
+                lock_release(fd->fdlock);
+                return result;
+            }
+            pos += st.st_size;
+            break;
+        default:
+            lock_release(fd->fdlock);
+            return EINVAL;
+    }
+    //Let the file decide: this fails with ESPIPE on the console, and EINVAL
+    //on negative positions
+    result = VOP_TRYSEEK(fd->fdvnode, pos);
+    if (result) {
+        lock_release(fd->fdlock);
+        return result;
+    }
+    fd->offset = pos;
+    *retval = pos;
+    lock_release(fd->fdlock);
+    return 0;
+}
+
+#endif /* OPT_A2 */
@@ -0,0 +1,138 @@
+/*
+Name
+mmap, munmap, msync - map files or anonymous memory into the address space
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+void *
+mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+
+int
+munmap(void *addr, size_t len);
+
+int
+msync(void *addr, size_t len, int flags);
+
+Description
+mmap adds a region of len bytes to the address space and returns its address.
+The kernel chooses the address; addr is ignored. Unless flags includes
+MAP_ANON, the region shows the contents of the file fd from offset on, and
+bytes past the end of the file read as zero. Anonymous regions start out
+zero-filled. Nothing is read in when mmap is called: pages come in from the
+file as they are first touched.
+
+prot is PROT_READ, optionally or'ed with PROT_WRITE (and PROT_EXEC, which is
+accepted but not enforced). flags must include exactly one of MAP_SHARED and
+MAP_PRIVATE. Writes to a MAP_SHARED file region go back to the file on msync
+or munmap, and when the process exits; until then the written pages stay in
+memory, as eviction never writes to files. Writes to a MAP_PRIVATE region are
+never written back. A forked child gets its own copy of the pages of private
+regions. Shared regions are written back when the process
+forks, and the child's copy pages in from the file, so the two see each other's
+writes once they reach the file, as two processes mapping the same file do.
+
+A region stays in place after fd is closed.
+
+munmap removes a region. addr and len must match a region that mmap returned.
+
+msync writes back the modified pages of shared regions in the given range.
+flags is ignored: the write back is always synchronous.
+
+Return Values
+mmap returns the address of the region. munmap and msync return 0. On error,
+-1 (MAP_FAILED for mmap) is returned, and errno is set according to the error
+encountered.
+
+Errors
+    EBADF 	fd is not a valid file handle, or was not opened for reading, or
+                MAP_SHARED and PROT_WRITE were asked for on an fd that was not
+                opened for reading and writing.
+    ENODEV 	fd does not refer to a regular file.
+    EINVAL 	len is 0, offset is not page-aligned, flags is invalid, or (for
+                munmap) addr and len do not match a region.
+    ENOMEM 	There is no room in the address space, or the process has too
+                many regions, or (for msync) part of the range is not mapped.
+    EIO 	A hardware I/O error occurred writing back.
+ */
+
+#include "opt-A3.h"
+#if OPT_A3
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <curthread.h>
+#include <thread.h>
+#include <vnode.h>
+#include <vm.h>
+
+int sys_mmap(int *retval, void *addr, size_t len, int prot, int flags, int fdn, off_t offset) {
+    struct filedescriptor *fd;
+    struct vnode *vn = NULL;
+    u_int32_t type;
+    vaddr_t vaddr;
+    int shared, result;
+
+    (void) addr; //the kernel always picks the address
+    shared = flags & MAP_SHARED;
+    if (len == 0 || len >= MIPS_KSEG0 || offset < 0 || offset % PAGE_SIZE != 0) {
+        return EINVAL;
+    }
+    //exactly one of MAP_SHARED and MAP_PRIVATE
+    if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE)) {
+        return EINVAL;
+    }
+
+    if (!(flags & MAP_ANON)) {
+        fd = ft_get(curthread->ft, fdn);
+        if (fd == NULL || (O_ACCMODE & fd->mode) == O_WRONLY) {
+            return EBADF;
+        }
+        //writes to a shared region end up in the file
+        if (shared && (prot & PROT_WRITE) && (O_ACCMODE & fd->mode) != O_RDWR) {
+            return EBADF;
+        }
+        vn = fd->fdvnode;
+        //only files have pages to read in and write back
+        result = VOP_GETTYPE(vn, &type);
+        if (result) {
+            return result;
+        }
+        if (!S_ISREG(type)) {
+            return ENODEV;
+        }
+    }
+
+    result = as_map(curthread->t_vmspace, vn, offset, len, prot & PROT_WRITE, shared, &vaddr);
+    if (result) {
+        return result;
+    }
+    *retval = vaddr;
+    return 0;
+}
+
+int sys_munmap(int *retval, void *addr, size_t len) {
+    if ((vaddr_t) addr % PAGE_SIZE != 0 || len == 0) {
+        return EINVAL;
+    }
+    *retval = 0;
+    return as_unmap(curthread->t_vmspace, (vaddr_t) addr, len);
+}
+
+int sys_msync(int *retval, void *addr, size_t len, int flags) {
+    (void) flags; //always synchronous
+    if ((vaddr_t) addr % PAGE_SIZE != 0) {
+        return EINVAL;
+    }
+    *retval = 0;
+    return as_sync(curthread->t_vmspace, (vaddr_t) addr, len);
+}
+
+#endif /* OPT_A3 */
@@ -67,6 +67,7 @@ The following error codes should be returned under the conditions given. Other e
  */
 
 #include "opt-A2.h"
+#include "opt-A3.h"
 #if OPT_A2
 #include <types.h>
 #include <kern/errno.h>
@@ -81,6 +82,7 @@ The following error codes should be returned under the conditions given. Other e
 #include <uio.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <synch.h>
 
 int sys_open(int *retval, char *filename, int flags, int mode) {
 
@@ -93,33 +95,44 @@ int sys_open(int *retval, char *filename, int flags, int mode) {
     }
 
     (void) mode;
-    struct filedescriptor* fd = kmalloc(sizeof (struct filedescriptor));
-    fd->fdvnode = kmalloc(sizeof (struct vnode));
+    struct vnode *vn;
     char *kfilename = kstrdup(filename);
+    if (kfilename == NULL) {
+        return ENOMEM;
+    }
     int copyflag = flags;
     flags = flags&O_ACCMODE;
     int offset = 0;
-    int result = vfs_open(kfilename, copyflag, &fd->fdvnode);
+    int result = vfs_open(kfilename, copyflag, &vn);
+    kfree(kfilename);
     if (result) {
         return result;
     }
 
     if (copyflag & O_APPEND) {
-        struct stat *statbuf = kmalloc(sizeof ( struct stat));
-        VOP_STAT(fd->fdvnode, statbuf);
-        offset = statbuf->st_size;
-        kfree(statbuf);
+        struct stat statbuf;
+        VOP_STAT(vn, &statbuf);
+        offset = statbuf.st_size;
     }
 
     if (copyflag & O_TRUNC) {
-        VOP_TRUNCATE(fd->fdvnode, 0);
+#if OPT_A3
+        elf_cache_invalidate(vn);
+#endif
+        VOP_TRUNCATE(vn, 0);
     }
 
-    kfree(kfilename);
-    fd->offset = offset;
-    fd->mode = flags;
-    fd->numOwners = 0; //will increment to 1 upon ft_add
-    result = ft_add(curthread->ft, fd);
+    struct filedescriptor* fd = fd_create(vn, flags, offset);
+    if (fd == NULL) {
+        vfs_close(vn);
+        return ENOMEM;
+    }
+    result = ft_add(curthread->ft, fd); //ft_add makes the table its first owner
+    if (result < 0) {
+        //the file table is full
+        fd_destroy(fd);
+        return EMFILE;
+    }
     *retval = result;
     return 0;
 }
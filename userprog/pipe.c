@@ -0,0 +1,110 @@
+/*
+Name
+pipe - create pipe object
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+int
+pipe(int *fds);
+
+Description
+The pipe call creates an anonymous pipe. It returns two file handles, one for
+the read end and one for the write end: fds[0] is the reading end and fds[1]
+is the writing end. Data written to the write end can be read from the read
+end, in order. Both handles are inherited across fork, so a parent and child
+(or two children) can use a pipe to pass data between them.
+
+Reads block until data is available, and then return what there is. Once every
+handle on the write end is closed and the pipe is empty, reads return 0 (end
+of file). Writes block until there is room. A write of PIPE_BUF bytes or fewer
+is atomic: it is never interleaved with data from other writers.
+
+Pipes cannot be seeked.
+
+Return Values
+pipe returns 0 on success. On error, -1 is returned, and errno is set
+according to the error encountered.
+
+Errors
+The following error codes should be returned under the conditions given. Other
+error codes may be returned for other errors not mentioned here.
+
+    EMFILE 	The process's file table was full, or a process-specific limit on
+                open files was reached.
+    ENOMEM 	Insufficient kernel memory was available.
+    EFAULT 	fds is an invalid pointer.
+
+Writing to a pipe whose read end has been closed fails with EPIPE.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <curthread.h>
+#include <thread.h>
+#include <vfs.h>
+#include <synch.h>
+#include <pipe.h>
+#include <vm.h>
+
+int sys_pipe(int *retval, int *fds) {
+    struct vnode *readend, *writeend;
+    struct filedescriptor *rfd, *wfd;
+    int kfds[2];
+    int result;
+
+    if (!fds || (u_int32_t) fds >= MIPS_KSEG0 || !as_valid_range(curthread->t_vmspace, (vaddr_t) fds, sizeof(kfds))) {
+        return EFAULT;
+    }
+
+    result = pipe_create(&readend, &writeend);
+    if (result) {
+        return result;
+    }
+    rfd = fd_create(readend, O_RDONLY, 0);
+    if (rfd == NULL) {
+        vfs_close(readend);
+        vfs_close(writeend);
+        return ENOMEM;
+    }
+    wfd = fd_create(writeend, O_WRONLY, 0);
+    if (wfd == NULL) {
+        fd_destroy(rfd);
+        vfs_close(writeend);
+        return ENOMEM;
+    }
+
+    //ft_add makes the table each open file's first owner
+    kfds[0] = ft_add(curthread->ft, rfd);
+    if (kfds[0] < 0) {
+        fd_destroy(rfd);
+        fd_destroy(wfd);
+        return EMFILE;
+    }
+    kfds[1] = ft_add(curthread->ft, wfd);
+    if (kfds[1] < 0) {
+        ft_remove(curthread->ft, kfds[0]);
+        fd_destroy(wfd);
+        return EMFILE;
+    }
+
+    result = copyout(kfds, (userptr_t) fds, sizeof(kfds));
+    if (result) {
+        ft_remove(curthread->ft, kfds[0]);
+        ft_remove(curthread->ft, kfds[1]);
+        return result;
+    }
+    *retval = 0;
+    return 0;
+}
+
+#endif /* OPT_A2 */
@@ -0,0 +1,83 @@
+/*
+Name
+pread, pwrite - read or write data at a given position in a file
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+int
+pread(int fd, void *buf, size_t buflen, off_t pos);
+
+int
+pwrite(int fd, const void *buf, size_t buflen, off_t pos);
+
+Description
+pread and pwrite are like read and write, except that the I/O happens at
+position pos in the file rather than at the current seek position, and the seek
+position is not changed. Processes sharing an open file can therefore each do
+their own I/O to it without racing on the shared seek position.
+
+The file must be seekable.
+
+Return Values
+As for read and write.
+
+Errors
+The following error codes should be returned under the conditions given. Other
+error codes may be returned for other errors not mentioned here.
+
+    EBADF 	fd is not a valid file descriptor, or was not opened for reading
+                (pread) or writing (pwrite).
+    EFAULT 	Part or all of the address space pointed to by buf is invalid.
+    EINVAL 	pos is negative or otherwise not a valid position in the file.
+    ESPIPE 	fd refers to an object which does not support seeking.
+    ENOSPC 	There is no free space remaining on the filesystem (pwrite).
+    EIO 	A hardware I/O error occurred.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <filetable.h>
+#include <addrspace.h>
+#include <curthread.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+
+//Do a pread or pwrite at pos, leaving the seek position alone
+static int positioned_rw(int *retval, int fdn, void *buf, size_t nbytes, off_t pos, enum uio_rw rw) {
+    struct uio u;
+    int result;
+    //Check for Bad memory reference.
+    if (!buf || (u_int32_t) buf >= MIPS_KSEG0 || !as_valid_range(curthread->t_vmspace, (vaddr_t) buf, nbytes)) {
+        return EFAULT;
+    }
+    struct filedescriptor *fd = ft_get(curthread->ft, fdn);
+    if (fd == NULL) {
+        return EBADF;
+    }
+    //The console and other character devices have no positions
+    result = VOP_TRYSEEK(fd->fdvnode, pos);
+    if (result) {
+        return result;
+    }
+    mk_uuio(&u, (userptr_t) buf, nbytes, pos, rw);
+    return fd_rw(fd, &u, 0, retval);
+}
+
+int sys_pread(int *retval, int fdn, void *buf, size_t nbytes, off_t pos) {
+    return positioned_rw(retval, fdn, buf, nbytes, pos, UIO_READ);
+}
+
+int sys_pwrite(int *retval, int fdn, const void *buf, size_t nbytes, off_t pos) {
+    return positioned_rw(retval, fdn, (void *) buf, nbytes, pos, UIO_WRITE);
+}
+
+#endif /* OPT_A2 */
@@ -54,10 +54,12 @@ error codes may be returned for other errors not mentioned here.
 #include <vfs.h>
 #include <vnode.h>
 #include <vm.h>
+#include <synch.h>
 
 int sys_read(int *retval, int fdn, void *buf, size_t nbytes) {
     //Check for Bad memory reference.
-    if (!buf || (u_int32_t) buf >= MIPS_KSEG0 || !as_valid_write_addr(curthread->t_vmspace,buf)) {
+    //The whole buffer is checked here, once, so the copy itself can't run off the end of it.
+    if (!buf || (u_int32_t) buf >= MIPS_KSEG0 || !as_valid_range(curthread->t_vmspace, (vaddr_t) buf, nbytes)) {
         return EFAULT;
     }
     //Get the file descriptor from the opened list of file descriptors that the current thread has, based on the fdn given.
@@ -65,32 +67,12 @@ int sys_read(int *retval, int fdn, void *buf, size_t nbytes) {
     if (fd == NULL) {
         return EBADF;
     }
-    //Make sure that the file is opened for writing.
-    switch (O_ACCMODE & fd->mode) {
-        case O_RDONLY:
-        case O_RDWR:
-            break;
-        default:
-            return EBADF;
-    }
-    //Make the uio
+    //Read at the seek position, advancing it. The offset is read and
+    //advanced under the open file's lock, since other fds (in other processes,
+    //too) may share it
     struct uio u;
-    mk_kuio(&u, (void *) buf, nbytes, fd->offset, UIO_READ);
-    //Disable interrupt
-    //int spl;
-    //spl = splhigh();
-    //Read
-    int sizeread = VOP_READ(fd->fdvnode, &u);
-    //splx(spl);
-    if (sizeread) {
-        return sizeread;
-    }
-    //Find the number of bytes read
-    sizeread = nbytes - u.uio_resid;
-    *retval = sizeread;
-    //Update the offset
-    fd->offset += sizeread;
-    return 0;
+    mk_uuio(&u, (userptr_t) buf, nbytes, 0, UIO_READ);
+    return fd_rw(fd, &u, 1, retval);
 }
 
 #endif /* OPT_A2 */
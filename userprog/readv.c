@@ -0,0 +1,80 @@
+/*
+Name
+readv, writev - read or write data from or to several buffers
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+int
+readv(int fd, const struct iovec *iov, int iovcnt);
+
+int
+writev(int fd, const struct iovec *iov, int iovcnt);
+
+Description
+readv reads from the file specified by fd, at the current seek position, into
+the iovcnt buffers described by iov, filling each in turn before moving on to
+the next. writev likewise writes the data gathered from the iovcnt buffers, in
+order. Each iovec gives a buffer's address (iov_base) and length (iov_len).
+
+The current seek position of the file is advanced by the number of bytes
+transferred. Each call is a single operation on the file: it is atomic relative
+to other I/O to the same file, just as read and write are.
+
+Return Values
+As for read and write: the count of bytes transferred, or -1 with errno set.
+
+Errors
+The following error codes should be returned under the conditions given. Other
+error codes may be returned for other errors not mentioned here.
+
+    EBADF 	fd is not a valid file descriptor, or was not opened for reading
+                (readv) or writing (writev).
+    EFAULT 	Part or all of the address space pointed to by iov, or by one
+                of the buffers it describes, is invalid.
+    EINVAL 	iovcnt is not between 1 and IOV_MAX, or the lengths add up to
+                more than can be returned.
+    ENOSPC 	There is no free space remaining on the filesystem (writev).
+    EIO 	A hardware I/O error occurred.
+ */
+
+#include "opt-A2.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <lib.h>
+#include <filetable.h>
+#include <curthread.h>
+#include <thread.h>
+#include <uio.h>
+
+//Do a readv or writev: gather the iovecs into one uio so the file sees a
+//single VOP_READ or VOP_WRITE
+static int vectored_rw(int *retval, int fdn, const struct iovec *iov, int iovcnt, enum uio_rw rw) {
+    struct iovec kiov[IOV_MAX];
+    struct uio u;
+    int result;
+    struct filedescriptor *fd = ft_get(curthread->ft, fdn);
+    if (fd == NULL) {
+        return EBADF;
+    }
+    result = mk_uuiov(&u, kiov, (const_userptr_t) iov, iovcnt, 0, rw);
+    if (result) {
+        return result;
+    }
+    return fd_rw(fd, &u, 1, retval);
+}
+
+int sys_readv(int *retval, int fdn, const struct iovec *iov, int iovcnt) {
+    return vectored_rw(retval, fdn, iov, iovcnt, UIO_READ);
+}
+
+int sys_writev(int *retval, int fdn, const struct iovec *iov, int iovcnt) {
+    return vectored_rw(retval, fdn, iov, iovcnt, UIO_WRITE);
+}
+
+#endif /* OPT_A2 */
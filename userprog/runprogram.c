@@ -14,6 +14,7 @@
 #include <vm.h>
 #include <vfs.h>
 #include <test.h>
+#include <filetable.h>
 #include "opt-A2.h"
 #include "opt-A3.h"
 
@@ -35,6 +36,12 @@ int runprogram(char *progname, char ** args, unsigned long nargs) {
     /* We should be a new thread. */
     assert(curthread->t_vmspace == NULL);
 
+    /* Give the program its stdin, stdout and stderr, once, up front. */
+    result = ft_attachstds(curthread->ft);
+    if (result) {
+        return result;
+    }
+
     /* Create a new address space. */
     curthread->t_vmspace = as_create();
     if (curthread->t_vmspace == NULL) {
@@ -112,6 +119,13 @@ int runprogram(char *progname, char ** args, unsigned long nargs) {
     /* We should be a new thread. */
     assert(curthread->t_vmspace == NULL);
 
+    /* Give the program its stdin, stdout and stderr, once, up front. */
+    result = ft_attachstds(curthread->ft);
+    if (result) {
+        vfs_close(v);
+        return result;
+    }
+
     /* Create a new address space. */
     curthread->t_vmspace = as_create();
     if (curthread->t_vmspace == NULL) {
@@ -0,0 +1,196 @@
+/*
+Name
+spawn - create a new process running a program
+
+Library
+Standard C Library (libc, -lc)
+
+Synopsis
+#include <unistd.h>
+
+pid_t
+spawn(const char *program, char **args);
+
+Description
+spawn creates a new child process running program, with the NULL-terminated
+argument array args as its argv[]. It does what fork followed by execv in the
+child would do, but without copying the parent's address space only to throw
+it away: the child starts out with a fresh address space and the program is
+loaded into it directly.
+
+The child inherits the parent's file table and current directory, as with
+fork. The caller waits until the program has been loaded (or has failed to
+load), so errors that execv would report are reported by spawn itself.
+
+Return Values
+On success, spawn returns the process id of the new child. On error, -1 is
+returned, no process is created, and errno is set according to the error
+encountered.
+
+Errors
+The following error codes should be returned under the conditions given. Other
+error codes may be returned for other errors not mentioned here.
+
+    ENOMEM 	Sufficient virtual memory for the new process was not available,
+                or too many processes already exist.
+    ENODEV 	The device prefix of program did not exist.
+    ENOTDIR 	A non-final component of program was not a directory.
+    ENOENT 	program did not exist.
+    EISDIR 	program is a directory.
+    ENOEXEC 	program is not in a recognizable executable file format, was
+                for the wrong platform, or contained invalid fields.
+    E2BIG 	The total size of the argument strings is too large.
+    EIO 	A hard I/O error occurred.
+    EFAULT 	One of the args is an invalid pointer.
+ */
+
+#include "opt-A2.h"
+#include "opt-A3.h"
+#if OPT_A2
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <addrspace.h>
+#include <thread.h>
+#include <curthread.h>
+#include <synch.h>
+#include <vfs.h>
+#include <pid.h>
+#include <filetable.h>
+#include <syscall.h>
+#include <machine/spl.h>
+
+/*
+ * Handed from the parent to the child. Lives on the parent's stack; the
+ * parent sleeps on `loaded` until the child is done with it.
+ */
+struct spawn_args {
+    char *progname;
+    char *args; //staged by copyin_exec
+    int nargs;
+    size_t argslen;
+    struct semaphore *loaded; //V'd by the child once the program is loaded or has failed
+    int result; //set by the child before the V
+};
+
+/*
+ * Load the program into a new address space for the child and set up
+ * its arguments.
+ */
+static int spawn_load(struct spawn_args *sa, vaddr_t *entrypoint, vaddr_t *stackptr, userptr_t *argv) {
+    int result;
+#if !OPT_A3
+    struct vnode *v;
+#endif
+
+    curthread->t_vmspace = as_create();
+    if (curthread->t_vmspace == NULL) {
+        return ENOMEM;
+    }
+    as_activate(curthread->t_vmspace);
+
+#if OPT_A3
+    result = load_elf(sa->progname, entrypoint);
+#else
+    result = vfs_open(sa->progname, O_RDONLY, &v);
+    if (result) {
+        return result;
+    }
+    result = load_elf(v, entrypoint);
+    vfs_close(v);
+#endif
+    if (result) {
+        /* thread_exit destroys curthread->t_vmspace */
+        return result;
+    }
+
+    result = as_define_stack(curthread->t_vmspace, stackptr);
+    if (result) {
+        return result;
+    }
+
+    return copyout_args(sa->args, sa->nargs, sa->argslen, stackptr, argv);
+}
+
+/*
+ * Where the child starts.
+ */
+static void spawn_entry(void *data, unsigned long unused) {
+    struct spawn_args *sa = data;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv;
+    int nargs = sa->nargs;
+    int result;
+
+    (void) unused;
+
+    result = spawn_load(sa, &entrypoint, &stackptr, &argv);
+
+    //sa is gone once the parent wakes up
+    sa->result = result;
+    V(sa->loaded);
+
+    if (result) {
+        thread_exit();
+    }
+
+    md_usermode(nargs /*argc*/, argv /*userspace addr of argv*/, stackptr, entrypoint);
+
+    /* md_usermode does not return */
+    panic("md_usermode returned\n");
+}
+
+int sys_spawn(int *retval, char *progname, char **args) {
+    struct spawn_args sa;
+    struct thread *child = NULL;
+    pid_t pid;
+    int result, status, spl;
+
+    /* We need to copy the programname and args into kernel space */
+    result = copyin_exec(progname, args, &sa.progname, &sa.args, &sa.nargs, &sa.argslen);
+    if (result) {
+        return result;
+    }
+
+    sa.loaded = sem_create("spawn", 0);
+    if (sa.loaded == NULL) {
+        result = ENOMEM;
+        goto done;
+    }
+
+    spl = splhigh();
+    result = thread_fork(sa.progname, &sa, 0, spawn_entry, &child);
+    if (result) {
+        splx(spl);
+        goto done;
+    }
+    pid = child->pid;
+
+    //add new process to our children in the process table
+    pid_add_child(curthread->pid, pid);
+
+    //the file table has a fixed size, so this can't fail
+    ft_copy(curthread->ft, child->ft);
+    splx(spl);
+
+    //wait for the child to load the program; after this, child may be gone
+    P(sa.loaded);
+    result = sa.result;
+    if (result) {
+        //collect the child, which is exiting without having run anything
+        pid_wait(curthread->pid, pid, 0, &status);
+    } else {
+        *retval = pid;
+    }
+
+done:
+    if (sa.loaded != NULL) {
+        sem_destroy(sa.loaded);
+    }
+    kfree(sa.progname);
+    kfree(sa.args);
+    return result;
+}
+
+#endif /* OPT_A2 */
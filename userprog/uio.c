@@ -1,6 +1,10 @@
+#include "opt-A2.h"
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
 #include <lib.h>
 #include <uio.h>
+#include <addrspace.h>
 #include <thread.h>
 #include <curthread.h>
 
@@ -26,20 +30,27 @@ uiomove(void *ptr, size_t n, struct uio *uio)
 	}
 
 	while (n > 0 && uio->uio_resid > 0) {
-		iov = &uio->uio_iovec;
-		size = iov->iov_len;
-
-		if (size > n) {
-			size = n;
-		}
-
-		if (size==0) {
+		if (uio->uio_iovcnt == 0) {
 			/* 
 			 * This should only happen if you set uio_resid
 			 * incorrectly (to more than the total length of
 			 * buffers the uio points to). 
 			 */
-			panic("uiomove: size reached 0\n");
+			panic("uiomove: ran out of iovecs\n");
+		}
+
+		iov = uio->uio_iov;
+		size = iov->iov_len;
+
+		if (size==0) {
+			/* Done with this buffer (or it was empty); next. */
+			uio->uio_iov++;
+			uio->uio_iovcnt--;
+			continue;
+		}
+
+		if (size > n) {
+			size = n;
 		}
 
 		switch (uio->uio_segflg) {
@@ -113,6 +124,8 @@ uiomovezeros(size_t n, struct uio *uio)
 void
 mk_kuio(struct uio *uio, void *kbuf, size_t len, off_t pos, enum uio_rw rw)
 {
+	uio->uio_iov = &uio->uio_iovec;
+	uio->uio_iovcnt = 1;
 	uio->uio_iovec.iov_kbase = kbuf;
 	uio->uio_iovec.iov_len = len;
 	uio->uio_offset = pos;
@@ -121,3 +134,70 @@ mk_kuio(struct uio *uio, void *kbuf, size_t len, off_t pos, enum uio_rw rw)
 	uio->uio_rw = rw;
 	uio->uio_space = NULL;
 }
+
+/*
+ * Convenience function to cons up a uio for I/O to or from a buffer in
+ * the current process's address space. uiomove then moves data with a
+ * single copyin/copyout per chunk the device or filesystem hands it.
+ */
+void
+mk_uuio(struct uio *uio, userptr_t ubuf, size_t len, off_t pos,
+	enum uio_rw rw)
+{
+	uio->uio_iov = &uio->uio_iovec;
+	uio->uio_iovcnt = 1;
+	uio->uio_iovec.iov_ubase = ubuf;
+	uio->uio_iovec.iov_len = len;
+	uio->uio_offset = pos;
+	uio->uio_resid = len;
+	uio->uio_segflg = UIO_USERSPACE;
+	uio->uio_rw = rw;
+	uio->uio_space = curthread->t_vmspace;
+}
+
+/*
+ * Convenience function to cons up a uio for vectored I/O (readv, writev)
+ * on buffers in the current process's address space. See uio.h.
+ */
+int
+mk_uuiov(struct uio *uio, struct iovec *kiov, const_userptr_t uiov,
+	 int iovcnt, off_t pos, enum uio_rw rw)
+{
+	size_t total;
+	int i, result;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+
+	result = copyin(uiov, kiov, iovcnt * sizeof(struct iovec));
+	if (result) {
+		return result;
+	}
+
+	total = 0;
+	for (i=0; i<iovcnt; i++) {
+		total += kiov[i].iov_len;
+		/* The byte count is returned as an int; it must fit. */
+		if ((int)total < 0 || total < kiov[i].iov_len) {
+			return EINVAL;
+		}
+
+#if OPT_A2
+		if (!as_valid_range(curthread->t_vmspace,
+				    (vaddr_t)kiov[i].iov_ubase,
+				    kiov[i].iov_len)) {
+			return EFAULT;
+		}
+#endif
+	}
+
+	uio->uio_iov = kiov;
+	uio->uio_iovcnt = iovcnt;
+	uio->uio_offset = pos;
+	uio->uio_resid = total;
+	uio->uio_segflg = UIO_USERSPACE;
+	uio->uio_rw = rw;
+	uio->uio_space = curthread->t_vmspace;
+	return 0;
+}
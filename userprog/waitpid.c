@@ -2,10 +2,8 @@
 
 #if OPT_A2
 
-#include <machine/spl.h>
 #include <kern/unistd.h>
 #include <pid.h>
-#include <child_table.h>
 #include <thread.h>
 #include <curthread.h>
 #include <vm.h>
@@ -23,24 +21,13 @@ int sys_waitpid(pid_t PID, int *status, int options) {
         //misaligned memory address
         return EFAULT;
     }
-    int spl = splhigh();
-    if (options != 0) {
+    if ((options & ~WNOHANG) != 0) {
         DEBUG(DB_PID, "Invalid option passed to waitpid\n");
-        splx(spl);
         //error
         return EINVAL;
     }
-    struct child_table *child = NULL;
-    struct child_table *p;
-    for (p = curthread->children; p != NULL; p = p->next) {
-        if (p->pid == PID) {
-            child = p;
-            break;
-        }
-    }
-    if (child == NULL) { //error: pid not in use or is not the pid of a child process
+    if (PID != -1 && !pid_is_child(curthread->pid, PID)) { //error: pid not in use or is not the pid of a child process
         DEBUG(DB_PID, "Thread `%s` trying to wait on invalid PID %d\n", curthread->t_name, (int) PID);
-        splx(spl);
         //error
         if (pid_claimed(PID)) {
             return ESRCH; //do not have permission to wait on that pid
@@ -50,33 +37,18 @@ int sys_waitpid(pid_t PID, int *status, int options) {
     }
     
     DEBUG(DB_PID, "Thread `%s`: wait_pid(%d)\n", curthread->t_name, (int) PID);
-    while (child->finished == 0) {
-        thread_sleep((void *) PID);
+    //PID -1 means whichever child exits first
+    int exit_code;
+    pid_t reaped = pid_wait(curthread->pid, PID, options, &exit_code);
+    if (reaped == -1) {
+        return ECHILD; //no children left to wait for
     }
-    
-    *status = child->exit_code;
-    
-    //now, remove the child from children list since it has exited and it's PID is no longer needed
-    if (curthread->children->pid == PID) {
-        struct child_table *temp = curthread->children;
-        curthread->children = curthread->children->next;
-        kfree(temp);
-    } else {
-        for (p = curthread->children;; p = p->next) {
-            assert(p->next != NULL);
-            if (p->next->pid == PID) {
-                struct child_table *temp = p->next;
-                p->next = p->next->next;
-                kfree(temp);
-                break;
-            }
-        }
+    if (reaped == 0) {
+        return 0; //WNOHANG and nobody has exited yet: waitpid returns 0
     }
+    *status = exit_code;
     
-    pid_parent_done(PID);
-    splx(spl);
-    
-    return PID;
+    return reaped;
 }
 
 #endif
@@ -55,51 +55,23 @@ EIO 	A hardware I/O error occurred writing the data.
 #include <vm.h>
 #include <synch.h>
 
-struct lock *writelock;
-
 int sys_write(int *retval, int fdn, void *buf, size_t nbytes) {
     //Check for Bad memory reference.
-    if (!buf || (u_int32_t) buf >= MIPS_KSEG0 || buf == NULL  || !as_valid_read_addr(curthread->t_vmspace,buf)) {
+    //The whole buffer is checked here, once, so the copy itself can't run off the end of it.
+    if (!buf || (u_int32_t) buf >= MIPS_KSEG0 || !as_valid_range(curthread->t_vmspace, (vaddr_t) buf, nbytes)) {
         return EFAULT;
     }
-    if (writelock == NULL) {
-        writelock = lock_create("WriteLock");
-        if (writelock == NULL) {
-            return ENOMEM;
-        }
-    }
     //Get the file descriptor from the opened list of file descriptors that the current thread has, based on the fdn given.
     struct filedescriptor* fd = ft_get(curthread->ft, fdn);
     if (fd == NULL) {
         return EBADF;
     }
-    //Make sure that the file is opened for writing.
-    switch (O_ACCMODE & fd->mode) {
-        case O_WRONLY:
-        case O_RDWR:
-            break;
-        default:
-            return EBADF;
-    }
-    //Make the uio
+    //Write at the seek position, advancing it. The offset is read and
+    //advanced under the open file's lock, since other fds (in other processes,
+    //too) may share it
     struct uio u;
-    mk_kuio(&u, (void *) buf, nbytes, fd->offset, UIO_WRITE);
-    ///lock_acquire(writelock);
-    int spl = splhigh();
-    //Write
-    int sizewrite = VOP_WRITE(fd->fdvnode, &u);
-    splx(spl);
-    ///lock_release(writelock);
-
-    if (sizewrite) {
-        return sizewrite;
-    }
-    //Find the number of bytes written
-    sizewrite = nbytes - u.uio_resid;
-    *retval = sizewrite;
-    //Update the offset
-    fd->offset += sizewrite;
-    return 0;
+    mk_uuio(&u, (userptr_t) buf, nbytes, 0, UIO_WRITE);
+    return fd_rw(fd, &u, 1, retval);
 }
 
 #endif /* OPT_A2 */
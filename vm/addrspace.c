@@ -18,7 +18,9 @@
 #include <coremap.h>
 #include <vnode.h>
 #include <vfs.h>
+#include <synch.h>
 #include <kern/unistd.h>
+#include <kern/stat.h>
 
 #include <elf.h>
 /* under dumbvm, always have 48k of user stack */
@@ -62,9 +64,7 @@ void free_kpages(vaddr_t addr) {
 
 int vm_fault(int faulttype, vaddr_t faultaddress) {
     struct addrspace *as;
-    int spl;
-
-    spl = splhigh();
+    struct segment *s;
 
     faultaddress &= PAGE_FRAME;
 
@@ -80,37 +80,38 @@ int vm_fault(int faulttype, vaddr_t faultaddress) {
 
     switch (faulttype) {
         case VM_FAULT_READONLY:
-            /* We always create pages read-write, so we can't get this */
+            /*
+             * Pages of writeable segments are mapped read-write, except in
+             * shared mmap regions, where a page stays read-only until its
+             * first write so that we know to write it back.
+             */
+            s = as_get_segment(as, faultaddress);
+            if (s != NULL && s->shared && s->writeable) {
+                pt_mark_modified(faultaddress, s);
+                return 0;
+            }
 
             DEBUG(DB_ELF, "ELF: VM_FAULT_READONLY\n");
             thread_exit();
             return EFAULT;
         case VM_FAULT_WRITE:
-            if (!as_valid_write_addr(as, (void *) faultaddress)) {
-
-                DEBUG(DB_ELF, "ELF: VM_FAULT_WRITE\n");
-                thread_exit();
-                return EFAULT;
-            }
-            break;
         case VM_FAULT_READ:
-            if (!as_valid_read_addr(as, (void *) faultaddress)) {
-
-                DEBUG(DB_ELF, "ELF: VM_FAULT_READ on %x\n", faultaddress);
-                thread_exit();
-                return EFAULT;
-            }
             break;
         default:
-            splx(spl);
             return EINVAL;
     }
 
-    struct segment * s = as_get_segment(as, faultaddress);
-    assert(s != NULL);
-    
-    //we can enable interuppts at this point since we will take care of synch
-    splx(spl);
+    //a single shared lookup both validates the address and finds its segment;
+    //the segment table only takes the lock exclusively while regions are (re)defined
+    s = as_get_segment(as, faultaddress);
+    if (s == NULL) {
+
+        DEBUG(DB_ELF, "ELF: %s fault on %x\n", faulttype == VM_FAULT_WRITE ? "VM_FAULT_WRITE" : "VM_FAULT_READ", faultaddress);
+        thread_exit();
+        return EFAULT;
+    }
+
+    //the page table and coremap take care of their own synch
     pt_page_in(faultaddress, s);
     return 0;
 }
@@ -127,7 +128,7 @@ struct addrspace * as_create(void) {
     }
 
     int i;
-    for (i = 0; i < AS_NUM_SEG - 1; i++) {
+    for (i = 0; i < AS_NUM_SEG; i++) {
         as->segments[i].active = 0;
         as->segments[i].vbase = 0;
         as->segments[i].size = 0;
@@ -137,11 +138,23 @@ struct addrspace * as_create(void) {
         as->segments[i].p_filesz = 0;
         as->segments[i].p_memsz = 0;
         as->segments[i].p_flags = 0;
-
+        as->segments[i].vn = NULL;
+        as->segments[i].shared = 0;
+    }
+    for (i = 0; i < AS_NUM_MAP; i++) {
+        as->mappings[i].active = 0;
+        as->mappings[i].pt = NULL;
+        as->mappings[i].vn = NULL;
+        as->mappings[i].shared = 0;
     }
 
     as->file = NULL;
     as->num_segments = 0;
+    as->as_lock = rwlock_create("as_lock");
+    if (as->as_lock == NULL) {
+        kfree(as);
+        return NULL;
+    }
     return as;
 }
 
@@ -161,31 +174,51 @@ void as_destroy(struct addrspace *as) {
         
     }
     //free the memory
+    rwlock_destroy(as->as_lock);
     kfree(as);
 }
 
+/*
+ * Free the frames, swap pages and page table of a segment. The caller
+ * holds as_lock for writing.
+ */
+static void as_release_segment(struct segment *s) {
+    if (s->pt != NULL) {
+        //free each physical frame
+        int j;
+        for (j = 0; j < s->pt->size; j++) {
+            if (s->pt->page_details[j].pfn != -1) {
+                cm_release_frame(s->pt->page_details[j].pfn);
+            }
+            if (s->pt->page_details[j].sfn != -1) {
+                swap_free_page(s->pt->page_details[j].sfn);
+            }
+        }
+        //destroy the page table
+        pt_destroy(s->pt);
+        s->pt = NULL;
+    }
+}
+
+static void as_drop_mapping(struct segment *s);
+static int as_sync_mapping(struct segment *s, vaddr_t start, vaddr_t end);
+
 void as_free_segments(struct addrspace *as){
     assert(as != NULL);
     int i;
+    rwlock_acquire_write(as->as_lock);
     for(i=0;i < AS_NUM_SEG; i++){
         if(as->segments[i].active){
-            if(as->segments[i].pt != NULL){
-                //free each physical frame
-                int j;
-                for(j = 0; j < as->segments[i].pt->size; j++){
-                    if(as->segments[i].pt->page_details[j].pfn != -1){
-                        cm_release_frame(as->segments[i].pt->page_details[j].pfn);
-                    }
-                    if(as->segments[i].pt->page_details[j].sfn != -1){
-                        swap_free_page(as->segments[i].pt->page_details[j].sfn);
-                    }
-                }
-                //destroy the page table
-                pt_destroy(as->segments[i].pt);
-            }
+            as_release_segment(&as->segments[i]);
         }
     }
-    
+    //shared mmap regions are written back on exit, as on munmap
+    for (i = 0; i < AS_NUM_MAP; i++) {
+        if (as->mappings[i].active) {
+            as_drop_mapping(&as->mappings[i]);
+        }
+    }
+    rwlock_release_write(as->as_lock);
 }
 
 void as_activate(struct addrspace *as) {
@@ -209,6 +242,7 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz, int flags,
 
     //DEBUG(DB_ELF, "ELF: Define seg: %d \n", as->num_segments);
 
+    rwlock_acquire_write(as->as_lock);
     if (as->num_segments < AS_NUM_SEG - 1) {
         assert(as->segments[as->num_segments].active == 0);
         as->segments[as->num_segments].active = 1;
@@ -219,12 +253,16 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz, int flags,
         as->segments[as->num_segments].p_memsz = memsz;
         as->segments[as->num_segments].p_filesz = filesz;
         as->segments[as->num_segments].p_flags = flags & PF_X;
+        as->segments[as->num_segments].vn = NULL;
+        as->segments[as->num_segments].shared = 0;
         //create a page table
         as->segments[as->num_segments].pt = pt_create(&(as->segments[as->num_segments]));
         assert(as->segments[as->num_segments].pt != NULL);
         as->num_segments++;
+        rwlock_release_write(as->as_lock);
         return 0;
     } else {
+        rwlock_release_write(as->as_lock);
         /*
          * Support for more than AS_NUM_SEG regions is not available.
          */
@@ -237,48 +275,84 @@ int as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz, int flags,
 
 }
 
+/*
+ * Copy one segment, and whichever of its pages can't just be paged in
+ * again from the file, into a new address space. Shared mmap regions
+ * copy none: the new one pages in from the file, which the caller has
+ * brought up to date, so that both see each other's writes through it.
+ */
+static void as_copy_segment(struct segment *olds, struct segment *news) {
+    news->active = 1;
+    news->vbase = olds->vbase;
+    news->size = olds->size;
+    news->writeable = olds->writeable;
+    news->p_offset = olds->p_offset;
+    news->p_filesz = olds->p_filesz;
+    news->p_memsz = olds->p_memsz;
+    news->p_flags = olds->p_flags;
+    news->vn = olds->vn;
+    news->shared = olds->shared;
+    if (news->vn != NULL) {
+        //the new mapping holds its own open of the file
+        VOP_INCREF(news->vn);
+        VOP_INCOPEN(news->vn);
+    }
+
+    //copy the page table
+    news->pt = pt_create(news);
+    int j;
+    for(j=0;j < news->pt->size; j++){
+
+        struct page_detail *pd = &(news->pt->page_details[j]);
+        if(!olds->shared && olds->pt->page_details[j].dirty){
+            //Page is writeable, copy it to a new physical frame for as
+            pd->use = 0;
+            pd->valid = 1;
+            pd->modified = olds->pt->page_details[j].modified;
+            pd->pfn = cm_getppage();
+            vaddr_t copy_location = PADDR_TO_KVADDR(pd->pfn*PAGE_SIZE);
+            //COPY THE USPACEMEM TO OUR NEW PHYSICAL PAGE
+            copyin((void *)pd->vaddr, (void *) copy_location, PAGE_SIZE);
+            //finish the load
+            cm_finish_paging(pd->pfn, pd);
+        }else{
+            //page is not writeable, it will be loaded from elf on demand
+            //so just set up the page details accordingly
+            pd->use = 0;
+            pd->pfn = -1;
+            pd->valid = 0;
+            pd->sfn = -1;
+        }
+    }
+}
+
 int as_copy_segments(struct addrspace *old, struct addrspace *new){
+    struct segment *s;
+    int result;
+    assert(curthread->t_vmspace == old); //pages are copied in from the old addressspace.
     //set the number of segments
     new->num_segments = old->num_segments;
     
     int i;
     for (i = 0; i < AS_NUM_SEG; i++) {
         if (old->segments[i].active) {
-            new->segments[i].active = 1;
-            new->segments[i].vbase = old->segments[i].vbase;
-            new->segments[i].size = old->segments[i].size;
-            new->segments[i].writeable = old->segments[i].writeable;
-            new->segments[i].p_offset = old->segments[i].p_offset;
-            new->segments[i].p_filesz = old->segments[i].p_filesz;
-            new->segments[i].p_memsz = old->segments[i].p_memsz;
-            new->segments[i].p_flags = old->segments[i].p_flags;
-            
-            //copy the page table
-	        new->segments[i].pt = pt_create(&new->segments[i]);
-	        int j;
-	        for(j=0;j < new->segments[i].pt->size; j++){
- 
-                struct page_detail *pd = &(new->segments[i].pt->page_details[j]);
-                if(old->segments[i].pt->page_details[j].dirty){
-                    //Page is writeable, copy it to a new physical frame for as
-                    pd->use = 0;
-                    pd->valid = 1;
-                    pd->pfn = cm_getppage();
-                    vaddr_t copy_location = PADDR_TO_KVADDR(pd->pfn*PAGE_SIZE);
-                    //COPY THE USPACEMEM TO OUR NEW PHYSICAL PAGE
-                    assert(curthread->t_vmspace == old); //make sure we are the old addressspace.
-                    copyin((void *)pd->vaddr, (void *) copy_location, PAGE_SIZE);
-                    //finish the load
-                    cm_finish_paging(pd->pfn, pd);
-                }else{
-                    //page is not writeable, it will be loaded from elf on demand
-                    //so just set up the page details accordingly
-                    pd->use = 0;
-                    pd->pfn = -1;
-                    pd->valid = 0;
-                    pd->sfn = -1;
+            as_copy_segment(&old->segments[i], &new->segments[i]);
+        }
+    }
+    for (i = 0; i < AS_NUM_MAP; i++) {
+        s = &old->mappings[i];
+        if (s->active) {
+            if (s->shared) {
+                //the child's copy of a shared region reads the file, so
+                //everything written to the region so far has to be there
+                rwlock_acquire_read(old->as_lock);
+                result = as_sync_mapping(s, s->vbase, s->vbase + s->size * PAGE_SIZE);
+                rwlock_release_read(old->as_lock);
+                if (result) {
+                    return result;
                 }
-	        }
+            }
+            as_copy_segment(s, &new->mappings[i]);
         }
     }
     
@@ -312,6 +386,7 @@ int as_define_stack(struct addrspace *as, vaddr_t *stackptr) {
     //assert(as->segments[AS_NUM_SEG - 1].active);
     /* Initial user-level stack pointer */
     // *stackptr = as->segments[AS_NUM_SEG - 1].vbase + as->segments[AS_NUM_SEG - 1].size*PAGE_SIZE;
+    rwlock_acquire_write(as->as_lock);
     as->segments[AS_NUM_SEG - 1].active = 1;
     as->segments[AS_NUM_SEG - 1].vbase = USERTOP - DUMBVM_STACKPAGES*PAGE_SIZE;
     as->segments[AS_NUM_SEG - 1].size = DUMBVM_STACKPAGES;
@@ -320,52 +395,255 @@ int as_define_stack(struct addrspace *as, vaddr_t *stackptr) {
     as->segments[AS_NUM_SEG - 1].p_filesz = 0;
     as->segments[AS_NUM_SEG - 1].p_memsz = 0;
     as->segments[AS_NUM_SEG - 1].p_flags = 0;
+    as->segments[AS_NUM_SEG - 1].vn = NULL;
+    as->segments[AS_NUM_SEG - 1].shared = 0;
     as->segments[AS_NUM_SEG - 1].pt = pt_create(&(as->segments[AS_NUM_SEG - 1]));
+    rwlock_release_write(as->as_lock);
     *stackptr = USERTOP;
     return 0;
 }
 
-struct segment * as_get_segment(struct addrspace * as, vaddr_t v) {
+/*
+ * Find the segment containing v without taking as_lock; the caller
+ * must hold it.
+ */
+static struct segment * as_find_segment(struct addrspace * as, vaddr_t v) {
     int i = 0;
+    if (!(v < USERTOP)) {
+        return NULL;
+    }
     for (i = 0; i < AS_NUM_SEG; i++) {
         if (as->segments[i].active == 1 && v >= as->segments[i].vbase && v < as->segments[i].vbase + as->segments[i].size * PAGE_SIZE) {
             return &as->segments[i];
         }
     }
+    for (i = 0; i < AS_NUM_MAP; i++) {
+        if (as->mappings[i].active == 1 && v >= as->mappings[i].vbase && v < as->mappings[i].vbase + as->mappings[i].size * PAGE_SIZE) {
+            return &as->mappings[i];
+        }
+    }
     return NULL;
 }
 
+struct segment * as_get_segment(struct addrspace * as, vaddr_t v) {
+    struct segment *s;
+    rwlock_acquire_read(as->as_lock);
+    s = as_find_segment(as, v);
+    rwlock_release_read(as->as_lock);
+    //segments live in the addrspace itself, so the pointer stays good after we unlock
+    return s;
+}
+
 int as_valid_read_addr(struct addrspace *as, vaddr_t *check_addr) {
-    int i = 0;
-    if (!(check_addr < (vaddr_t *) USERTOP)) {
-        return 0;
+    return as_get_segment(as, (vaddr_t) check_addr) != NULL;
+}
+
+int as_valid_write_addr(struct addrspace *as, vaddr_t *check_addr) {
+    return as_get_segment(as, (vaddr_t) check_addr) != NULL;
+}
+
+/*
+ * Check that every byte of [start, start + len) lies in some segment.
+ * Segments can sit back to back, so step from one segment's end into the
+ * next: one lookup per segment crossed rather than one per page.
+ */
+int as_valid_range(struct addrspace *as, vaddr_t start, size_t len) {
+    vaddr_t end = start + len;
+    struct segment *s;
+    if (end < start) {
+        return 0; //wrapped around
     }
-    for (i = 0; i < AS_NUM_SEG; i++) {
-        if (as->segments[i].active) {
-            if ((check_addr >= (vaddr_t *) as->segments[i].vbase) && (check_addr < (vaddr_t *) as->segments[i].vbase + PAGE_SIZE * as->segments[i].size)) {
-                return 1;
-            }
+    rwlock_acquire_read(as->as_lock);
+    while (start < end) {
+        s = as_find_segment(as, start);
+        if (s == NULL) {
+            rwlock_release_read(as->as_lock);
+            return 0;
         }
+        start = s->vbase + s->size * PAGE_SIZE;
+    }
+    rwlock_release_read(as->as_lock);
+    return 1;
+}
+
+/*
+ * Find a segment or mmap region overlapping [base, base + len). The
+ * caller holds as_lock.
+ */
+static struct segment * as_find_overlap(struct addrspace *as, vaddr_t base, size_t len) {
+    int i;
+    struct segment *s;
+    for (i = 0; i < AS_NUM_SEG + AS_NUM_MAP; i++) {
+        s = i < AS_NUM_SEG ? &as->segments[i] : &as->mappings[i - AS_NUM_SEG];
+        if (s->active == 1 && base < s->vbase + s->size * PAGE_SIZE && s->vbase < base + len) {
+            return s;
+        }
+    }
+    return NULL;
+}
 
+/*
+ * Pick an address for an mmap region of npages: the highest gap below the
+ * stack that fits, leaving page 0 unmapped. Returns 0 if there isn't one.
+ * The caller holds as_lock.
+ */
+static vaddr_t as_find_gap(struct addrspace *as, size_t npages) {
+    vaddr_t top = USERTOP - DUMBVM_STACKPAGES * PAGE_SIZE;
+    size_t len = npages * PAGE_SIZE;
+    struct segment *s;
+    while (top >= len + PAGE_SIZE) {
+        s = as_find_overlap(as, top - len, len);
+        if (s == NULL) {
+            return top - len;
+        }
+        top = s->vbase;
     }
     return 0;
 }
 
-int as_valid_write_addr(struct addrspace *as, vaddr_t *check_addr) {
-    int i = 0;
-    if (!(check_addr < (vaddr_t *) USERTOP)) {
+/*
+ * Write back the modified pages of a shared mmap region that lie in
+ * [start, end). Modified pages are never evicted, so they are all
+ * resident. The caller holds as_lock.
+ */
+static int as_sync_mapping(struct segment *s, vaddr_t start, vaddr_t end) {
+    struct page_detail *pd;
+    int j, frame, spl, result;
+    if (!s->shared) {
         return 0;
     }
-    for (i = 0; i < AS_NUM_SEG; i++) {
-        if (as->segments[i].active) {
-            if ((check_addr >= (vaddr_t *) as->segments[i].vbase) && (check_addr < (vaddr_t *) as->segments[i].vbase + PAGE_SIZE * as->segments[i].size)) {
-                return 1;
+    for (j = 0; j < s->pt->size; j++) {
+        pd = &s->pt->page_details[j];
+        if (pd->vaddr < start || pd->vaddr >= end || !pd->modified) {
+            continue;
+        }
+        frame = cm_pin_page(pd);
+        if (frame < 0) {
+            continue;
+        }
+        //from here on, a write has to fault again to mark the page modified
+        spl = splhigh();
+        pd->modified = 0;
+        tlb_invalidate_vaddr(pd->vaddr);
+        splx(spl);
+        result = pt_write_back(s, pd, frame);
+        cm_unpin_page(frame);
+        if (result) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Tear down an mmap region: write it back if it is shared, free its pages,
+ * and let go of the file. The caller holds as_lock for writing.
+ */
+static void as_drop_mapping(struct segment *s) {
+    int j, spl;
+    as_sync_mapping(s, s->vbase, s->vbase + s->size * PAGE_SIZE);
+    //none of its pages may stay reachable through the TLB
+    spl = splhigh();
+    for (j = 0; j < s->pt->size; j++) {
+        if (s->pt->page_details[j].valid) {
+            tlb_invalidate_vaddr(s->pt->page_details[j].vaddr);
+        }
+    }
+    splx(spl);
+    as_release_segment(s);
+    if (s->vn != NULL) {
+        vfs_close(s->vn);
+        s->vn = NULL;
+    }
+    s->active = 0;
+}
+
+int as_map(struct addrspace *as, struct vnode *vn, off_t offset, size_t len, int writeable, int shared, vaddr_t *ret) {
+    size_t npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+    u_int32_t filesz = 0;
+    struct segment *s = NULL;
+    struct stat st;
+    vaddr_t vaddr;
+    int i, result;
+
+    //only the part of the region that the file covers is read from it;
+    //the rest, like all of an anonymous region, is zero-filled
+    if (vn != NULL) {
+        result = VOP_STAT(vn, &st);
+        if (result) {
+            return result;
+        }
+        if (offset < st.st_size) {
+            filesz = st.st_size - offset;
+            if (filesz > len) {
+                filesz = len;
             }
         }
+    }
 
+    rwlock_acquire_write(as->as_lock);
+    for (i = 0; i < AS_NUM_MAP; i++) {
+        if (!as->mappings[i].active) {
+            s = &as->mappings[i];
+            break;
+        }
     }
+    vaddr = as_find_gap(as, npages);
+    if (s == NULL || vaddr == 0) {
+        rwlock_release_write(as->as_lock);
+        return ENOMEM;
+    }
+    s->active = 1;
+    s->vbase = vaddr;
+    s->size = npages;
+    s->writeable = writeable;
+    s->p_offset = offset;
+    s->p_filesz = filesz;
+    s->p_memsz = len;
+    s->p_flags = 0;
+    s->vn = vn;
+    s->shared = shared && vn != NULL;
+    //nothing is read in now; pages come in from pt_page_in as they are touched
+    s->pt = pt_create(s);
+    if (vn != NULL) {
+        //the mapping holds its own open of the file, so closing the fd doesn't end it
+        VOP_INCREF(vn);
+        VOP_INCOPEN(vn);
+    }
+    rwlock_release_write(as->as_lock);
+    *ret = vaddr;
     return 0;
 }
+
+int as_unmap(struct addrspace *as, vaddr_t vaddr, size_t len) {
+    size_t npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+    int i;
+    rwlock_acquire_write(as->as_lock);
+    for (i = 0; i < AS_NUM_MAP; i++) {
+        if (as->mappings[i].active && as->mappings[i].vbase == vaddr && as->mappings[i].size == npages) {
+            as_drop_mapping(&as->mappings[i]);
+            rwlock_release_write(as->as_lock);
+            return 0;
+        }
+    }
+    rwlock_release_write(as->as_lock);
+    return EINVAL;
+}
+
+int as_sync(struct addrspace *as, vaddr_t vaddr, size_t len) {
+    int i, result = 0;
+    if (!as_valid_range(as, vaddr, len)) {
+        return ENOMEM;
+    }
+    rwlock_acquire_read(as->as_lock);
+    for (i = 0; i < AS_NUM_MAP && result == 0; i++) {
+        if (as->mappings[i].active) {
+            result = as_sync_mapping(&as->mappings[i], vaddr, vaddr + len);
+        }
+    }
+    rwlock_release_read(as->as_lock);
+    return result;
+}
 #else
 
 ///////////////////////////////////////////////////
@@ -519,6 +797,7 @@ int as_valid_write_addr(struct addrspace *as, vaddr_t *check_addr) {
     }
     return 0;
 }
+
 #endif /* OPT_A2 */
 
 #endif /* OPT_A3 */
@@ -6,6 +6,7 @@
 #include <kern/unistd.h>
 #include <kern/limits.h>
 #include <machine/spl.h>
+#include <spinlock.h>
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -27,6 +28,7 @@ void cm_bootstrap() {
     assert(curspl > 0);
     assert(core_map.init == 0); //we had better not bootstrap more than once!
     core_map.init = 1;
+    spinlock_init(&core_map.lock);
     core_map.size = mips_ramsize() / PAGE_SIZE;
 
     core_map.core_details = (struct cm_detail*) kmalloc(sizeof (struct cm_detail) * core_map.size);
@@ -58,7 +60,7 @@ void cm_bootstrap() {
 }
 
 void free_frame_list_add(struct cm_detail *new) {
-    int spl = splhigh();
+    spinlock_acquire(&core_map.lock);
     debug_claimed_pages--;
     DEBUG(DB_CORE, "[free] %3d / %3d pages used.\n", debug_claimed_pages, debug_toal_pages_avail);
     if (core_map.free_frame_list == NULL) {
@@ -74,11 +76,11 @@ void free_frame_list_add(struct cm_detail *new) {
     }
     new->free = 1;
     new->kern = 0;
-    splx(spl);
+    spinlock_release(&core_map.lock);
 }
 
 void free_frame_list_add_back(struct cm_detail *new) {
-    int spl = splhigh();
+    spinlock_acquire(&core_map.lock);
     debug_claimed_pages--;
     DEBUG(DB_CORE, "[free] %3d / %3d pages used.\n", debug_claimed_pages, debug_toal_pages_avail);
     if (core_map.last_free == NULL) {
@@ -94,14 +96,14 @@ void free_frame_list_add_back(struct cm_detail *new) {
     }
     new->free = 1;
     new->kern = 0;
-    splx(spl);
+    spinlock_release(&core_map.lock);
 }
 
+//caller holds core_map.lock
 struct cm_detail *free_frame_list_pop() {
-    int spl = splhigh();
+    assert(spinlock_do_i_hold(&core_map.lock));
 
     if (core_map.free_frame_list == NULL) {
-        splx(spl);
         return NULL;
     }
     debug_claimed_pages++;
@@ -121,12 +123,12 @@ struct cm_detail *free_frame_list_pop() {
     retval->kern = 1;
     retval->free = 0;
 
-    splx(spl);
     return retval;
 }
 
+//caller holds core_map.lock
 void free_frame_list_remove(int i) {
-    int spl = splhigh();
+    assert(spinlock_do_i_hold(&core_map.lock));
     debug_claimed_pages++;
     DEBUG(DB_CORE, "[padd] %3d / %3d pages used.\n", debug_claimed_pages, debug_toal_pages_avail);
     assert(core_map.free_frame_list != NULL && core_map.last_free != NULL);
@@ -146,44 +148,55 @@ void free_frame_list_remove(int i) {
     }
     core_map.core_details[i].free = 0;
     core_map.core_details[i].kern = 1;
-    splx(spl);   
 }
 
 int clock_to_index(int c) {
     return (c + core_map.lowest_frame);
 }
 
+/*
+ * Frames eviction must leave alone: kernel pages, and pages of shared
+ * mappings written since they last went back to their file. Those are
+ * only written back by msync, munmap and exit (as_sync_mapping), never
+ * from here, since whatever needs a frame may already be inside the
+ * filesystem the page would be written to.
+ */
+static int cm_unevictable(struct cm_detail *cd) {
+    return cd->kern || (!cd->free && cd->pd != NULL &&
+            cd->pd->seg->shared && cd->pd->modified);
+}
+
 int cm_getppage(){
-    int spl = splhigh();    
+    spinlock_acquire(&core_map.lock);
     struct cm_detail *frame = free_frame_list_pop();
     if (frame == NULL) {
         /*
         if no free pages are available, we need to push a frame into
         swap to make room for a new frame in RAM
          */
-        splx(spl);
+        spinlock_release(&core_map.lock);
         return cm_push_to_swap();
     } else {
         //there is a free page, so return it's index
-        splx(spl);
+        spinlock_release(&core_map.lock);
         return frame->id;
     }
 }
 
 int cm_push_to_swap() {
-    int spl = splhigh();
+    spinlock_acquire(&core_map.lock);
     int i = 0;
 
     for (i = core_map.lowest_frame; i < core_map.size; i++) {
         struct cm_detail *cd = &core_map.core_details[clock_to_index(core_map.clock_pointer)];
-        if (cd->kern == 0) {
+        if (!cm_unevictable(cd)) {
             struct page_detail * pd = cd->pd;
             if (pd == NULL) {
                 panic("FREE PHYSICAL FRAMES NOT IN THE FREE LIST");
             }
             if (pd->use == 0) {
-                //interupts are re-enabled in free core
-                cm_free_core(cd, spl);
+                //the coremap lock is released in free core
+                cm_free_core(cd);
                 return cd->id;
             } else {
                 pd->use = 0;
@@ -194,21 +207,21 @@ int cm_push_to_swap() {
     }
     for (i = core_map.lowest_frame; i < core_map.size; i++) {
         struct cm_detail *cd = &core_map.core_details[clock_to_index(core_map.clock_pointer)];
-        if (cd->kern == 0) {
+        if (!cm_unevictable(cd)) {
             struct page_detail * pd = cd->pd;
 
             if (pd == NULL) {
                 panic("FREE PHYSICAL FRAMES NOT IN THE FREE LIST");
             }
-            //interupts are re-enabled in free core
-            cm_free_core(cd, spl);
+            //the coremap lock is released in free core
+            cm_free_core(cd);
             return cd->id;
 
         }
         core_map.clock_pointer = (core_map.clock_pointer + 1) % (core_map.size - core_map.lowest_frame);
     }
-    splx(spl);
-    //if we get here, then all pages are kernel pages (which must remain in RAM), so we're out of memory. That sucks!
+    spinlock_release(&core_map.lock);
+    //if we get here, then all pages are kernel pages or modified shared pages (which must remain in RAM), so we're out of memory. That sucks!
     panic("Too many kernel pages! No more space in RAM for a new page.");
     return 0;
 }
@@ -222,7 +235,9 @@ void cm_finish_paging(int frame, struct page_detail* pd) {
     core_map.core_details[frame].kern = 0;
 }
 
-void cm_free_core(struct cm_detail *cd, int spl) {
+void cm_free_core(struct cm_detail *cd) {
+    assert(spinlock_do_i_hold(&core_map.lock));
+    assert(!cm_unevictable(cd));
     //invalidate the TLB
     tlb_invalidate_vaddr(cd->pd->vaddr);
     
@@ -233,11 +248,14 @@ void cm_free_core(struct cm_detail *cd, int spl) {
     //set the page to be 'currently swapping (sfn = -2)
     cd->pd->sfn = -2;
     
-    //save to enable interuppts since page is kernel
-    splx(spl);
+    //safe to drop the lock since page is kernel; swapping out may sleep
+    spinlock_release(&core_map.lock);
     
+    //shared mappings are paged in from their file again; modified ones are never picked
+    if (cd->pd->seg->shared) {
+        cd->pd->sfn = -1;
     //only write to swap if its a dirty page
-    if (cd->pd->dirty) {
+    } else if (cd->pd->dirty) {
         //kprintf("WRITING TO SWAP\n");
         cd->pd->sfn = swap_write(cd->id);
     }else{
@@ -252,16 +270,35 @@ void cm_free_core(struct cm_detail *cd, int spl) {
     cd->next_free = NULL;
 }
 
+int cm_pin_page(struct page_detail *pd) {
+    int frame = -1;
+    spinlock_acquire(&core_map.lock);
+    if (pd->valid && pd->pfn >= 0) {
+        frame = pd->pfn;
+        //kernel frames are never picked for eviction
+        core_map.core_details[frame].kern = 1;
+    }
+    spinlock_release(&core_map.lock);
+    return frame;
+}
+
+void cm_unpin_page(int frame) {
+    spinlock_acquire(&core_map.lock);
+    assert(core_map.core_details[frame].kern == 1);
+    core_map.core_details[frame].kern = 0;
+    spinlock_release(&core_map.lock);
+}
+
 vaddr_t cm_request_kframes(int num) {
     assert(core_map.init); //don't call kmalloc before coremap is setup
-    int spl = splhigh();
+    spinlock_acquire(&core_map.lock);
     int frame = -1;
     int i;
     int j;
     for (i = core_map.lowest_frame; i <= core_map.size - num; i++) {
         frame = i;
         for (j = 0; j < num; j++) {
-            if (core_map.core_details[i + j].kern) {
+            if (cm_unevictable(&core_map.core_details[i + j])) {
                 frame = -1;
                 break;
             }
@@ -287,12 +324,12 @@ vaddr_t cm_request_kframes(int num) {
         if (core_map.core_details[i].free) {
             free_frame_list_remove(i);
         } else {
-            cm_free_core(&core_map.core_details[i], spl);
-            spl = splhigh();
+            cm_free_core(&core_map.core_details[i]);
+            spinlock_acquire(&core_map.lock);
         }
 
     }
-    splx(spl);
+    spinlock_release(&core_map.lock);
     return PADDR_TO_KVADDR((paddr_t) (frame * PAGE_SIZE));
 }
 
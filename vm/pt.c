@@ -20,6 +20,7 @@
 #include <vmstats.h>
 #include <coremap.h>
 #include <vm_tlb.h>
+#include <uio.h>
 
 struct page_table* pt_create(struct segment* seg) {
     assert(seg != NULL);
@@ -45,12 +46,27 @@ struct page_table* pt_create(struct segment* seg) {
             pt->page_details[i].valid = 0; //valid bit
             pt->page_details[i].dirty = seg->writeable; //dirty bit (can we modify)
             pt->page_details[i].use = 0; //use bit (have we used the page recently)
+            pt->page_details[i].modified = 0;
+            pt->page_details[i].seg = seg;
     }
     
     return pt;
 }
 
 
+/*
+ * Whether the TLB may let the page be written. Shared mappings go in
+ * read-only until the page is first written, so that the write faults
+ * and pt_mark_modified can note it: only modified pages are written
+ * back to the file.
+ */
+static int pt_tlb_writeable(struct segment *s, struct page_detail *pd) {
+    if (s->shared) {
+        return s->writeable && pd->modified;
+    }
+    return s->writeable;
+}
+
 void pt_page_in(vaddr_t vaddr, struct segment *s) {
     int spl = splhigh();
     _vmstats_inc(VMSTAT_TLB_FAULT);
@@ -62,7 +78,7 @@ void pt_page_in(vaddr_t vaddr, struct segment *s) {
     if (pd->valid && pd->pfn != -1){
         pd->use = 1;
         _vmstats_inc(VMSTAT_TLB_RELOAD);
-        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, s->writeable, 1); 
+        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, pt_tlb_writeable(s, pd), 1);
         splx(spl);
         return;
     }else if(pd->sfn != -1){
@@ -72,21 +88,70 @@ void pt_page_in(vaddr_t vaddr, struct segment *s) {
         swap_read(pd->pfn,pd->sfn);
         pd->sfn = -1;
         //add the tlb entry
-        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, s->writeable, 1);
+        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, pt_tlb_writeable(s, pd), 1);
         //finish the load
         cm_finish_paging(pd->pfn, pd);
     }else{
         splx(spl);
         pd->use = 1;
         pd->pfn = cm_getppage();
-        load_segment_page(curthread->t_vmspace->file, vaddr, s, pd->pfn*PAGE_SIZE);
+        //mmap regions page from their own file; anonymous ones have no
+        //file data (p_filesz is 0), so they are just zero-filled
+        load_segment_page(s->vn != NULL ? s->vn : curthread->t_vmspace->file, vaddr, s, pd->pfn*PAGE_SIZE);
         //add the tlb entry
-        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, s->writeable, 1);
+        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, pt_tlb_writeable(s, pd), 1);
         //finish the load
         cm_finish_paging(pd->pfn, pd);
     }
 }
 
+/*
+ * Called on a write to a page of a shared mapping that the TLB has as
+ * read-only: note that the page must be written back, and let the write
+ * through.
+ */
+void pt_mark_modified(vaddr_t vaddr, struct segment *s) {
+    int spl = splhigh();
+    struct page_detail *pd = &(s->pt->page_details[(vaddr - s->vbase) / PAGE_SIZE]);
+
+    assert(s->shared && s->writeable);
+    pd->modified = 1;
+    if (pd->valid && pd->pfn != -1) {
+        pd->use = 1;
+        //replace the read-only entry; the TLB must not hold two for one page
+        tlb_invalidate_vaddr(vaddr);
+        tlb_add_entry(vaddr, pd->pfn*PAGE_SIZE, 1, 0);
+        splx(spl);
+        return;
+    }
+    splx(spl);
+    //evicted since the fault; it comes back in writeable now
+    pt_page_in(vaddr, s);
+}
+
+/*
+ * Write a page of a shared mapping, in physical frame `frame`, back to
+ * the file. Only the part of the page that maps file data goes out:
+ * writes past the end of the file don't extend it.
+ */
+int pt_write_back(struct segment *s, struct page_detail *pd, int frame) {
+    struct uio u;
+    u_int32_t off = pd->vaddr - s->vbase;
+    size_t len;
+
+    assert(s->vn != NULL);
+    if (off >= s->p_filesz) {
+        return 0;
+    }
+    len = s->p_filesz - off;
+    if (len > PAGE_SIZE) {
+        len = PAGE_SIZE;
+    }
+    elf_cache_invalidate(s->vn);
+    mk_kuio(&u, (void *) PADDR_TO_KVADDR(frame * PAGE_SIZE), len, s->p_offset + off, UIO_WRITE);
+    return VOP_WRITE(s->vn, &u);
+}
+
 void pt_destroy(struct page_table * pt) {
 
     if (pt != NULL) {